@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* SHM-Demoapplication to convert, list and query compressed archive files
+ *
+ * Archives are written by demorecorder -z or converted from trace files,
+ * see lib/mk_shmarchive.h. A range of records is found with the index of
+ * the archive and can be printed or expanded into a trace file, which can be
+ * replayed with demoreplay.
+ *
+ * Usage:
+ * -f [file]    Specifies the archive file
+ * -c [file]    Compresses the trace file into the archive file
+ * -x [file]    Expands the records of the range into the trace file
+ * -p           Prints the records of the range
+ * -l           Lists the blocks of the archive
+ * -b [value]   Specifies the start of the range in seconds after the first record. Default 0
+ * -e [value]   Specifies the end of the range in seconds after the first record. Default end of the archive
+ * -B [value]   Specifies the number of records of a block for -c. Default 1024
+ * -h           Prints this help message and exits
+ *
+ */
+
+#include "../mk_shminterface.h"
+#include "../lib/mk_shmlib.h"
+#include "../lib/mk_shmfields.h"
+#include "../lib/mk_shmtrace.h"
+#include "../lib/mk_shmarchive.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+
+struct demoarchive_t {
+        struct mk_archive archive;
+        char* file;
+        char* compress;
+        char* expand;
+        double begin;
+        double end;
+        uint32_t blocklen;
+        bool flagprint;
+        bool flaglist;
+};
+
+/* Print usage message */
+static void usage(char *appname)
+{
+        fprintf(stderr,
+                "\n"
+                "Usage: %s [options]\n"
+                " -f [file]     Specifies the archive file\n"
+                " -c [file]     Compresses the trace file into the archive file\n"
+                " -x [file]     Expands the records of the range into the trace file\n"
+                " -p            Prints the records of the range\n"
+                " -l            Lists the blocks of the archive\n"
+                " -b [value]    Specifies the start of the range in seconds after the first record. Default 0\n"
+                " -e [value]    Specifies the end of the range in seconds after the first record. Default end of the archive\n"
+                " -B [value]    Specifies the number of records of a block for -c. Default %d\n"
+                " -h            Prints this help message and exits\n"
+                "\n",
+                appname,MK_ARC_BLOCKLEN);
+}
+
+/* Evaluate CLI-parameters */
+void evalCLI(int argc, char* argv[0],struct demoarchive_t * archive)
+{
+        int c;
+        char* appname = strrchr(argv[0], '/');
+        appname = appname ? 1 + appname : argv[0];
+        while (EOF != (c = getopt(argc,argv,"hplf:c:x:b:e:B:"))) {
+                switch(c) {
+                case 'f':
+                        (*archive).file = optarg;
+                        break;
+                case 'c':
+                        (*archive).compress = optarg;
+                        break;
+                case 'x':
+                        (*archive).expand = optarg;
+                        break;
+                case 'p':
+                        (*archive).flagprint = true;
+                        break;
+                case 'l':
+                        (*archive).flaglist = true;
+                        break;
+                case 'b':
+                        (*archive).begin = atof(optarg);
+                        break;
+                case 'e':
+                        (*archive).end = atof(optarg);
+                        break;
+                case 'B':
+                        (*archive).blocklen = atoi(optarg);
+                        break;
+                case 'h':
+                default:
+                        usage(appname);
+                        exit(0);
+                        break;
+                }
+        }
+        if (NULL == (*archive).file) {
+                printf("An archive file needs to be specified\n");
+                exit(0);
+        }
+        if ((NULL != (*archive).compress) && ((NULL != (*archive).expand) || (*archive).flagprint)) {
+                printf("-c can not be combined with -x or -p\n");
+                exit(0);
+        }
+}
+
+/* Compresses a trace file into the archive, returns 0 or -1 on error */
+int compressTrace(struct demoarchive_t* archive)
+{
+        struct mk_trace trace;
+        uint64_t count;
+        uint64_t i;
+
+        if (mk_trace_open(&trace,archive->compress) == -1)
+                return -1;
+        if (mk_archive_create(&archive->archive,archive->file,trace.hdr->segments,trace.hdr->period,archive->blocklen) == -1) {
+                mk_trace_close(&trace);
+                return -1;
+        }
+        count = trace.hdr->count;
+        for (i = 0; i < count; i++) {
+                if (mk_archive_append(&archive->archive,mk_trace_record(&trace,i)) == -1)
+                        break;
+        }
+        mk_archive_close(&archive->archive);
+        printf("%llu records of %llu bytes compressed into %llu bytes, %.1f bytes per record, ratio %.1f\n",
+                (unsigned long long) archive->archive.records,
+                (unsigned long long) (count * sizeof(struct mk_tracerec)),
+                (unsigned long long) archive->archive.bytes,
+                archive->archive.records ? (double) archive->archive.bytes / archive->archive.records : 0.0,
+                archive->archive.bytes ? (double) (count * sizeof(struct mk_tracerec)) / archive->archive.bytes : 0.0);
+        mk_trace_close(&trace);
+        return (i == count) ? 0 : -1;
+}
+
+/* Prints a record with all recorded shared memories */
+void printRecord(const struct mk_archive* arc, const struct mk_tracerec* rec, uint64_t first)
+{
+        char at[64];
+
+        if (arc->hdr.segments & (1 << MK_SHM_MAINOUT)) {
+                snprintf(at,sizeof(at),"%.6f s, cycle %llu",(rec->stamp - first) / 1e9,(unsigned long long) rec->seg[MK_SHM_MAINOUT].cycle);
+                mk_shm_fprint(stdout,MK_SHM_MAINOUT,&rec->mainout,at);
+        }
+        if (arc->hdr.segments & (1 << MK_SHM_ADDOUT)) {
+                snprintf(at,sizeof(at),"%.6f s, cycle %llu",(rec->stamp - first) / 1e9,(unsigned long long) rec->seg[MK_SHM_ADDOUT].cycle);
+                mk_shm_fprint(stdout,MK_SHM_ADDOUT,&rec->addout,at);
+        }
+        if (arc->hdr.segments & (1 << MK_SHM_MAININ)) {
+                snprintf(at,sizeof(at),"%.6f s, cycle %llu",(rec->stamp - first) / 1e9,(unsigned long long) rec->seg[MK_SHM_MAININ].cycle);
+                mk_shm_fprint(stdout,MK_SHM_MAININ,&rec->mainin,at);
+        }
+}
+
+/* Prints or expands the records of the range, returns 0 or -1 on error */
+int queryRange(struct demoarchive_t* archive)
+{
+        struct mk_archive* arc = &archive->archive;
+        struct mk_trace trace;
+        struct mk_tracerec rec;
+        struct mk_tracerec* dst;
+        uint64_t first = arc->index[0].first;
+        uint64_t from = first + (uint64_t) (archive->begin * 1e9);
+        uint64_t to = (archive->end > 0.0) ? first + (uint64_t) (archive->end * 1e9) : UINT64_MAX;
+        uint64_t count = 0;
+        int ok = -1;
+
+        if (mk_archive_seek(arc,from) == -1) {
+                printf("No records in the range\n");
+                return 0;
+        }
+        // the trace file gets space for the whole archive and is truncated to the range on close
+        if ((NULL != archive->expand) && (mk_trace_create(&trace,archive->expand,arc->records,arc->hdr.segments,arc->hdr.period) == -1))
+                return -1;
+        while ((ok = mk_archive_next(arc,&rec)) == 1) {
+                if (rec.stamp > to)
+                        break;
+                if (archive->flagprint)
+                        printRecord(arc,&rec,first);
+                if (NULL != archive->expand) {
+                        dst = mk_trace_next(&trace);
+                        if (NULL == dst)
+                                break;
+                        *dst = rec;
+                        mk_trace_commit(&trace);
+                }
+                count++;
+        }
+        if (NULL != archive->expand) {
+                mk_trace_close(&trace);
+                printf("%llu records expanded into %s\n",(unsigned long long) count,archive->expand);
+        }
+        return (ok == -1) ? -1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+        struct demoarchive_t archive;
+        struct mk_arcindex* idx;
+        uint64_t i;
+        int ok = 0;
+
+        memset(&archive,0,sizeof(archive));
+        archive.blocklen = MK_ARC_BLOCKLEN;
+
+        evalCLI(argc,argv,&archive);
+
+        if (NULL != archive.compress)
+                return (compressTrace(&archive) == -1) ? 1 : 0;
+
+        if (mk_archive_open(&archive.archive,archive.file) == -1)
+                exit(1);
+        printf("%llu records in %llu blocks, %llu bytes, %.1f bytes per record (%zu uncompressed)\n",
+                (unsigned long long) archive.archive.records,(unsigned long long) archive.archive.blocks,
+                (unsigned long long) archive.archive.bytes,
+                archive.archive.records ? (double) archive.archive.bytes / archive.archive.records : 0.0,
+                sizeof(struct mk_tracerec));
+        if (archive.flaglist) {
+                for (i = 0; i < archive.archive.blocks; i++) {
+                        idx = &archive.archive.index[i];
+                        printf("Block %llu: %llu records at offset %llu, %.6f s to %.6f s\n",
+                                (unsigned long long) i,(unsigned long long) idx->count,(unsigned long long) idx->offset,
+                                (idx->first - archive.archive.index[0].first) / 1e9,
+                                (idx->last - archive.archive.index[0].first) / 1e9);
+                }
+        }
+        if ((archive.archive.blocks > 0) && (archive.flagprint || (NULL != archive.expand)))
+                ok = queryRange(&archive);
+        mk_archive_close(&archive.archive);
+
+        return (ok == -1) ? 1 : 0;
+}
@@ -0,0 +1,479 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* SHM-Benchmark of the access paths of the shared memories
+ *
+ * Measures for every selected shared memory the time to attach it as writer
+ * and as reader, the cost of a write and a read without contention and the
+ * cost of the writer while 1 to N reader processes, each pinned to its own
+ * cpu, read continuously. Writes and reads are measured for the seqlock of
+ * libmkshm, for the named semaphore protocol the interface used before and
+ * for a plain copy without any protection as baseline. The results are
+ * printed as csv or json to the standard output. The shared memories are
+ * attached with separate names, so running demo applications are not
+ * disturbed.
+ *
+ * Usage:
+ * -o           Benchmarks main output variables from control
+ * -i           Benchmarks main input variables to control
+ * -a           Benchmarks additional output variables from control
+ *              Without -o, -i and -a all shared memories are benchmarked
+ * -n [value]   Specifies the number of writes and reads. Default 1000000
+ * -A [value]   Specifies the number of attaches. Default 1000
+ * -d [value]   Specifies the duration of each contention run in milliseconds. Default 1000
+ * -R [value]   Specifies the maximum number of reader processes. Default number of cpus - 1
+ * -F [format]  Output format, csv or json. Default csv
+ * -m           Locks the shared memories into RAM
+ * -H           Uses shared memories backed by hugepages (hugetlbfs)
+ * -h           Prints this help message and exits
+ *
+ */
+
+#define _GNU_SOURCE
+#include "../mk_shminterface.h"
+#include "../lib/mk_shmlib.h"
+#include "../lib/mk_shmhist.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// operations between two timestamps, so the cost of reading the clock is negligible
+#define BENCH_BATCH 64
+#define BENCH_MAXREADERS 64
+#define BENCH_SEMNAME "/MK_BENCH_SEM"
+
+// protocols to access the content of a shared memory
+enum bench_proto {
+        BENCH_NONE = 0,         // plain copy, reads may be torn
+        BENCH_SEM,              // named semaphore around every access
+        BENCH_SEQLOCK,          // seqlock of libmkshm
+        BENCH_PROTOCNT
+};
+
+static const char* protonames[BENCH_PROTOCNT] = { "none", "semaphore", "seqlock" };
+
+// shared memory to benchmark
+struct bench_seg {
+        const char* name;       // name of the shared memory used by the benchmark
+        const char* label;      // name in the results
+        size_t size;            // size of the shared memory struct
+        size_t offset;          // offset of the content
+        size_t len;             // size of the content
+};
+
+static const struct bench_seg segs[MK_SHM_SEGCNT] = {
+        { "MK_BENCH_MAINOUT", MK_MAINOUTKEY, sizeof(struct mk_mainoutput_shm), offsetof(struct mk_mainoutput_shm, data), sizeof(mk_mainoutput_t) },
+        { "MK_BENCH_MAININ", MK_MAININKEY, sizeof(struct mk_maininput_shm), offsetof(struct mk_maininput_shm, data), sizeof(mk_maininput_t) },
+        { "MK_BENCH_ADDOUT", MK_ADDAOUTKEY, sizeof(struct mk_additionaloutput_shm), offsetof(struct mk_additionaloutput_shm, data), sizeof(mk_additionaloutput_t) },
+};
+
+// state shared between the writer and the reader processes of a contention run
+struct bench_shared {
+        uint32_t ready;
+        uint32_t start;
+        uint32_t stop;
+        struct {
+                uint64_t ops;
+                uint64_t retries;
+        } reader[BENCH_MAXREADERS];
+};
+
+struct demobench_t {
+        bool flagseg[MK_SHM_SEGCNT];
+        uint64_t iterations;
+        uint64_t attaches;
+        uint32_t duration;
+        int readers;
+        int cpus;
+        int shmflags;
+        bool json;
+        uint64_t rows;
+        sem_t* sem;
+        struct mk_hist* hist;
+};
+
+/* Print usage message */
+static void usage(char *appname)
+{
+        fprintf(stderr,
+                "\n"
+                "Usage: %s [options]\n"
+                " -o            Benchmarks main output variables from control\n"
+                " -i            Benchmarks main input variables to control\n"
+                " -a            Benchmarks additional output variables from control\n"
+                "               Without -o, -i and -a all shared memories are benchmarked\n"
+                " -n [value]    Specifies the number of writes and reads. Default 1000000\n"
+                " -A [value]    Specifies the number of attaches. Default 1000\n"
+                " -d [value]    Specifies the duration of each contention run in milliseconds. Default 1000\n"
+                " -R [value]    Specifies the maximum number of reader processes. Default number of cpus - 1\n"
+                " -F [format]   Output format, csv or json. Default csv\n"
+                " -m            Locks the shared memories into RAM\n"
+                " -H            Uses shared memories backed by hugepages (hugetlbfs)\n"
+                " -h            Prints this help message and exits\n"
+                "\n",
+                appname);
+}
+
+/* Evaluate CLI-parameters */
+void evalCLI(int argc, char* argv[0],struct demobench_t * bench)
+{
+        int c;
+        char* appname = strrchr(argv[0], '/');
+        appname = appname ? 1 + appname : argv[0];
+        while (EOF != (c = getopt(argc,argv,"oiahmHn:A:d:R:F:"))) {
+                switch(c) {
+                case 'o':
+                        (*bench).flagseg[MK_SHM_MAINOUT] = true;
+                        break;
+                case 'i':
+                        (*bench).flagseg[MK_SHM_MAININ] = true;
+                        break;
+                case 'a':
+                        (*bench).flagseg[MK_SHM_ADDOUT] = true;
+                        break;
+                case 'n':
+                        (*bench).iterations = strtoull(optarg,NULL,10);
+                        break;
+                case 'A':
+                        (*bench).attaches = strtoull(optarg,NULL,10);
+                        break;
+                case 'd':
+                        (*bench).duration = atoi(optarg);
+                        break;
+                case 'R':
+                        (*bench).readers = atoi(optarg);
+                        break;
+                case 'F':
+                        if (strcmp(optarg,"json") == 0) {
+                                (*bench).json = true;
+                        } else if (strcmp(optarg,"csv") != 0) {
+                                usage(appname);
+                                exit(0);
+                        }
+                        break;
+                case 'm':
+                        (*bench).shmflags |= MK_SHM_MLOCK;
+                        break;
+                case 'H':
+                        (*bench).shmflags |= MK_SHM_HUGEPAGE;
+                        break;
+                case 'h':
+                default:
+                        usage(appname);
+                        exit(0);
+                        break;
+                }
+        }
+        if (!(*bench).flagseg[MK_SHM_MAINOUT] && !(*bench).flagseg[MK_SHM_MAININ] && !(*bench).flagseg[MK_SHM_ADDOUT]) {
+                (*bench).flagseg[MK_SHM_MAINOUT] = true;
+                (*bench).flagseg[MK_SHM_MAININ] = true;
+                (*bench).flagseg[MK_SHM_ADDOUT] = true;
+        }
+        if ((*bench).readers < 1)
+                (*bench).readers = 1;
+        if ((*bench).readers > BENCH_MAXREADERS)
+                (*bench).readers = BENCH_MAXREADERS;
+}
+
+/* Returns the current CLOCK_MONOTONIC time in ns */
+static inline uint64_t nowNs(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC,&ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Keeps the compiler from dropping copies which are never used */
+static inline void clobber(void* p)
+{
+        __asm__ __volatile__("" :: "r"(p) : "memory");
+}
+
+/* Pins the calling process to a cpu */
+static void pinCpu(int cpu)
+{
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu,&cpus);
+        if (sched_setaffinity(0,sizeof(cpus),&cpus) == -1)
+                perror("Setting cpu affinity failed");
+}
+
+/* Writes the content of a shared memory with a protocol */
+static inline void benchWrite(struct demobench_t* bench, enum bench_proto proto, void* addr, const struct bench_seg* seg, const void* src, uint64_t cycle)
+{
+        switch (proto) {
+        case BENCH_NONE:
+                memcpy((char*) addr + seg->offset,src,seg->len);
+                break;
+        case BENCH_SEM:
+                sem_wait(bench->sem);
+                memcpy((char*) addr + seg->offset,src,seg->len);
+                sem_post(bench->sem);
+                break;
+        default:
+                mk_shm_write((struct mk_shmhdr*) addr,(char*) addr + seg->offset,src,seg->len,cycle,0);
+                break;
+        }
+}
+
+/* Reads the content of a shared memory with a protocol, returns the number of retries */
+static inline uint64_t benchRead(struct demobench_t* bench, enum bench_proto proto, const void* addr, const struct bench_seg* seg, void* dst)
+{
+        const struct mk_shmhdr* hdr = (const struct mk_shmhdr*) addr;
+        uint64_t retries = 0;
+        uint32_t seq;
+        switch (proto) {
+        case BENCH_NONE:
+                memcpy(dst,(const char*) addr + seg->offset,seg->len);
+                break;
+        case BENCH_SEM:
+                sem_wait(bench->sem);
+                memcpy(dst,(const char*) addr + seg->offset,seg->len);
+                sem_post(bench->sem);
+                break;
+        default:
+                seq = mk_shm_readbegin(hdr);
+                memcpy(dst,(const char*) addr + seg->offset,seg->len);
+                while (mk_shm_readretry(hdr,seq)) {
+                        retries++;
+                        seq = mk_shm_readbegin(hdr);
+                        memcpy(dst,(const char*) addr + seg->offset,seg->len);
+                }
+                break;
+        }
+        clobber(dst);
+        return retries;
+}
+
+/* Prints one result of ops operations, the histogram holds the cost of one operation in ns */
+static void printRow(struct demobench_t* bench, const char* benchmark, const struct bench_seg* seg, const char* proto, int readers, uint64_t ops, double readerops, uint64_t retries)
+{
+        const struct mk_hist* hist = bench->hist;
+        double mean = hist->count ? (double) hist->sum / hist->count : 0;
+        if (bench->json) {
+                printf("%s\n  {\"benchmark\": \"%s\", \"segment\": \"%s\", \"protocol\": \"%s\", \"readers\": %d, \"ops\": %llu, "
+                       "\"mean_ns\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu, \"reader_ops_per_s\": %.0f, \"reader_retries\": %llu}",
+                       bench->rows ? "," : "[",benchmark,seg->label,proto,readers,(unsigned long long) ops,mean,
+                       (unsigned long long) mk_hist_percentile(hist,50.0),(unsigned long long) mk_hist_percentile(hist,99.0),
+                       (unsigned long long) hist->max,readerops,(unsigned long long) retries);
+        } else {
+                if (bench->rows == 0)
+                        printf("benchmark,segment,protocol,readers,ops,mean_ns,p50_ns,p99_ns,max_ns,reader_ops_per_s,reader_retries\n");
+                printf("%s,%s,%s,%d,%llu,%.1f,%llu,%llu,%llu,%.0f,%llu\n",benchmark,seg->label,proto,readers,(unsigned long long) ops,mean,
+                       (unsigned long long) mk_hist_percentile(hist,50.0),(unsigned long long) mk_hist_percentile(hist,99.0),
+                       (unsigned long long) hist->max,readerops,(unsigned long long) retries);
+        }
+        fflush(stdout);
+        bench->rows++;
+}
+
+/* Measures attaching and detaching a shared memory as writer and as reader */
+static void benchAttach(struct demobench_t* bench, const struct bench_seg* seg)
+{
+        struct mk_shm shm;
+        struct mk_shm owner;
+        uint64_t i;
+        uint64_t t0;
+
+        mk_hist_init(bench->hist);
+        for (i = 0; i < bench->attaches; i++) {
+                t0 = nowNs();
+                if (NULL == mk_shm_attachname(&shm,seg->name,seg->size,bench->shmflags | MK_SHM_WRITER))
+                        return;
+                mk_hist_record(bench->hist,nowNs() - t0);
+                mk_shm_detach(&shm);
+        }
+        printRow(bench,"attach_writer",seg,"-",0,bench->hist->count,0,0);
+
+        if (NULL == mk_shm_attachname(&owner,seg->name,seg->size,bench->shmflags | MK_SHM_WRITER))
+                return;
+        mk_hist_init(bench->hist);
+        for (i = 0; i < bench->attaches; i++) {
+                t0 = nowNs();
+                if (NULL == mk_shm_attachname(&shm,seg->name,seg->size,bench->shmflags))
+                        break;
+                mk_hist_record(bench->hist,nowNs() - t0);
+                mk_shm_detach(&shm);
+        }
+        mk_shm_detach(&owner);
+        printRow(bench,"attach_reader",seg,"-",0,bench->hist->count,0,0);
+}
+
+/* Measures writes and reads without contention */
+static void benchAccess(struct demobench_t* bench, const struct bench_seg* seg, void* addr, enum bench_proto proto)
+{
+        char buf[256];
+        uint64_t i;
+        uint64_t j;
+        uint64_t t0;
+        uint64_t retries = 0;
+
+        memset(buf,0x5a,sizeof(buf));
+        mk_hist_init(bench->hist);
+        for (i = 0; i < bench->iterations; i += BENCH_BATCH) {
+                t0 = nowNs();
+                for (j = 0; j < BENCH_BATCH; j++)
+                        benchWrite(bench,proto,addr,seg,buf,i + j);
+                mk_hist_record(bench->hist,(nowNs() - t0) / BENCH_BATCH);
+        }
+        printRow(bench,"write",seg,protonames[proto],0,bench->hist->count * BENCH_BATCH,0,0);
+
+        mk_hist_init(bench->hist);
+        for (i = 0; i < bench->iterations; i += BENCH_BATCH) {
+                t0 = nowNs();
+                for (j = 0; j < BENCH_BATCH; j++)
+                        retries += benchRead(bench,proto,addr,seg,buf);
+                mk_hist_record(bench->hist,(nowNs() - t0) / BENCH_BATCH);
+        }
+        printRow(bench,"read",seg,protonames[proto],0,bench->hist->count * BENCH_BATCH,0,retries);
+}
+
+/* Reader process of a contention run */
+static void contentionReader(struct demobench_t* bench, const struct bench_seg* seg, const void* addr, enum bench_proto proto, struct bench_shared* shared, int id)
+{
+        char buf[256];
+        uint64_t ops = 0;
+        uint64_t retries = 0;
+
+        pinCpu((id + 1) % bench->cpus);
+        __atomic_add_fetch(&shared->ready,1,__ATOMIC_RELEASE);
+        while (!__atomic_load_n(&shared->start,__ATOMIC_ACQUIRE))
+                mk_cpurelax();
+        while (!__atomic_load_n(&shared->stop,__ATOMIC_RELAXED)) {
+                retries += benchRead(bench,proto,addr,seg,buf);
+                ops++;
+        }
+        shared->reader[id].ops = ops;
+        shared->reader[id].retries = retries;
+        _exit(0);
+}
+
+/* Measures the writer while readers read continuously */
+static void benchContention(struct demobench_t* bench, const struct bench_seg* seg, void* addr, enum bench_proto proto, int readers)
+{
+        struct bench_shared* shared;
+        char buf[256];
+        pid_t pids[BENCH_MAXREADERS];
+        uint64_t cycle = 0;
+        uint64_t start;
+        uint64_t end;
+        uint64_t t0;
+        uint64_t ops = 0;
+        uint64_t retries = 0;
+        int started;
+        int i;
+        int j;
+
+        shared = mmap(NULL,sizeof(*shared),PROT_READ | PROT_WRITE,MAP_SHARED | MAP_ANONYMOUS,-1,0);
+        if (MAP_FAILED == shared) {
+                perror("Mapping shared state failed");
+                return;
+        }
+        memset(shared,0,sizeof(*shared));
+        memset(buf,0x5a,sizeof(buf));
+        fflush(stdout);
+        for (started = 0; started < readers; started++) {
+                pids[started] = fork();
+                if (pids[started] == -1) {
+                        perror("Starting reader failed");
+                        break;
+                }
+                if (pids[started] == 0)
+                        contentionReader(bench,seg,addr,proto,shared,started);
+        }
+        while (__atomic_load_n(&shared->ready,__ATOMIC_ACQUIRE) < (uint32_t) started)
+                sched_yield();
+
+        mk_hist_init(bench->hist);
+        __atomic_store_n(&shared->start,1,__ATOMIC_RELEASE);
+        start = nowNs();
+        end = start + (uint64_t) bench->duration * 1000000ULL;
+        do {
+                t0 = nowNs();
+                for (j = 0; j < BENCH_BATCH; j++)
+                        benchWrite(bench,proto,addr,seg,buf,cycle++);
+                mk_hist_record(bench->hist,(nowNs() - t0) / BENCH_BATCH);
+        } while (t0 < end);
+        __atomic_store_n(&shared->stop,1,__ATOMIC_RELEASE);
+        end = nowNs();
+        for (i = 0; i < started; i++) {
+                waitpid(pids[i],NULL,0);
+                ops += shared->reader[i].ops;
+                retries += shared->reader[i].retries;
+        }
+        printRow(bench,"contention",seg,protonames[proto],started,cycle,(double) ops * 1e9 / (end - start),retries);
+        munmap(shared,sizeof(*shared));
+}
+
+int main(int argc, char* argv[])
+{
+        struct demobench_t bench;
+        struct mk_shm shm;
+        void* addr;
+        int s;
+        int p;
+        int r;
+
+        memset(&bench,0,sizeof(bench));
+        bench.iterations = 1000000;
+        bench.attaches = 1000;
+        bench.duration = 1000;          // 1 second
+        bench.cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (bench.cpus < 1)
+                bench.cpus = 1;
+        bench.readers = bench.cpus - 1;
+        bench.shmflags = MK_SHM_POPULATE;
+
+        evalCLI(argc,argv,&bench);
+
+        bench.hist = malloc(sizeof(*bench.hist));
+        if (NULL == bench.hist) {
+                perror("Allocating histogram failed");
+                exit(1);
+        }
+        sem_unlink(BENCH_SEMNAME);
+        bench.sem = sem_open(BENCH_SEMNAME,O_CREAT,0666,1);
+        if (bench.sem == SEM_FAILED) {
+                perror("Semaphore Open failed");
+                exit(1);
+        }
+
+        // the writer runs on the first cpu, the readers on the following ones
+        pinCpu(0);
+        for (s = 0; s < MK_SHM_SEGCNT; s++) {
+                if (!bench.flagseg[s])
+                        continue;
+                benchAttach(&bench,&segs[s]);
+                addr = mk_shm_attachname(&shm,segs[s].name,segs[s].size,bench.shmflags | MK_SHM_WRITER);
+                if (NULL == addr)
+                        continue;
+                for (p = 0; p < BENCH_PROTOCNT; p++)
+                        benchAccess(&bench,&segs[s],addr,p);
+                for (p = 0; p < BENCH_PROTOCNT; p++)
+                        for (r = 1; r <= bench.readers; r++)
+                                benchContention(&bench,&segs[s],addr,p,r);
+                mk_shm_detach(&shm);
+        }
+        if (bench.json && bench.rows)
+                printf("\n]\n");
+
+        // cleanup
+        sem_close(bench.sem);
+        sem_unlink(BENCH_SEMNAME);
+        free(bench.hist);
+
+        return 0;
+}
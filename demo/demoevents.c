@@ -0,0 +1,335 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* SHM-Demoapplication to detect following errors and faults
+ *
+ * The daemon runs the event detector with every update of the writer and
+ * pushes the events into the event queue, see lib/mk_shmevents.h. With -p
+ * it is the consumer of the event queue instead: it creates the queue,
+ * waits for events and prints them. The consumer has to be started first,
+ * any number of detectors can push into its queue.
+ *
+ * Usage:
+ * -o           Samples main output variables from control
+ * -i           Samples main input variables to control
+ * -a           Samples additional output variables from control
+ * -E [value]   Specifies the limit of the following errors in mm, 0 disables the check. Default 1
+ * -R [value]   Specifies the limit of the rates of the actual positions in mm/s, 0 disables the check. Default 1000
+ * -I [value]   Specifies the instance of the interface. Default MK_SHM_INSTANCE or 0
+ * -p           Consumes and prints the events instead of detecting them
+ * -q [value]   Specifies the depth of the event queue created with -p (power of two). Default 1024
+ * -t [value]   Specifies sampling-period in milliseconds. Default update-period of the writer
+ * -u [value]   Specifies sampling-period in microseconds
+ * -w           Waits for updates of the writer instead of polling, at most one period
+ * -m           Locks the shared memories into RAM
+ * -H           Uses shared memories backed by hugepages (hugetlbfs)
+ * -h           Prints this help message and exits
+ *
+ */
+
+#include "../mk_shminterface.h"
+#include "../lib/mk_shmlib.h"
+#include "../lib/mk_shmevents.h"
+#include "../lib/mk_shmsnap.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+
+// sampling period if neither given nor announced by the writer
+#define DEMOEVENTS_PERIOD 1000
+
+uint8_t run = 1;
+
+struct demoevents_t {
+        struct mk_mainoutput_shm * mainout;
+        struct mk_maininput_shm * mainin;
+        struct mk_additionaloutput_shm * addout;
+        struct mk_eventq * queue;
+        struct mk_shm shm_mainout;
+        struct mk_shm shm_mainin;
+        struct mk_shm shm_addout;
+        struct mk_shm shm_queue;
+        const struct mk_shmhdr* waithdr;        //selected shared memory published last in a cycle
+        struct mk_detector det;
+        struct mk_snapset snapset;
+        struct mk_snapshot snap;
+        struct mk_mainoutput wire_mainout;
+        struct mk_additionaloutput wire_addout;
+        struct mk_maininput wire_mainin;
+        double ferror;
+        double rate;
+        uint32_t seq;           //seq of the last sample
+        uint32_t depth;
+        uint32_t inst;
+        uint32_t period;
+        int shmflags;
+        bool flagmainout;
+        bool flagmainin;
+        bool flagaddout;
+        bool flagprint;
+        bool flagwait;
+        uint64_t samples;
+};
+
+/* signal handler */
+void sigfunc(int sig)
+{
+        switch(sig)
+        {
+        case SIGINT:
+                if(run)
+                        run = 0;
+                else
+                        exit(0);
+                break;
+        case SIGTERM:
+                run = 0;
+                break;
+        }
+}
+
+/* Print usage message */
+static void usage(char *appname)
+{
+        fprintf(stderr,
+                "\n"
+                "Usage: %s [options]\n"
+                " -o            Samples main output variables from control\n"
+                " -i            Samples main input variables to control\n"
+                " -a            Samples additional output variables from control\n"
+                " -E [value]    Specifies the limit of the following errors in mm, 0 disables the check. Default 1\n"
+                " -R [value]    Specifies the limit of the rates of the actual positions in mm/s, 0 disables the check. Default 1000\n"
+                " -I [value]    Specifies the instance of the interface. Default MK_SHM_INSTANCE or 0\n"
+                " -p            Consumes and prints the events instead of detecting them\n"
+                " -q [value]    Specifies the depth of the event queue created with -p (power of two). Default 1024\n"
+                " -t [value]    Specifies sampling-period in milliseconds. Default update-period of the writer\n"
+                " -u [value]    Specifies sampling-period in microseconds\n"
+                " -w            Waits for updates of the writer instead of polling, at most one period\n"
+                " -m            Locks the shared memories into RAM\n"
+                " -H            Uses shared memories backed by hugepages (hugetlbfs)\n"
+                " -h            Prints this help message and exits\n"
+                "\n",
+                appname);
+}
+
+/* Evaluate CLI-parameters */
+void evalCLI(int argc, char* argv[0],struct demoevents_t * events)
+{
+        int c;
+        char* appname = strrchr(argv[0], '/');
+        appname = appname ? 1 + appname : argv[0];
+        while (EOF != (c = getopt(argc,argv,"oiahmHwpE:R:I:q:t:u:"))) {
+                switch(c) {
+                case 'o':
+                        (*events).flagmainout = true;
+                        break;
+                case 'i':
+                        (*events).flagmainin = true;
+                        break;
+                case 'a':
+                        (*events).flagaddout = true;
+                        break;
+                case 'E':
+                        (*events).ferror = atof(optarg);
+                        break;
+                case 'R':
+                        (*events).rate = atof(optarg);
+                        break;
+                case 'I':
+                        (*events).inst = atoi(optarg);
+                        break;
+                case 'p':
+                        (*events).flagprint = true;
+                        break;
+                case 'q':
+                        (*events).depth = atoi(optarg);
+                        break;
+                case 'm':
+                        (*events).shmflags |= MK_SHM_MLOCK;
+                        break;
+                case 'H':
+                        (*events).shmflags |= MK_SHM_HUGEPAGE;
+                        break;
+                case 'w':
+                        (*events).flagwait = true;
+                        break;
+                case 't':
+                        (*events).period = atoi(optarg)*1000;
+                        break;
+                case 'u':
+                        (*events).period = atoi(optarg);
+                        break;
+                case 'h':
+                default:
+                        usage(appname);
+                        exit(0);
+                        break;
+                }
+        }
+        // sample all shared memories if none is selected
+        if (!(*events).flagmainout && !(*events).flagmainin && !(*events).flagaddout) {
+                (*events).flagmainout = true;
+                (*events).flagmainin = true;
+                (*events).flagaddout = true;
+        }
+}
+
+/* Reads a cycle-coherent snapshot of the selected shared memories and runs the detector */
+void sample(struct demoevents_t* events)
+{
+        uint32_t seq;
+
+        // nothing published yet, no update since the last sample or update in progress
+        seq = __atomic_load_n(&events->waithdr->seq, __ATOMIC_ACQUIRE);
+        if ((seq == events->seq) || (events->waithdr->stamp == 0) || (seq & 1))
+                return;
+        // setpoints and actual positions of the same cycle, otherwise the following error is off by one cycle
+        if (mk_snap_read(&events->snapset,&events->snap,MK_SNAP_TRIES) == -1)
+                return;
+        if (NULL != events->mainout)
+                mk_mainoutput_towire(&events->wire_mainout,&events->snap.mainout);
+        if (NULL != events->addout)
+                mk_additionaloutput_towire(&events->wire_addout,&events->snap.addout);
+        if (NULL != events->mainin)
+                mk_maininput_towire(&events->wire_mainin,&events->snap.mainin);
+        events->seq = seq;
+        events->samples++;
+        mk_detector_run(&events->det,events->queue,events->snap.cycle,events->snap.stamp,
+                events->mainout ? &events->wire_mainout : NULL,
+                events->addout ? &events->wire_addout : NULL,
+                events->mainin ? &events->wire_mainin : NULL);
+}
+
+/* Creates the event queue and prints the events until terminated */
+int consumeEvents(struct demoevents_t* events)
+{
+        struct mk_event ev;
+        uint64_t count = 0;
+        uint32_t seq;
+
+        events->queue = mk_events_attach(&events->shm_queue,events->inst,events->depth,events->shmflags | MK_SHM_WRITER | MK_SHM_NOTIFY);
+        if (NULL == events->queue)
+                return -1;
+        if (events->period == 0)
+                events->period = 1000000;
+        printf("Consuming events of %s\n",events->shm_queue.name);
+        fflush(stdout);
+        while(run) {
+                // seq is read before popping, so no event pushed meanwhile is missed by the wait
+                seq = __atomic_load_n(&events->queue->hdr.seq, __ATOMIC_ACQUIRE);
+                while (mk_events_pop(events->queue,&ev)) {
+                        mk_events_fprint(stdout,&ev);
+                        count++;
+                }
+                fflush(stdout);
+                mk_shm_wait(&events->queue->hdr,seq,events->period);
+        }
+        printf("%llu events, %llu dropped because the queue was full\n",
+                (unsigned long long) count,(unsigned long long) __atomic_load_n(&events->queue->dropped, __ATOMIC_RELAXED));
+        mk_shm_detach(&events->shm_queue);
+        return 0;
+}
+
+int main(int argc, char* argv[])
+{
+        struct demoevents_t events;
+        struct mk_detlimits limits;
+        struct timespec next;
+        uint32_t waitseq;
+        uint64_t rounds = 0;
+        int i;
+
+        memset(&events,0,sizeof(events));
+        events.shmflags = MK_SHM_POPULATE;
+        events.ferror = 1.0;
+        events.rate = 1000.0;
+        events.depth = 1024;
+        events.inst = mk_shm_instance();
+
+        evalCLI(argc,argv,&events);
+
+        //register signal handlers
+        signal(SIGTERM, sigfunc);
+        signal(SIGINT, sigfunc);
+
+        if (events.flagprint) {
+                if (consumeEvents(&events) == -1)
+                        exit(1);
+                return 0;
+        }
+
+        // open and setup shm mapping
+        if (events.flagmainout)
+                events.mainout = (struct mk_mainoutput_shm *) mk_shm_attach_inst(&events.shm_mainout,MK_SHM_MAINOUT,events.inst,events.shmflags);
+        if (events.flagaddout)
+                events.addout = (struct mk_additionaloutput_shm *) mk_shm_attach_inst(&events.shm_addout,MK_SHM_ADDOUT,events.inst,events.shmflags);
+        if (events.flagmainin)
+                events.mainin = (struct mk_maininput_shm *) mk_shm_attach_inst(&events.shm_mainin,MK_SHM_MAININ,events.inst,events.shmflags);
+        mk_snap_init(&events.snapset);
+        mk_snap_add(&events.snapset,MK_SHM_MAINOUT,events.mainout);
+        mk_snap_add(&events.snapset,MK_SHM_ADDOUT,events.addout);
+        mk_snap_add(&events.snapset,MK_SHM_MAININ,events.mainin);
+        // wake up on the shared memory published last, the others of the cycle are published then
+        if (events.snapset.segments == 0)
+                exit(1);
+        events.waithdr = events.snapset.hdr[mk_shm_lastseg(events.snapset.segments)];
+        events.queue = mk_events_attach(&events.shm_queue,events.inst,0,events.shmflags | MK_SHM_SHARED);
+        if (NULL == events.queue) {
+                printf("The event queue is created by the consumer, start it first with -p\n");
+                exit(1);
+        }
+
+        if (events.period == 0)
+                events.period = events.waithdr->period ? events.waithdr->period : DEMOEVENTS_PERIOD;
+        for (i = 0; i < MK_EVENTS_AXES; i++) {
+                limits.ferror[i] = events.ferror;
+                limits.rate[i] = events.rate;
+        }
+        mk_detector_init(&events.det,&limits,events.inst);
+
+        // mainloop
+        clock_gettime(CLOCK_MONOTONIC,&next);
+        while(run) {
+                sample(&events);
+                rounds++;
+
+                if (events.flagwait) {
+                        // before the first update of the writer wait for any change of seq
+                        waitseq = events.seq;
+                        if (events.waithdr->stamp == 0)
+                                waitseq = __atomic_load_n(&events.waithdr->seq, __ATOMIC_ACQUIRE);
+                        mk_shm_wait(events.waithdr,waitseq,events.period);
+                } else {
+                        next.tv_nsec += (long) events.period * 1000;
+                        while (next.tv_nsec >= 1000000000L) {
+                                next.tv_nsec -= 1000000000L;
+                                next.tv_sec++;
+                        }
+                        clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&next,NULL);
+                }
+        }
+
+        // cleanup
+        printf("%llu rounds, %llu samples, %llu events detected, %llu dropped because the queue was full\n",
+                (unsigned long long) rounds,(unsigned long long) events.samples,
+                (unsigned long long) events.det.events,(unsigned long long) events.det.dropped);
+        printf("%llu samples of different cycles, %llu pairs of different writers skewed, %llu reads repeated\n",
+                (unsigned long long) events.snapset.incoherent,(unsigned long long) events.snapset.skewed,(unsigned long long) events.snapset.retries);
+        mk_shm_detach(&events.shm_queue);
+        if (NULL != events.mainout)
+                mk_shm_detach(&events.shm_mainout);
+        if (NULL != events.addout)
+                mk_shm_detach(&events.shm_addout);
+        if (NULL != events.mainin)
+                mk_shm_detach(&events.shm_mainin);
+
+        return 0;
+}
@@ -0,0 +1,509 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* SHM-Demoapplication to fan out the shared memories to many local clients
+ *
+ * The daemon is the only process reading the shared memories. It samples
+ * them once per cycle and pushes every update to the subscribed clients over
+ * a unix domain socket (SOCK_SEQPACKET), all samples due for a client in one
+ * sendmmsg call. See lib/mk_shmfanout.h for the protocol.
+ *
+ * Usage:
+ * -o           Samples main output variables from control
+ * -i           Samples main input variables to control
+ * -a           Samples additional output variables from control
+ * -s [path]    Specifies the path of the socket. Default /tmp/mk_shmfanout.sock
+ * -C [value]   Specifies the maximum number of clients. Default 64
+ * -t [value]   Specifies sampling-period in milliseconds. Default update-period of the writer
+ * -u [value]   Specifies sampling-period in microseconds
+ * -w           Waits for updates of the writer instead of polling, at most one period
+ * -m           Locks the shared memories into RAM
+ * -H           Uses shared memories backed by hugepages (hugetlbfs)
+ * -h           Prints this help message and exits
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "../mk_shminterface.h"
+#include "../lib/mk_shmlib.h"
+#include "../lib/mk_shmfanout.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+// sampling period if neither given nor announced by the writer
+#define DEMOFANOUT_PERIOD 1000
+
+uint8_t run = 1;
+
+// latest sample of a shared memory, shared by the messages to all clients
+struct fanseg_t {
+        const struct mk_shmhdr* hdr;
+        uint32_t seq;           //seq of the sample
+        struct mk_fanout_msghdr msg;
+        union {
+                struct mk_mainoutput mainout;
+                struct mk_maininput mainin;
+                struct mk_additionaloutput addout;
+        } wire;
+        struct iovec iov[2];
+};
+
+struct client_t {
+        int fd;                 //-1 if unused
+        uint32_t segments;      //subscribed shared memories, 0 until subscribed
+        uint64_t interval;      //minimum interval between samples in ns
+        uint64_t last;          //time of the last sent samples
+        uint32_t seq[MK_SHM_SEGCNT];    //seq of the last sample sent per shared memory
+        uint64_t sent;
+        uint64_t dropped;
+};
+
+struct demofanout_t {
+        struct mk_mainoutput_shm * mainout;
+        struct mk_maininput_shm * mainin;
+        struct mk_additionaloutput_shm * addout;
+        struct mk_shm shm_mainout;
+        struct mk_shm shm_mainin;
+        struct mk_shm shm_addout;
+        struct fanseg_t seg[MK_SHM_SEGCNT];
+        struct client_t* clients;
+        struct pollfd* fds;     //listening socket and clients
+        const char* path;
+        int listenfd;
+        int shmflags;
+        uint32_t segments;
+        uint32_t maxclients;
+        uint32_t period;
+        bool flagmainout;
+        bool flagmainin;
+        bool flagaddout;
+        bool flagwait;
+        uint64_t connects;
+        uint64_t sent;
+        uint64_t dropped;
+};
+
+/* signal handler */
+void sigfunc(int sig)
+{
+        switch(sig)
+        {
+        case SIGINT:
+                if(run)
+                        run = 0;
+                else
+                        exit(0);
+                break;
+        case SIGTERM:
+                run = 0;
+                break;
+        }
+}
+
+/* Print usage message */
+static void usage(char *appname)
+{
+        fprintf(stderr,
+                "\n"
+                "Usage: %s [options]\n"
+                " -o            Samples main output variables from control\n"
+                " -i            Samples main input variables to control\n"
+                " -a            Samples additional output variables from control\n"
+                " -s [path]     Specifies the path of the socket. Default %s\n"
+                " -C [value]    Specifies the maximum number of clients. Default 64\n"
+                " -t [value]    Specifies sampling-period in milliseconds. Default update-period of the writer\n"
+                " -u [value]    Specifies sampling-period in microseconds\n"
+                " -w            Waits for updates of the writer instead of polling, at most one period\n"
+                " -m            Locks the shared memories into RAM\n"
+                " -H            Uses shared memories backed by hugepages (hugetlbfs)\n"
+                " -h            Prints this help message and exits\n"
+                "\n",
+                appname,MK_FANOUT_PATH);
+}
+
+/* Evaluate CLI-parameters */
+void evalCLI(int argc, char* argv[0],struct demofanout_t * fanout)
+{
+        int c;
+        char* appname = strrchr(argv[0], '/');
+        appname = appname ? 1 + appname : argv[0];
+        while (EOF != (c = getopt(argc,argv,"oiahmHws:C:t:u:"))) {
+                switch(c) {
+                case 'o':
+                        (*fanout).flagmainout = true;
+                        break;
+                case 'i':
+                        (*fanout).flagmainin = true;
+                        break;
+                case 'a':
+                        (*fanout).flagaddout = true;
+                        break;
+                case 's':
+                        (*fanout).path = optarg;
+                        break;
+                case 'C':
+                        (*fanout).maxclients = atoi(optarg);
+                        break;
+                case 'm':
+                        (*fanout).shmflags |= MK_SHM_MLOCK;
+                        break;
+                case 'H':
+                        (*fanout).shmflags |= MK_SHM_HUGEPAGE;
+                        break;
+                case 'w':
+                        (*fanout).flagwait = true;
+                        break;
+                case 't':
+                        (*fanout).period = atoi(optarg)*1000;
+                        break;
+                case 'u':
+                        (*fanout).period = atoi(optarg);
+                        break;
+                case 'h':
+                default:
+                        usage(appname);
+                        exit(0);
+                        break;
+                }
+        }
+        // sample all shared memories if none is selected
+        if (!(*fanout).flagmainout && !(*fanout).flagmainin && !(*fanout).flagaddout) {
+                (*fanout).flagmainout = true;
+                (*fanout).flagmainin = true;
+                (*fanout).flagaddout = true;
+        }
+        if ((*fanout).maxclients == 0) {
+                printf("At least one client needs to be allowed\n");
+                exit(0);
+        }
+}
+
+/* Creates the listening socket, a stale socket file of a previous run is removed */
+int openSocket(struct demofanout_t* fanout)
+{
+        struct sockaddr_un addr;
+
+        memset(&addr,0,sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(fanout->path) >= sizeof(addr.sun_path)) {
+                fprintf(stderr,"Socket path %s is too long\n",fanout->path);
+                return -1;
+        }
+        strcpy(addr.sun_path,fanout->path);
+        fanout->listenfd = socket(AF_UNIX,SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+        if (fanout->listenfd == -1) {
+                perror("Socket failed");
+                return -1;
+        }
+        unlink(fanout->path);
+        if ((bind(fanout->listenfd,(struct sockaddr*) &addr,sizeof(addr)) == -1) || (listen(fanout->listenfd,16) == -1)) {
+                perror("Binding socket failed");
+                close(fanout->listenfd);
+                return -1;
+        }
+        return 0;
+}
+
+/* Closes the connection to a client */
+void dropClient(struct demofanout_t* fanout, struct client_t* client)
+{
+        close(client->fd);
+        client->fd = -1;
+        fanout->sent += client->sent;
+        fanout->dropped += client->dropped;
+}
+
+/* Accepts new clients and sends them the hello message */
+void acceptClients(struct demofanout_t* fanout)
+{
+        struct mk_fanout_hello hello;
+        uint32_t i;
+        int fd;
+
+        memset(&hello,0,sizeof(hello));
+        hello.type = MK_FANOUT_HELLO;
+        hello.magic = MK_FANOUT_MAGIC;
+        hello.version = MK_FANOUT_VERSION;
+        hello.layout = MK_SHM_LAYOUT_VERSION;
+        hello.hash = MK_SHM_LAYOUT_HASH;
+        hello.segments = fanout->segments;
+        hello.period = fanout->period;
+
+        while ((fd = accept4(fanout->listenfd,NULL,NULL,SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+                for (i = 0; i < fanout->maxclients; i++)
+                        if (fanout->clients[i].fd == -1)
+                                break;
+                if ((i == fanout->maxclients) || (send(fd,&hello,sizeof(hello),MSG_NOSIGNAL) != sizeof(hello))) {
+                        close(fd);
+                        continue;
+                }
+                memset(&fanout->clients[i],0,sizeof(fanout->clients[i]));
+                fanout->clients[i].fd = fd;
+                fanout->connects++;
+        }
+}
+
+/* Accepts new clients, reads subscriptions and closes hung up connections, never blocks */
+void serviceSockets(struct demofanout_t* fanout)
+{
+        struct mk_fanout_sub sub;
+        struct client_t* client;
+        uint32_t i;
+        ssize_t n;
+
+        fanout->fds[0].fd = fanout->listenfd;
+        fanout->fds[0].events = POLLIN;
+        for (i = 0; i < fanout->maxclients; i++) {
+                fanout->fds[i + 1].fd = fanout->clients[i].fd;
+                fanout->fds[i + 1].events = POLLIN;
+                fanout->fds[i + 1].revents = 0;
+        }
+        if (poll(fanout->fds,fanout->maxclients + 1,0) <= 0)
+                return;
+        for (i = 0; i < fanout->maxclients; i++) {
+                client = &fanout->clients[i];
+                if ((client->fd == -1) || (fanout->fds[i + 1].revents == 0))
+                        continue;
+                while ((n = recv(client->fd,&sub,sizeof(sub),MSG_DONTWAIT)) > 0) {
+                        if ((n == sizeof(sub)) && (sub.type == MK_FANOUT_SUBSCRIBE)) {
+                                client->segments = sub.segments & fanout->segments;
+                                client->interval = (uint64_t) sub.interval * 1000;
+                        }
+                }
+                if ((n == 0) || ((n == -1) && (errno != EAGAIN) && (errno != EINTR)))
+                        dropClient(fanout,client);
+        }
+        if (fanout->fds[0].revents & POLLIN)
+                acceptClients(fanout);
+}
+
+/* Reads the selected shared memories, returns true if any was updated since the last sample */
+bool sample(struct demofanout_t* fanout)
+{
+        mk_mainoutput_t mainout;
+        mk_maininput_t mainin;
+        mk_additionaloutput_t addout;
+        struct fanseg_t* seg;
+        uint32_t seq;
+        uint32_t s;
+        bool updated = false;
+
+        for (s = 0; s < MK_SHM_SEGCNT; s++) {
+                seg = &fanout->seg[s];
+                if (!(fanout->segments & (1 << s)))
+                        continue;
+                // nothing published yet, no update since the last sample or update in progress
+                seq = __atomic_load_n(&seg->hdr->seq, __ATOMIC_ACQUIRE);
+                if ((seq == seg->seq) || (seg->hdr->stamp == 0) || (seq & 1))
+                        continue;
+                switch (s) {
+                case MK_SHM_MAINOUT:
+                        seq = mk_shm_read(seg->hdr,&mainout,&fanout->mainout->data,sizeof(mainout),&seg->msg.cycle,&seg->msg.stamp);
+                        if (!(seq & 1))
+                                mk_mainoutput_towire(&seg->wire.mainout,&mainout);
+                        break;
+                case MK_SHM_MAININ:
+                        seq = mk_shm_read(seg->hdr,&mainin,&fanout->mainin->data,sizeof(mainin),&seg->msg.cycle,&seg->msg.stamp);
+                        if (!(seq & 1))
+                                mk_maininput_towire(&seg->wire.mainin,&mainin);
+                        break;
+                default:
+                        seq = mk_shm_read(seg->hdr,&addout,&fanout->addout->data,sizeof(addout),&seg->msg.cycle,&seg->msg.stamp);
+                        if (!(seq & 1))
+                                mk_additionaloutput_towire(&seg->wire.addout,&addout);
+                        break;
+                }
+                // the writer did not finish the update, the sample is not sent
+                if (seq & 1)
+                        continue;
+                seg->seq = seq;
+                updated = true;
+        }
+        return updated;
+}
+
+/* Sends every client its due samples with one sendmmsg call */
+void publish(struct demofanout_t* fanout, uint64_t now)
+{
+        struct mmsghdr msgs[MK_SHM_SEGCNT];
+        uint32_t segs[MK_SHM_SEGCNT];
+        struct client_t* client;
+        uint32_t i;
+        uint32_t s;
+        uint32_t cnt;
+        int n;
+
+        for (i = 0; i < fanout->maxclients; i++) {
+                client = &fanout->clients[i];
+                if ((client->fd == -1) || (client->segments == 0))
+                        continue;
+                if ((client->last != 0) && (now - client->last < client->interval))
+                        continue;
+                cnt = 0;
+                for (s = 0; s < MK_SHM_SEGCNT; s++) {
+                        if (!(client->segments & (1 << s)) || (client->seq[s] == fanout->seg[s].seq))
+                                continue;
+                        memset(&msgs[cnt],0,sizeof(msgs[cnt]));
+                        msgs[cnt].msg_hdr.msg_iov = fanout->seg[s].iov;
+                        msgs[cnt].msg_hdr.msg_iovlen = 2;
+                        segs[cnt++] = s;
+                }
+                if (cnt == 0)
+                        continue;
+                n = sendmmsg(client->fd,msgs,cnt,MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (n == -1) {
+                        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                                // the client does not keep up, it gets the next samples
+                                client->dropped += cnt;
+                                continue;
+                        }
+                        dropClient(fanout,client);
+                        continue;
+                }
+                for (s = 0; s < (uint32_t) n; s++)
+                        client->seq[segs[s]] = fanout->seg[segs[s]].seq;
+                client->sent += n;
+                client->dropped += cnt - n;
+                client->last = now;
+        }
+}
+
+int main(int argc, char* argv[])
+{
+        struct demofanout_t fanout;
+        memset(&fanout,0,sizeof(fanout));
+        fanout.shmflags = MK_SHM_POPULATE;
+        fanout.path = MK_FANOUT_PATH;
+        fanout.maxclients = 64;
+        const struct mk_shmhdr* waithdr;
+        uint32_t waitseg;
+        struct timespec next;
+        uint32_t waitseq = 0;
+        uint32_t clients = 0;
+        uint32_t i;
+        uint32_t s;
+        uint64_t rounds = 0;
+
+        evalCLI(argc,argv,&fanout);
+
+        //register signal handlers
+        signal(SIGTERM, sigfunc);
+        signal(SIGINT, sigfunc);
+
+        // open and setup shm mapping
+        if (fanout.flagmainout) {
+                fanout.mainout = (struct mk_mainoutput_shm *) mk_shm_attach(&fanout.shm_mainout,MK_SHM_MAINOUT,fanout.shmflags);
+                if (NULL != fanout.mainout) {
+                        fanout.segments |= 1 << MK_SHM_MAINOUT;
+                        fanout.seg[MK_SHM_MAINOUT].hdr = &fanout.mainout->hdr;
+                }
+        }
+        if (fanout.flagmainin) {
+                fanout.mainin = (struct mk_maininput_shm *) mk_shm_attach(&fanout.shm_mainin,MK_SHM_MAININ,fanout.shmflags);
+                if (NULL != fanout.mainin) {
+                        fanout.segments |= 1 << MK_SHM_MAININ;
+                        fanout.seg[MK_SHM_MAININ].hdr = &fanout.mainin->hdr;
+                }
+        }
+        if (fanout.flagaddout) {
+                fanout.addout = (struct mk_additionaloutput_shm *) mk_shm_attach(&fanout.shm_addout,MK_SHM_ADDOUT,fanout.shmflags);
+                if (NULL != fanout.addout) {
+                        fanout.segments |= 1 << MK_SHM_ADDOUT;
+                        fanout.seg[MK_SHM_ADDOUT].hdr = &fanout.addout->hdr;
+                }
+        }
+        if (fanout.segments == 0)
+                exit(1);
+
+        // wait for updates of the shared memory published last in a cycle, the others are published then
+        waitseg = mk_shm_lastseg(fanout.segments);
+        waithdr = fanout.seg[waitseg].hdr;
+        if (fanout.period == 0)
+                fanout.period = waithdr->period ? waithdr->period : DEMOFANOUT_PERIOD;
+
+        // the messages point at the latest samples
+        for (s = 0; s < MK_SHM_SEGCNT; s++) {
+                fanout.seg[s].msg.type = MK_FANOUT_SAMPLE;
+                fanout.seg[s].msg.seg = s;
+                fanout.seg[s].msg.size = mk_shm_datasize(s);
+                fanout.seg[s].iov[0].iov_base = &fanout.seg[s].msg;
+                fanout.seg[s].iov[0].iov_len = sizeof(fanout.seg[s].msg);
+                fanout.seg[s].iov[1].iov_base = &fanout.seg[s].wire;
+                fanout.seg[s].iov[1].iov_len = mk_shm_datasize(s);
+        }
+
+        fanout.clients = calloc(fanout.maxclients,sizeof(*fanout.clients));
+        fanout.fds = calloc(fanout.maxclients + 1,sizeof(*fanout.fds));
+        if ((NULL == fanout.clients) || (NULL == fanout.fds)) {
+                perror("Allocation of clients failed");
+                exit(1);
+        }
+        for (i = 0; i < fanout.maxclients; i++)
+                fanout.clients[i].fd = -1;
+        if (openSocket(&fanout) == -1)
+                exit(1);
+        printf("Fanning out to %s every %u us\n",fanout.path,fanout.period);
+        fflush(stdout);
+
+        // mainloop
+        clock_gettime(CLOCK_MONOTONIC,&next);
+        while(run) {
+                serviceSockets(&fanout);
+                if (sample(&fanout))
+                        publish(&fanout,mk_shm_taitime());
+                rounds++;
+
+                if (fanout.flagwait) {
+                        // before the first update of the writer wait for any change of seq
+                        waitseq = fanout.seg[waitseg].seq;
+                        if (waithdr->stamp == 0)
+                                waitseq = __atomic_load_n(&waithdr->seq, __ATOMIC_ACQUIRE);
+                        mk_shm_wait(waithdr,waitseq,fanout.period);
+                } else {
+                        next.tv_nsec += (long) fanout.period * 1000;
+                        while (next.tv_nsec >= 1000000000L) {
+                                next.tv_nsec -= 1000000000L;
+                                next.tv_sec++;
+                        }
+                        clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&next,NULL);
+                }
+        }
+
+        // cleanup
+        for (i = 0; i < fanout.maxclients; i++) {
+                if (fanout.clients[i].fd == -1)
+                        continue;
+                clients++;
+                dropClient(&fanout,&fanout.clients[i]);
+        }
+        printf("%llu rounds, %llu clients served (%u connected at exit), %llu samples sent, %llu dropped\n",
+                (unsigned long long) rounds,(unsigned long long) fanout.connects,clients,
+                (unsigned long long) fanout.sent,(unsigned long long) fanout.dropped);
+        close(fanout.listenfd);
+        unlink(fanout.path);
+        free(fanout.clients);
+        free(fanout.fds);
+        if (fanout.segments & (1 << MK_SHM_MAINOUT))
+                mk_shm_detach(&fanout.shm_mainout);
+        if (fanout.segments & (1 << MK_SHM_MAININ))
+                mk_shm_detach(&fanout.shm_mainin);
+        if (fanout.segments & (1 << MK_SHM_ADDOUT))
+                mk_shm_detach(&fanout.shm_addout);
+
+        return 0;
+}
@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Trajectory generator of demowriter */
+
+#include "demogen.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define DEMOGEN_ACCEL 500.0             // path acceleration in mm/s^2
+#define DEMOGEN_TRAVEL 300.0            // travel of all axes in mm, home position is at 0
+#define DEMOGEN_HOMEFEED 100.0          // feedrate while homing in mm/s
+#define DEMOGEN_SPINDLE 8000.0          // spindlespeed while running the program in rpm
+#define DEMOGEN_SPINDLEACC 4000.0       // acceleration of the spindle in rpm/s
+#define DEMOGEN_ESTOPTIME 1.0           // duration of an emergency stop in s
+#define DEMOGEN_POWERONTIME 0.5         // time between switching the machine on and homing in s
+#define DEMOGEN_ESTOPPASSES 5           // an emergency stop is triggered every ESTOPPASSES program passes
+#define DEMOGEN_ESTOPLINE 6             // in the move with this index
+#define DEMOGEN_TOOLS 4
+
+// one move of the program, starting at the end of the previous one
+struct demogen_move {
+        double end[3];
+        double center[2];
+        bool arc;               // counterclockwise arc in the xy-plane around center
+        double feed;
+};
+
+// contour of a pocket with rounded corners
+static const struct demogen_move program[] = {
+        { {  70.0,  50.0, 20.0 }, {   0.0,   0.0 }, false, 100.0 },
+        { {  70.0,  50.0,  5.0 }, {   0.0,   0.0 }, false,  20.0 },
+        { { 150.0,  50.0,  5.0 }, {   0.0,   0.0 }, false,  40.0 },
+        { { 170.0,  70.0,  5.0 }, { 150.0,  70.0 }, true,   40.0 },
+        { { 170.0, 150.0,  5.0 }, {   0.0,   0.0 }, false,  40.0 },
+        { { 150.0, 170.0,  5.0 }, { 150.0, 150.0 }, true,   40.0 },
+        { {  70.0, 170.0,  5.0 }, {   0.0,   0.0 }, false,  40.0 },
+        { {  50.0, 150.0,  5.0 }, {  70.0, 150.0 }, true,   40.0 },
+        { {  50.0,  70.0,  5.0 }, {   0.0,   0.0 }, false,  40.0 },
+        { {  70.0,  50.0,  5.0 }, {  70.0,  70.0 }, true,   40.0 },
+        { {  70.0,  50.0, 20.0 }, {   0.0,   0.0 }, false, 100.0 },
+        { {   0.0,   0.0, 20.0 }, {   0.0,   0.0 }, false, 100.0 },
+};
+#define DEMOGEN_MOVES (sizeof(program) / sizeof(program[0]))
+
+/* Returns a uniformly distributed random number in [-1,1) (xorshift64*) */
+static double randUniform(struct demogen_t* gen)
+{
+        gen->rand ^= gen->rand >> 12;
+        gen->rand ^= gen->rand << 25;
+        gen->rand ^= gen->rand >> 27;
+        return (double) ((gen->rand * 0x2545F4914F6CDD1DULL) >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+/* Plans a move from the current commanded position with a trapezoidal velocity profile */
+static void startMove(struct demogen_t* gen, const double end[3], const double center[2], bool arc, double feed)
+{
+        double d[3];
+        int i;
+        for (i = 0; i < 3; i++) {
+                gen->start[i] = gen->pos[i];
+                gen->end[i] = end[i];
+                d[i] = end[i] - gen->pos[i];
+        }
+        gen->sweep = 0;
+        if (arc) {
+                gen->center[0] = center[0];
+                gen->center[1] = center[1];
+                gen->radius = hypot(gen->start[0] - center[0], gen->start[1] - center[1]);
+                gen->angle = atan2(gen->start[1] - center[1], gen->start[0] - center[0]);
+                gen->sweep = atan2(end[1] - center[1], end[0] - center[0]) - gen->angle;
+                if (gen->sweep <= 0)
+                        gen->sweep += 2 * M_PI;
+                gen->length = hypot(gen->radius * gen->sweep, d[2]);
+        } else {
+                gen->length = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        }
+        gen->time = 0;
+        if (gen->length <= 0) {
+                gen->vmax = 0;
+                gen->tacc = 0;
+                gen->tend = 0;
+                return;
+        }
+        // short moves do not reach the feedrate, the profile becomes a triangle
+        gen->vmax = feed;
+        if (gen->length < feed * feed / DEMOGEN_ACCEL)
+                gen->vmax = sqrt(DEMOGEN_ACCEL * gen->length);
+        gen->tacc = gen->vmax / DEMOGEN_ACCEL;
+        gen->tend = 2 * gen->tacc + (gen->length - gen->vmax * gen->tacc) / gen->vmax;
+}
+
+/* Advances the current move by one cycle, returns true if it is finished */
+static bool stepMove(struct demogen_t* gen)
+{
+        double s;
+        double v;
+        double rest;
+        double f;
+        double df;
+        double ang;
+        int i;
+
+        gen->time += gen->dt;
+        if (gen->time >= gen->tend) {
+                for (i = 0; i < 3; i++) {
+                        gen->pos[i] = gen->end[i];
+                        gen->vel[i] = 0;
+                }
+                gen->feed = 0;
+                return true;
+        }
+        if (gen->time < gen->tacc) {
+                s = 0.5 * DEMOGEN_ACCEL * gen->time * gen->time;
+                v = DEMOGEN_ACCEL * gen->time;
+        } else if (gen->time < gen->tend - gen->tacc) {
+                s = 0.5 * DEMOGEN_ACCEL * gen->tacc * gen->tacc + gen->vmax * (gen->time - gen->tacc);
+                v = gen->vmax;
+        } else {
+                rest = gen->tend - gen->time;
+                s = gen->length - 0.5 * DEMOGEN_ACCEL * rest * rest;
+                v = DEMOGEN_ACCEL * rest;
+        }
+        f = s / gen->length;
+        df = v / gen->length;
+        if (gen->sweep != 0) {
+                ang = gen->angle + gen->sweep * f;
+                gen->pos[0] = gen->center[0] + gen->radius * cos(ang);
+                gen->pos[1] = gen->center[1] + gen->radius * sin(ang);
+                gen->vel[0] = -gen->radius * gen->sweep * df * sin(ang);
+                gen->vel[1] = gen->radius * gen->sweep * df * cos(ang);
+                gen->pos[2] = gen->start[2] + (gen->end[2] - gen->start[2]) * f;
+                gen->vel[2] = (gen->end[2] - gen->start[2]) * df;
+        } else {
+                for (i = 0; i < 3; i++) {
+                        gen->pos[i] = gen->start[i] + (gen->end[i] - gen->start[i]) * f;
+                        gen->vel[i] = (gen->end[i] - gen->start[i]) * df;
+                }
+        }
+        gen->feed = v;
+        return false;
+}
+
+/* Stops all axes immediately */
+static void stopAxes(struct demogen_t* gen)
+{
+        int i;
+        for (i = 0; i < 3; i++)
+                gen->vel[i] = 0;
+        gen->feed = 0;
+}
+
+void demogen_init(struct demogen_t* gen, uint32_t period, uint32_t lag, double noise)
+{
+        memset(gen,0,sizeof(*gen));
+        gen->state = DEMOGEN_ESTOP;
+        gen->dt = period * 1e-6;
+        gen->lag = lag * 1e-6;
+        gen->noise = noise;
+        gen->rand = 0x9E3779B97F4A7C15ULL ^ (uint64_t) rand();
+        gen->fault = -1;
+        gen->tool = 1;
+        // the axes are somewhere within their travel before homing
+        gen->pos[0] = DEMOGEN_TRAVEL * 0.5 * (1.0 + randUniform(gen));
+        gen->pos[1] = DEMOGEN_TRAVEL * 0.5 * (1.0 + randUniform(gen));
+        gen->pos[2] = DEMOGEN_TRAVEL * 0.5 * (1.0 + randUniform(gen));
+        memcpy(gen->cur,gen->pos,sizeof(gen->cur));
+}
+
+void demogen_step(struct demogen_t* gen, mk_mainoutput_t* mainout, mk_additionaloutput_t* addout, mk_maininput_t* mainin)
+{
+        static const double home[3] = { 0.0, 0.0, 0.0 };
+        double alpha;
+        int i;
+
+        switch (gen->state) {
+        case DEMOGEN_ESTOP:
+                gen->time += gen->dt;
+                stopAxes(gen);
+                gen->homed = false;
+                gen->line = 0;
+                if (gen->time >= DEMOGEN_ESTOPTIME) {
+                        gen->state = DEMOGEN_POWERON;
+                        gen->fault = -1;
+                        gen->time = 0;
+                }
+                break;
+        case DEMOGEN_POWERON:
+                gen->time += gen->dt;
+                if (gen->time >= DEMOGEN_POWERONTIME) {
+                        gen->state = DEMOGEN_HOMING;
+                        startMove(gen,home,NULL,false,DEMOGEN_HOMEFEED);
+                }
+                break;
+        case DEMOGEN_HOMING:
+                if (stepMove(gen)) {
+                        gen->homed = true;
+                        gen->state = DEMOGEN_RUNNING;
+                        gen->line = 0;
+                        startMove(gen,program[0].end,program[0].center,program[0].arc,program[0].feed);
+                }
+                break;
+        case DEMOGEN_RUNNING:
+                if (!stepMove(gen))
+                        break;
+                if ((gen->line == DEMOGEN_ESTOPLINE) && ((gen->passes % DEMOGEN_ESTOPPASSES) == DEMOGEN_ESTOPPASSES - 1)) {
+                        // a drive fault of one of the axes triggers the emergency stop
+                        gen->state = DEMOGEN_ESTOP;
+                        gen->fault = (gen->passes / DEMOGEN_ESTOPPASSES) % 3;
+                        gen->passes++;
+                        gen->time = 0;
+                        break;
+                }
+                gen->line++;
+                if (gen->line >= DEMOGEN_MOVES) {
+                        gen->line = 0;
+                        gen->passes++;
+                        gen->tool = gen->tool % DEMOGEN_TOOLS + 1;
+                }
+                startMove(gen,program[gen->line].end,program[gen->line].center,program[gen->line].arc,program[gen->line].feed);
+                break;
+        }
+
+        // the spindle runs up while running the program and is braked otherwise
+        if (gen->state == DEMOGEN_RUNNING)
+                gen->spindle = fmin(gen->spindle + DEMOGEN_SPINDLEACC * gen->dt, DEMOGEN_SPINDLE);
+        else
+                gen->spindle = fmax(gen->spindle - 2 * DEMOGEN_SPINDLEACC * gen->dt, 0.0);
+
+        // the drives follow with a first order lag, the measurement is noisy
+        alpha = gen->dt / (gen->lag + gen->dt);
+        for (i = 0; i < 3; i++)
+                gen->cur[i] += alpha * (gen->pos[i] - gen->cur[i]);
+
+        mainout->xvel_set = gen->vel[0];
+        mainout->yvel_set = gen->vel[1];
+        mainout->zvel_set = gen->vel[2];
+        mainout->spindlespeed = gen->spindle;
+        mainout->xenable = gen->state != DEMOGEN_ESTOP;
+        mainout->yenable = gen->state != DEMOGEN_ESTOP;
+        mainout->zenable = gen->state != DEMOGEN_ESTOP;
+        mainout->spindleenable = gen->state == DEMOGEN_RUNNING;
+        mainout->spindlebrake = (gen->state != DEMOGEN_RUNNING) && (gen->spindle == 0);
+        mainout->machinestatus = gen->state != DEMOGEN_ESTOP;
+        mainout->estopstatus = gen->state == DEMOGEN_ESTOP;
+
+        addout->feedrate = gen->feed;
+        addout->feedoverride = 100.0;
+        addout->xpos_set = gen->pos[0];
+        addout->ypos_set = gen->pos[1];
+        addout->zpos_set = gen->pos[2];
+        addout->lineno = gen->state == DEMOGEN_RUNNING ? (int32_t) gen->line + 1 : 0;
+        addout->tool = gen->tool;
+        addout->mode = gen->state == DEMOGEN_RUNNING ? 1 : 4;
+        addout->xhome = gen->homed && (fabs(gen->pos[0]) < 1e-3);
+        addout->yhome = gen->homed && (fabs(gen->pos[1]) < 1e-3);
+        addout->zhome = gen->homed && (fabs(gen->pos[2]) < 1e-3);
+        addout->xhardneg = gen->cur[0] < -1.0;
+        addout->yhardneg = gen->cur[1] < -1.0;
+        addout->zhardneg = gen->cur[2] < -1.0;
+        addout->xhardpos = gen->cur[0] > DEMOGEN_TRAVEL + 1.0;
+        addout->yhardpos = gen->cur[1] > DEMOGEN_TRAVEL + 1.0;
+        addout->zhardpos = gen->cur[2] > DEMOGEN_TRAVEL + 1.0;
+
+        mainin->xpos_cur = gen->cur[0] + gen->noise * randUniform(gen);
+        mainin->ypos_cur = gen->cur[1] + gen->noise * randUniform(gen);
+        mainin->zpos_cur = gen->cur[2] + gen->noise * randUniform(gen);
+        mainin->xfault = gen->fault == 0;
+        mainin->yfault = gen->fault == 1;
+        mainin->zfault = gen->fault == 2;
+}
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Trajectory generator of demowriter
+ *
+ * Generates physically plausible values for the shared memories instead of
+ * random ones: the machine is switched on, homes all axes and then runs a
+ * small program of linear moves and arcs in a loop, with trapezoidal
+ * velocity profiles along the path. Every few program passes an emergency
+ * stop is triggered, after which the machine is switched on and homed again.
+ * The actual positions follow the commanded ones with a first order lag and
+ * noise. One step costs a few floating point operations, so it can run at
+ * cycle times of 100 us and below.
+ */
+
+#ifndef _DEMOGEN_H_
+#define _DEMOGEN_H_
+
+#include "../mk_shminterface.h"
+#include <stdint.h>
+
+// states of the machine
+enum demogen_state {
+	DEMOGEN_ESTOP,		//emergency stop activated, machine off
+	DEMOGEN_POWERON,	//emergency stop released, machine switched on
+	DEMOGEN_HOMING,		//moving all axes to the home position
+	DEMOGEN_RUNNING		//running the program
+};
+
+struct demogen_t {
+	enum demogen_state state;
+	double dt;		//cycle time in s
+	double lag;		//time constant of the feedback in s
+	double noise;		//amplitude of the noise of the feedback in mm
+	double time;		//time since the start of the current state or move in s
+	uint64_t rand;		//state of the random number generator
+	uint32_t passes;	//completed program passes
+	uint32_t line;		//index of the current move of the program
+	int fault;		//axis whose drive fault caused the emergency stop, -1 if none
+	bool homed;
+	// current move
+	double start[3];	//start position in mm
+	double end[3];		//end position in mm
+	double center[2];	//center of an arc in the xy-plane in mm
+	double radius;		//radius of an arc in mm
+	double angle;		//start angle of an arc in rad
+	double sweep;		//swept angle of an arc in rad, 0 for a linear move
+	double length;		//path length in mm
+	double vmax;		//peak velocity in mm/s
+	double tacc;		//duration of the acceleration and deceleration phase in s
+	double tend;		//duration of the move in s
+	// commanded and actual values
+	double pos[3];
+	double vel[3];
+	double feed;
+	double cur[3];
+	double spindle;
+	uint32_t tool;
+};
+
+// initializes the generator for the cycle time period in us, the feedback lag in us and the noise in mm
+void demogen_init(struct demogen_t* gen, uint32_t period, uint32_t lag, double noise);
+
+// advances the generator by one cycle and fills the structs of variables
+void demogen_step(struct demogen_t* gen, mk_mainoutput_t* mainout, mk_additionaloutput_t* addout, mk_maininput_t* mainin);
+
+#endif /* _DEMOGEN_H_ */
@@ -11,98 +11,469 @@
  * -i           Reads main input variables to control
  * -a           Reads additional output variables from control
  * -t [value]   Specifies update-period in milliseconds. Default 10 seconds
+ * -m           Locks the shared memories into RAM
+ * -H           Uses shared memories backed by hugepages (hugetlbfs)
+ * -b           Reads every sample from the ring buffers of the shared memories
+ * -u [value]   Specifies update-period in microseconds
+ * -w           Waits for updates of the writer instead of polling, at most one period; unchanged shared memories are not output again
+ * -l           Measures latency from publication to read, prints statistics on exit or SIGUSR1
+ * -F [format]  Output format: text, bin, json or csv. Default text
+ * -d           Outputs only the variables changed since the last read
+ * -S [path]    Receives the samples from the fan-out daemon at path instead of reading the shared memories
+ * -x           Reads the axes shared memory in struct-of-arrays layout
+ * -W [value]   Reports writers which did not update for this many of their cycles or terminated, 0 disables. Default 10
+ * -I [value]   Instance of the first monitored interface. Default MK_SHM_INSTANCE or 0
+ * -M [value]   Monitors this many instances of the interface in one loop, starting at -I. Default 1
  * -h           Prints this help message and exits
  * 
  */
 
 #include "../mk_shminterface.h"
+#include "../lib/mk_shmlib.h"
+#include "../lib/mk_shmring.h"
+#include "../lib/mk_shmhist.h"
+#include "../lib/mk_shmfields.h"
+#include "../lib/mk_shmoutput.h"
+#include "../lib/mk_shmfanout.h"
+#include "../lib/mk_shmaxes.h"
+#include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <semaphore.h>
-#include <fcntl.h>
 #include <signal.h>
 #include <time.h>
-#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 
 uint8_t run = 1;
+uint8_t dump = 0;
+
+// latency statistics of a shared memory
+struct latency_t {
+        uint32_t seq;
+        uint64_t cycle;
+        uint64_t stamp;
+        uint64_t samples;
+        uint64_t missed;
+        uint64_t duplicated;
+        struct mk_hist latency;
+        struct mk_hist interval;
+};
+
+// shared memories and read state of one instance of the interface
+struct instance_t {
+        uint32_t inst;
+        struct mk_mainoutput_shm * mainout;
+        struct mk_maininput_shm * mainin;
+        struct mk_additionaloutput_shm * addout;
+        struct mk_axes_shm * axes;
+        struct mk_shm * shm;	//handles of the shared memories or their ring buffers by enum mk_shmseg, in demoreader_t.shms
+        struct mk_shm shm_axes;
+        struct mk_shmring * mainoutring;
+        struct mk_shmring * maininring;
+        struct mk_shmring * addoutring;
+        struct mk_ringcursor mainoutcur;
+        struct mk_ringcursor mainincur;
+        struct mk_ringcursor addoutcur;
+        struct latency_t * mainoutlat;
+        struct latency_t * maininlat;
+        struct latency_t * addoutlat;
+        struct latency_t * axeslat;
+        bool checked;
+        uint32_t mainoutseen;	//seq of the last read snapshot, for the changed variables
+        uint32_t maininseen;
+        uint32_t addoutseen;
+        uint32_t axesseen;
+        enum mk_shm_wstate mainoutstate;	//last reported state of the writer
+        enum mk_shm_wstate maininstate;
+        enum mk_shm_wstate addoutstate;
+        enum mk_shm_wstate axesstate;
+        mk_mainoutput_t mainoutval;	//with -d the variables of the previous reads
+        mk_maininput_t maininval;
+        mk_additionaloutput_t addoutval;
+};
+
 struct demoreader_t {
-        struct mk_mainoutput * mainout;
-        struct mk_maininput * mainin;
-        struct mk_additionaloutput * addout;
-        sem_t* sem_mainout;
-        sem_t* sem_mainin;
-        sem_t* sem_addout;
+        struct instance_t * insts;
+        struct mk_shminst * shms;	//shared memories of all instances, attached together
+        uint32_t firstinst;	//instance of the first monitored interface
+        uint32_t instances;	//number of monitored instances
+        int shmflags;
         uint32_t period;
+        uint32_t watchdog;	//cycles of the writer without update after which it is reported, 0 disables
         bool flagmainout;
         bool flagmainin;
         bool flagaddout;
+        bool flagaxes;
+        bool flagring;
+        bool flaglatency;
+        bool flagwait;
+        bool flagdelta;
+        const char* path;	//socket of the fan-out daemon, NULL to read the shared memories
+        enum mk_outfmt fmt;
+        struct mk_output out;
 };
 
-/* Opens a shared memory (Readonly) and created it if necessary */
-void* openShM(const char* name, uint32_t size, sem_t** sem)
+/* Checks the layout of a shared memory once its writer published the first update
+ *
+ * The reader may have created the shared memory itself before the writer
+ * started, the writer then initializes the header again with its layout.
+ * Returns 1 once checked, 0 while the writer did not update yet and -1 on a mismatch.
+ */
+int checkWriter(const struct mk_shm* shm)
+{
+        const struct mk_shmhdr* hdr = (const struct mk_shmhdr*) shm->addr;
+
+        if (NULL == hdr)
+                return 1;
+        if (__atomic_load_n(&hdr->stamp, __ATOMIC_ACQUIRE) == 0)
+                return 0;
+        return (mk_shm_check(shm) == 0) ? 1 : -1;
+}
+
+/* Checks the writer of a shared memory, reports changes of its state on stderr
+ *
+ * Returns false if the values of the shared memory are not current, as the
+ * writer is stale, stuck, terminated or not started yet.
+ */
+bool watchWriter(const struct demoreader_t* reader, const struct mk_shm* shm, enum mk_shm_wstate* state)
+{
+        enum mk_shm_wstate now;
+
+        if ((reader->watchdog == 0) || (NULL == shm->addr))
+                return true;
+        now = mk_shm_writerstate((const struct mk_shmhdr*) shm->addr,reader->watchdog);
+        if (now != *state)
+                fprintf(stderr,"%s: %s\n",shm->name,mk_shm_wstatename(now));
+        *state = now;
+        return now == MK_SHM_WSTATE_OK;
+}
+
+/* Outputs all samples of a ring buffer not read yet */
+void drainRing(struct mk_output* out, enum mk_shmseg seg, uint32_t inst, const struct mk_shmring* ring, struct mk_ringcursor* cur, void* buf, size_t max)
+{
+        size_t cnt;
+        size_t i;
+        uint64_t lost = cur->lost;
+        uint32_t restarts = cur->restarts;
+        uint64_t now = mk_shm_realtime();
+        struct mk_shmslot* slot;
+
+        do {
+                cnt = mk_ring_drain(ring,cur,buf,max);
+                for (i = 0; i < cnt; i++) {
+                        slot = mk_ring_bufslot(ring,buf,i);
+                        mk_output_sample(out,seg,inst,now,slot->cycle,slot->stamp,mk_ring_slotdata(slot),MK_OUT_ALLFIELDS);
+                }
+        } while (cnt == max);
+        // stdout may carry a binary stream, report on stderr
+        if (cur->restarts != restarts)
+                fprintf(stderr,"%s instance %u: ring buffer restarted by a new writer\n",mk_shm_segname(seg),inst);
+        if (cur->lost != lost)
+                fprintf(stderr,"%s instance %u: %llu samples lost\n",mk_shm_segname(seg),inst,(unsigned long long) (cur->lost - lost));
+}
+
+/* Updates the latency statistics with a snapshot of a shared memory */
+void updateLatency(struct latency_t* lat, uint32_t seq, uint64_t cycle, uint64_t stamp)
+{
+        uint64_t now;
+        // nothing published yet, writer stuck in an update (stamp 0) or nothing new since the last read
+        if ((stamp == 0) || (seq == lat->seq))
+                return;
+        now = mk_shm_taitime();
+        lat->seq = seq;
+        // the first snapshot may be arbitrarily old, it only starts the statistics
+        if (lat->samples > 0) {
+                if (cycle <= lat->cycle)
+                        lat->duplicated++;
+                else if (cycle > lat->cycle + 1)
+                        lat->missed += cycle - lat->cycle - 1;
+                if (stamp > lat->stamp)
+                        mk_hist_record(&lat->interval,stamp - lat->stamp);
+                mk_hist_record(&lat->latency,now > stamp ? now - stamp : 0);
+        }
+        lat->samples++;
+        lat->cycle = cycle;
+        lat->stamp = stamp;
+}
+
+/* Prints the latency statistics of a shared memory */
+void printLatency(const char* name, const struct latency_t* lat)
+{
+        printf("\n##### Latency of %s: #####\n",name);
+        printf("Samples: %llu;        Missed cycles: %llu;        Duplicated cycles: %llu\n",(unsigned long long) lat->samples,(unsigned long long) lat->missed,(unsigned long long) lat->duplicated);
+        mk_hist_print(&lat->latency,stdout,"Latency publish to read [ns]");
+        mk_hist_print(&lat->interval,stdout,"Interval between publications [ns]");
+        if (lat->latency.count > 0)
+                printf("Jitter [ns]: latency p99-p50 %llu; interval max-min %llu\n",
+                        (unsigned long long) (mk_hist_percentile(&lat->latency,99.0) - mk_hist_percentile(&lat->latency,50.0)),
+                        (unsigned long long) (lat->interval.max - lat->interval.min));
+        fflush(stdout);
+}
+
+/* Sleeps until the next update or for one period, meanwhile writes the buffered output once it is due */
+void waitUpdate(struct demoreader_t* reader, const struct mk_shmhdr* hdr, uint32_t* seq)
+{
+        uint64_t now = mk_shm_realtime();
+        uint64_t end = now + (uint64_t) reader->period * 1000;
+        uint64_t due;
+        uint32_t timeout;
+
+        while (run && (now < end)) {
+                timeout = (end - now) / 1000;
+                if (reader->out.len > 0) {
+                        due = reader->out.first + reader->out.interval;
+                        if (due <= now)
+                                mk_output_flush(&reader->out);
+                        else if (due < end)
+                                timeout = (due - now) / 1000;
+                }
+                if (reader->flagwait && (NULL != hdr)) {
+                        if (mk_shm_wait(hdr,*seq,timeout) == 0)
+                                break;
+                } else {
+                        usleep(timeout);
+                }
+                now = mk_shm_realtime();
+        }
+        if (NULL != hdr)
+                *seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+}
+
+/* Returns the bitmap of the selected shared memories */
+uint32_t selectedSegments(const struct demoreader_t* reader)
 {
+        uint32_t segments = 0;
+        if (reader->flagmainout)
+                segments |= 1 << MK_SHM_MAINOUT;
+        if (reader->flagmainin)
+                segments |= 1 << MK_SHM_MAININ;
+        if (reader->flagaddout)
+                segments |= 1 << MK_SHM_ADDOUT;
+        return segments;
+}
+
+/* Outputs the samples pushed by the fan-out daemon, the update-period is the minimum interval between samples */
+void receiveFanout(struct demoreader_t* reader, uint32_t segments)
+{
+        struct mk_fanout_sample sample;
+        // wake up regularly to notice signals and to write the buffered output
+        struct timeval timeout = { 0, 100000 };
         int fd;
-        bool init = false;
-        int mpflg = PROT_READ;
-        void* shm;
-        int semflg = 0;
-        fd = shm_open(name, O_RDONLY, 0666);
-        if ((fd == -1) && (errno == ENOENT)){
-                //shm not available yet -> create and initialize
-                init = true;
-                fd = shm_open(name,O_RDWR | O_CREAT,0666);
-                mpflg = PROT_READ | PROT_WRITE;
-                semflg = O_CREAT;
-        }
-        if (fd == -1) {
-                perror("SHM Open failed");
-                return(NULL);
-        }
-        
-        ftruncate(fd,size);
-        shm = mmap(NULL, size, mpflg, MAP_SHARED | MAP_POPULATE, fd, 0);
-        if (MAP_FAILED == shm) {
-                perror("SHM Map failed");
-                shm = NULL;
-                if(init)
-                        shm_unlink(name);
-        }
-        *sem = sem_open(name,semflg,0666,0);
-        if (*sem == SEM_FAILED){
-                perror("Semaphore open failed");
-                munmap(shm, size);
-                return(NULL);
-        }
-        if(init) {
-                memset(shm,0,size);
-                mprotect(shm,size,PROT_READ);
-                sem_post(*sem);
-        }
-        
-        return shm;
-}
-
-/* Closes a shared memory */
-int closeShM(void** shm, int len, sem_t** sem)
-{
-        // not doing unlink of the shared memory because this should only be
-        // done by the writer, so other reader process can still open it
-        int ok;        
-        ok = munmap(*shm,len);
-        if (ok < 0)
-                return ok;
-        *shm = NULL;
-        ok = sem_close(*sem);
-        if (ok < 0)
-                return ok;
-        *sem = NULL;
-        return ok;
+        int ok;
+
+        fd = mk_fanout_connect(reader->path,segments,reader->period,NULL);
+        if (fd == -1)
+                return;
+        setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+        while (run) {
+                ok = mk_fanout_recv(fd,&sample);
+                if (ok == 1) {
+                        mk_output_sample(&reader->out,sample.hdr.seg,reader->firstinst,mk_shm_realtime(),sample.hdr.cycle,sample.hdr.stamp,&sample.data,MK_OUT_ALLFIELDS);
+                } else if (ok == 0) {
+                        fprintf(stderr,"Fan-out daemon closed the connection\n");
+                        break;
+                } else if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                        perror("Receiving from fan-out daemon failed");
+                        break;
+                }
+                if ((reader->out.len > 0) && (mk_shm_realtime() >= reader->out.first + reader->out.interval))
+                        mk_output_flush(&reader->out);
+        }
+        close(fd);
+}
+
+/* Sets up an instance whose shared memories are attached or attaches their ring buffers, a failed one stays NULL */
+void attachInstance(struct demoreader_t* reader, struct instance_t* in)
+{
+        if (reader->flagring) {
+                if (reader->flagmainout) {
+                        in->mainoutring = mk_ring_attach_inst(&in->shm[MK_SHM_MAINOUT],MK_SHM_MAINOUT,in->inst,0,reader->shmflags);
+                        if (NULL != in->mainoutring)
+                                mk_ring_cursorinit(in->mainoutring,&in->mainoutcur);
+                }
+                if (reader->flagmainin) {
+                        in->maininring = mk_ring_attach_inst(&in->shm[MK_SHM_MAININ],MK_SHM_MAININ,in->inst,0,reader->shmflags);
+                        if (NULL != in->maininring)
+                                mk_ring_cursorinit(in->maininring,&in->mainincur);
+                }
+                if (reader->flagaddout) {
+                        in->addoutring = mk_ring_attach_inst(&in->shm[MK_SHM_ADDOUT],MK_SHM_ADDOUT,in->inst,0,reader->shmflags);
+                        if (NULL != in->addoutring)
+                                mk_ring_cursorinit(in->addoutring,&in->addoutcur);
+                }
+        } else {
+                in->mainout = (struct mk_mainoutput_shm *) in->shm[MK_SHM_MAINOUT].addr;
+                in->mainin = (struct mk_maininput_shm *) in->shm[MK_SHM_MAININ].addr;
+                in->addout = (struct mk_additionaloutput_shm *) in->shm[MK_SHM_ADDOUT].addr;
+                if (reader->flagaxes)
+                        in->axes = mk_axes_attach(&in->shm_axes,in->inst,reader->shmflags);
+        }
+}
+
+/* Allocates the latency statistics of an instance, returns 0 or -1 on error */
+int allocLatency(struct instance_t* in)
+{
+        in->mainoutlat = calloc(1,sizeof(struct latency_t));
+        in->maininlat = calloc(1,sizeof(struct latency_t));
+        in->addoutlat = calloc(1,sizeof(struct latency_t));
+        in->axeslat = calloc(1,sizeof(struct latency_t));
+        if ((NULL == in->mainoutlat) || (NULL == in->maininlat) || (NULL == in->addoutlat) || (NULL == in->axeslat))
+                return -1;
+        mk_hist_init(&in->mainoutlat->latency);
+        mk_hist_init(&in->mainoutlat->interval);
+        mk_hist_init(&in->maininlat->latency);
+        mk_hist_init(&in->maininlat->interval);
+        mk_hist_init(&in->addoutlat->latency);
+        mk_hist_init(&in->addoutlat->interval);
+        mk_hist_init(&in->axeslat->latency);
+        mk_hist_init(&in->axeslat->interval);
+        return 0;
+}
+
+/* Updates the latency statistics of an instance */
+void measureInstance(struct instance_t* in)
+{
+        struct mk_axes axes;
+        uint32_t seq;
+        uint64_t cycle;
+        uint64_t stamp;
+
+        if (NULL != in->mainout) {
+                seq = mk_shm_read(&in->mainout->hdr,&in->mainoutval,&in->mainout->data,sizeof(in->mainoutval),&cycle,&stamp);
+                updateLatency(in->mainoutlat,seq,cycle,stamp);
+        }
+        if (NULL != in->addout) {
+                seq = mk_shm_read(&in->addout->hdr,&in->addoutval,&in->addout->data,sizeof(in->addoutval),&cycle,&stamp);
+                updateLatency(in->addoutlat,seq,cycle,stamp);
+        }
+        if (NULL != in->mainin) {
+                seq = mk_shm_read(&in->mainin->hdr,&in->maininval,&in->mainin->data,sizeof(in->maininval),&cycle,&stamp);
+                updateLatency(in->maininlat,seq,cycle,stamp);
+        }
+        if (NULL != in->axes) {
+                seq = mk_axes_read(in->axes,&axes,&cycle,&stamp);
+                updateLatency(in->axeslat,seq,cycle,stamp);
+        }
+}
+
+/* Prints the latency statistics of an instance */
+void printInstanceLatency(const struct instance_t* in)
+{
+        if (NULL != in->mainout)
+                printLatency(in->shm[MK_SHM_MAINOUT].name,in->mainoutlat);
+        if (NULL != in->addout)
+                printLatency(in->shm[MK_SHM_ADDOUT].name,in->addoutlat);
+        if (NULL != in->mainin)
+                printLatency(in->shm[MK_SHM_MAININ].name,in->maininlat);
+        if (NULL != in->axes)
+                printLatency(in->shm_axes.name,in->axeslat);
+}
+
+/* Returns false if a shared memory is unchanged since the read of seq seen, with -w it is not output again */
+bool updated(const struct demoreader_t* reader, const struct mk_shmhdr* hdr, uint32_t seen)
+{
+        return !reader->flagwait || (__atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE) != seen);
+}
+
+/* Outputs the variables of an instance read at now, with -d only the changed ones */
+void readInstance(struct demoreader_t* reader, struct instance_t* in, uint64_t now)
+{
+        struct mk_mainoutput mainoutwire;
+        struct mk_maininput maininwire;
+        struct mk_additionaloutput addoutwire;
+        struct mk_axes axes;
+        uint32_t seq;
+        uint64_t cycle;
+        uint64_t stamp;
+        uint64_t fields;
+
+        // with -d the structs keep the variables of the previous reads, only changed ones are copied
+        // the values of a writer which is not alive and updating are not output again
+        if ((NULL != in->mainout) && watchWriter(reader,&in->shm[MK_SHM_MAINOUT],&in->mainoutstate)) {
+                fields = MK_OUT_ALLFIELDS;
+                if (reader->flagdelta)
+                        fields = mk_mainoutput_readdelta(in->mainout,&in->mainoutval,&in->mainoutseen,&cycle,&stamp);
+                else if (!updated(reader,&in->mainout->hdr,in->mainoutseen))
+                        fields = 0;
+                else if ((in->mainoutseen = mk_shm_read(&in->mainout->hdr,&in->mainoutval,&in->mainout->data,sizeof(in->mainoutval),&cycle,&stamp)) & 1)
+                        fields = 0;
+                if (fields != 0) {
+                        mk_mainoutput_towire(&mainoutwire,&in->mainoutval);
+                        mk_output_sample(&reader->out,MK_SHM_MAINOUT,in->inst,now,cycle,stamp,&mainoutwire,fields);
+                }
+        }
+        if ((NULL != in->addout) && watchWriter(reader,&in->shm[MK_SHM_ADDOUT],&in->addoutstate)) {
+                fields = MK_OUT_ALLFIELDS;
+                if (reader->flagdelta)
+                        fields = mk_additionaloutput_readdelta(in->addout,&in->addoutval,&in->addoutseen,&cycle,&stamp);
+                else if (!updated(reader,&in->addout->hdr,in->addoutseen))
+                        fields = 0;
+                else if ((in->addoutseen = mk_shm_read(&in->addout->hdr,&in->addoutval,&in->addout->data,sizeof(in->addoutval),&cycle,&stamp)) & 1)
+                        fields = 0;
+                if (fields != 0) {
+                        mk_additionaloutput_towire(&addoutwire,&in->addoutval);
+                        mk_output_sample(&reader->out,MK_SHM_ADDOUT,in->inst,now,cycle,stamp,&addoutwire,fields);
+                }
+        }
+        if ((NULL != in->mainin) && watchWriter(reader,&in->shm[MK_SHM_MAININ],&in->maininstate)) {
+                fields = MK_OUT_ALLFIELDS;
+                if (reader->flagdelta)
+                        fields = mk_maininput_readdelta(in->mainin,&in->maininval,&in->maininseen,&cycle,&stamp);
+                else if (!updated(reader,&in->mainin->hdr,in->maininseen))
+                        fields = 0;
+                else if ((in->maininseen = mk_shm_read(&in->mainin->hdr,&in->maininval,&in->mainin->data,sizeof(in->maininval),&cycle,&stamp)) & 1)
+                        fields = 0;
+                if (fields != 0) {
+                        mk_maininput_towire(&maininwire,&in->maininval);
+                        mk_output_sample(&reader->out,MK_SHM_MAININ,in->inst,now,cycle,stamp,&maininwire,fields);
+                }
+        }
+        if ((NULL != in->axes) && watchWriter(reader,&in->shm_axes,&in->axesstate)) {
+                // the axes are published as a whole, with -d or -w they are output once per update
+                seq = mk_axes_read(in->axes,&axes,&cycle,&stamp);
+                if (!(seq & 1) && ((!reader->flagdelta && !reader->flagwait) || (seq != in->axesseen)))
+                        mk_output_axes(&reader->out,in->inst,now,cycle,stamp,&axes);
+                in->axesseen = seq;
+        }
+}
+
+/* Outputs the samples of the ring buffers of an instance not read yet */
+void drainInstance(struct demoreader_t* reader, struct instance_t* in, void* buf, size_t max)
+{
+        // the samples appended before the writer stopped are still output
+        watchWriter(reader,&in->shm[MK_SHM_MAINOUT],&in->mainoutstate);
+        watchWriter(reader,&in->shm[MK_SHM_MAININ],&in->maininstate);
+        watchWriter(reader,&in->shm[MK_SHM_ADDOUT],&in->addoutstate);
+        if (NULL != in->mainoutring)
+                drainRing(&reader->out,MK_SHM_MAINOUT,in->inst,in->mainoutring,&in->mainoutcur,buf,max);
+        if (NULL != in->addoutring)
+                drainRing(&reader->out,MK_SHM_ADDOUT,in->inst,in->addoutring,&in->addoutcur,buf,max);
+        if (NULL != in->maininring)
+                drainRing(&reader->out,MK_SHM_MAININ,in->inst,in->maininring,&in->mainincur,buf,max);
+}
+
+/* Checks the layout of the shared memories of an instance, see checkWriter */
+int checkInstance(struct instance_t* in)
+{
+        int mainoutok;
+        int maininok;
+        int addoutok;
+        int axesok;
+
+        if (in->checked)
+                return 1;
+        mainoutok = checkWriter(&in->shm[MK_SHM_MAINOUT]);
+        maininok = checkWriter(&in->shm[MK_SHM_MAININ]);
+        addoutok = checkWriter(&in->shm[MK_SHM_ADDOUT]);
+        axesok = checkWriter(&in->shm_axes);
+        if ((mainoutok == -1) || (maininok == -1) || (addoutok == -1) || (axesok == -1))
+                return -1;
+        in->checked = (mainoutok == 1) && (maininok == 1) && (addoutok == 1) && (axesok == 1);
+        return in->checked ? 1 : 0;
 }
 
 /* signal handler */
@@ -119,6 +490,9 @@ void sigfunc(int sig)
         case SIGTERM:
                 run = 0;
                 break;        
+        case SIGUSR1:
+                dump = 1;
+                break;
         }
 }
 
@@ -132,6 +506,19 @@ static void usage(char *appname)
                 " -i            Reads main input variables to control\n"
                 " -a            Reads additional output variables from control\n"
                 " -t [value]    Specifies update-period in milliseconds. Default 10 seconds.\n"
+                " -m            Locks the shared memories into RAM\n"
+                " -H            Uses shared memories backed by hugepages (hugetlbfs)\n"
+                " -b            Reads every sample from the ring buffers of the shared memories\n"
+                " -u [value]    Specifies update-period in microseconds\n"
+                " -w            Waits for updates of the writer instead of polling, at most one period; unchanged shared memories are not output again\n"
+                " -l            Measures latency from publication to read, prints statistics on exit or SIGUSR1\n"
+                " -F [format]   Output format: text, bin, json or csv. Default text\n"
+                " -d            Outputs only the variables changed since the last read\n"
+                " -S [path]     Receives the samples from the fan-out daemon at path instead of reading the shared memories\n"
+                " -x            Reads the axes shared memory in struct-of-arrays layout\n"
+                " -W [value]    Reports writers which did not update for this many of their cycles or terminated, 0 disables. Default 10\n"
+                " -I [value]    Instance of the first monitored interface. Default MK_SHM_INSTANCE or 0\n"
+                " -M [value]    Monitors this many instances of the interface in one loop, starting at -I. Default 1\n"
                 " -h            Prints this help message and exits\n"
                 "\n",
                 appname);
@@ -141,9 +528,10 @@ static void usage(char *appname)
 void evalCLI(int argc, char* argv[0],struct demoreader_t * reader)
 {
         int c;
+        int fmt;
         char* appname = strrchr(argv[0], '/');
         appname = appname ? 1 + appname : argv[0];
-        while (EOF != (c = getopt(argc,argv,"oiaht:"))) {
+        while (EOF != (c = getopt(argc,argv,"oiahmHblwdxt:u:F:S:I:M:W:"))) {
                 switch(c) {
                 case 'o':
                         (*reader).flagmainout = true;
@@ -154,9 +542,53 @@ void evalCLI(int argc, char* argv[0],struct demoreader_t * reader)
                 case 'a':
                         (*reader).flagaddout = true;
                         break;
+                case 'm':
+                        (*reader).shmflags |= MK_SHM_MLOCK;
+                        break;
+                case 'H':
+                        (*reader).shmflags |= MK_SHM_HUGEPAGE;
+                        break;
+                case 'b':
+                        (*reader).flagring = true;
+                        break;
+                case 'l':
+                        (*reader).flaglatency = true;
+                        break;
+                case 'w':
+                        (*reader).flagwait = true;
+                        break;
+                case 'd':
+                        (*reader).flagdelta = true;
+                        break;
+                case 'S':
+                        (*reader).path = optarg;
+                        break;
+                case 'x':
+                        (*reader).flagaxes = true;
+                        break;
+                case 'W':
+                        (*reader).watchdog = atoi(optarg);
+                        break;
+                case 'I':
+                        (*reader).firstinst = atoi(optarg);
+                        break;
+                case 'M':
+                        (*reader).instances = atoi(optarg);
+                        break;
                 case 't':
                         (*reader).period = atoi(optarg)*1000;
                         break;
+                case 'u':
+                        (*reader).period = atoi(optarg);
+                        break;
+                case 'F':
+                        fmt = mk_output_parse(optarg);
+                        if (fmt == -1) {
+                                printf("Unknown output format %s\n",optarg);
+                                exit(0);
+                        }
+                        (*reader).fmt = fmt;
+                        break;
                 case 'h':
                 default:
                         usage(appname);
@@ -164,10 +596,30 @@ void evalCLI(int argc, char* argv[0],struct demoreader_t * reader)
                         break;
                 }
         }
-        if (((*reader).flagmainout == false) && ((*reader).flagmainin == false) && ((*reader).flagaddout) == false) {
+        if (((*reader).flagmainout == false) && ((*reader).flagmainin == false) && ((*reader).flagaddout == false) && ((*reader).flagaxes == false)) {
                 printf("At minium, one block of variables needs to be selected\n");
                 exit(0);
         };
+        if ((NULL != (*reader).path) && ((*reader).flagring || (*reader).flaglatency || (*reader).flagdelta || (*reader).flagwait)) {
+                printf("The fan-out daemon pushes every update, -b, -l, -d and -w can not be used with -S\n");
+                exit(0);
+        }
+        if ((NULL != (*reader).path) && ((*reader).instances != 1)) {
+                printf("The fan-out daemon serves one instance, -M can not be used with -S\n");
+                exit(0);
+        }
+        if ((*reader).flagring && (*reader).flaglatency) {
+                printf("The latency is measured on the shared memories, -l can not be used with -b\n");
+                exit(0);
+        }
+        if ((*reader).flagaxes && ((*reader).flagring || (NULL != (*reader).path) || ((*reader).fmt == MK_OUT_CSV))) {
+                printf("The axes are only read from their shared memory and have no CSV format, -x can not be used with -b, -S and -F csv\n");
+                exit(0);
+        }
+        if ((*reader).instances == 0) {
+                printf("At minimum, one instance needs to be monitored\n");
+                exit(0);
+        }
 
 }
 
@@ -177,72 +629,158 @@ int main(int argc, char* argv[])
         reader.flagaddout = false;
         reader.flagmainout = false;
         reader.flagmainin = false;
+        reader.flagaxes = false;
+        reader.flagring = false;
+        reader.flaglatency = false;
+        reader.flagwait = false;
+        reader.flagdelta = false;
+        reader.path = NULL;
+        reader.insts = NULL;
+        reader.shms = NULL;
+        reader.firstinst = mk_shm_instance();
+        reader.instances = 1;
+        reader.fmt = MK_OUT_TEXT;
+        memset(&reader.out,0,sizeof(reader.out));
+        reader.shmflags = MK_SHM_POPULATE;
         reader.period = 10000000;       // 10 seconds
-        time_t now;
-        struct tm now_local;
+        reader.watchdog = 10;
+        struct instance_t* in;
+        uint32_t i;
+        uint64_t now;
+        uint32_t segments;
+        void* ringbuf = NULL;
+        size_t ringmax = 0;
+        size_t ringslot;
+        uint32_t waitseq = 0;
+        const struct mk_shmhdr* waithdr = NULL;
 
         evalCLI(argc,argv,&reader);
 
         //register signal handlers
         signal(SIGTERM, sigfunc);
         signal(SIGINT, sigfunc);
+        signal(SIGUSR1, sigfunc);
+
+        // the fan-out daemon reads the shared memories instead
+        if (NULL != reader.path) {
+                if (mk_output_init(&reader.out,STDOUT_FILENO,reader.fmt,selectedSegments(&reader)) == 0)
+                        receiveFanout(&reader,selectedSegments(&reader));
+                mk_output_close(&reader.out);
+                return 0;
+        }
 
-        // open and setup shm mapping
-        if (reader.flagmainout) {
-                reader.mainout = (struct mk_mainoutput *) openShM(MK_MAINOUTKEY,sizeof(struct mk_mainoutput),&reader.sem_mainout);
-                if (NULL == reader.mainout)
-                        reader.flagmainout = false;
+        // all instances are attached once and read in the same loop
+        reader.insts = calloc(reader.instances,sizeof(struct instance_t));
+        reader.shms = calloc(reader.instances,sizeof(struct mk_shminst));
+        if ((NULL == reader.insts) || (NULL == reader.shms)) {
+                perror("Allocation of instances failed");
+                exit(1);
+        }
+        // with -b the handles hold the ring buffers instead
+        if (!reader.flagring)
+                mk_shm_attach_insts(reader.shms,reader.firstinst,reader.instances,selectedSegments(&reader),reader.shmflags);
+        for (i = 0; i < reader.instances; i++) {
+                in = &reader.insts[i];
+                in->inst = reader.firstinst + i;
+                in->shm = reader.shms[i].shm;
+                attachInstance(&reader,in);
+                if (reader.flaglatency && (allocLatency(in) == -1)) {
+                        perror("Allocation of latency statistics failed");
+                        exit(1);
+                }
         }
-        if (reader.flagmainin) {
-                reader.mainin = (struct mk_maininput *) openShM(MK_MAININKEY,sizeof(struct mk_maininput),&reader.sem_mainin);
-                if (NULL == reader.mainin)
-                        reader.flagmainin = false;
+
+        if (reader.flagring) {
+                // drain in batches of 64 slots through one buffer sized for the largest slot
+                ringmax = 64;
+                ringslot = 0;
+                for (i = 0; i < reader.instances; i++) {
+                        in = &reader.insts[i];
+                        if ((NULL != in->mainoutring) && (in->mainoutring->slotsize > ringslot))
+                                ringslot = in->mainoutring->slotsize;
+                        if ((NULL != in->maininring) && (in->maininring->slotsize > ringslot))
+                                ringslot = in->maininring->slotsize;
+                        if ((NULL != in->addoutring) && (in->addoutring->slotsize > ringslot))
+                                ringslot = in->addoutring->slotsize;
+                }
+                ringbuf = malloc(ringmax * ringslot + 1);
+                if (NULL == ringbuf) {
+                        perror("Ring buffer allocation failed");
+                        run = 0;
+                }
         }
-        if (reader.flagaddout) {
-                reader.addout = (struct mk_additionaloutput *) openShM(MK_ADDAOUTKEY,sizeof(struct mk_additionaloutput),&reader.sem_addout);
-                if (NULL == reader.addout)
-                        reader.flagaddout = false;
+
+        segments = selectedSegments(&reader);
+        // the latency statistics replace the output of samples
+        if (!reader.flaglatency && (mk_output_init(&reader.out,STDOUT_FILENO,reader.fmt,segments) == -1))
+                run = 0;
+
+        // wait for updates of the shared memory the writer publishes last in a cycle, the others are updated then
+        // instances are published one after the other, shared memories in the order mainout, addout, mainin, axes
+        for (i = 0; i < reader.instances; i++) {
+                in = &reader.insts[i];
+                if (NULL != in->maininring)
+                        waithdr = &in->maininring->hdr;
+                else if (NULL != in->addoutring)
+                        waithdr = &in->addoutring->hdr;
+                else if (NULL != in->mainoutring)
+                        waithdr = &in->mainoutring->hdr;
+                else if (NULL != in->axes)
+                        waithdr = &in->axes->hdr;
+                else if (NULL != in->mainin)
+                        waithdr = &in->mainin->hdr;
+                else if (NULL != in->addout)
+                        waithdr = &in->addout->hdr;
+                else if (NULL != in->mainout)
+                        waithdr = &in->mainout->hdr;
         }
 
         // mainloop
         while(run) {
-                now = time(NULL);
-                now_local = *localtime(&now);
-                if (reader.flagmainout){
-                        sem_wait(reader.sem_mainout);
-                        sem_post(reader.sem_mainout);
-                        printf("\n##### Main Output Variables: (at %02d:%02d:%02d) #####\n", now_local.tm_hour, now_local.tm_min, now_local.tm_sec);
-                        printf("X-Velocity Setpoint: %f mm/s;        Y-Velocity Setpoint: %f mm/s;        Z-Velocity Setpoint: %f mm/s;        Spindlespeed Setpoint: %f rpm\n",reader.mainout->xvel_set,reader.mainout->yvel_set,reader.mainout->zvel_set,reader.mainout->spindlespeed);
-                        printf("X-Axis enabled: %s;             Y-Axis enabled: %s;             Z-Axis enabled: %s;             Spindle enabled: %s\n",reader.mainout->xenable ? "true" : "false",reader.mainout->yenable ? "true" : "false",reader.mainout->zenable ? "true" : "false",reader.mainout->spindleenable ? "true" : "false");
-                        printf("Spindlebranke engaged: %s;      Machine on: %s;                 Emergency Stop activated: %s\n",reader.mainout->spindlebrake ? "true" : "false",reader.mainout->machinestatus ? "true" : "false",reader.mainout->estopstatus ? "true" : "false");
-                }
-                if (reader.flagaddout){
-                        sem_wait(reader.sem_addout);
-                        sem_post(reader.sem_addout);
-                        printf("\n##### Additional Output Variables: (at %02d:%02d:%02d) #####\n", now_local.tm_hour, now_local.tm_min, now_local.tm_sec);
-                        printf("X-Position Setpoint: %f mm;         Y-Position Setpoint: %f mm;        Z-Position Setpoint: %f mm;        Feedrate planned: %f mm/s\n",reader.addout->xpos_set,reader.addout->ypos_set,reader.addout->zpos_set,reader.addout->feedrate);
-                        printf("X-Axis at home: %s;              Y-Axis at home: %s;             Z-Axis at home: %s;             Feedrate override: %f %%\n",reader.addout->xhome ? "true" : "false",reader.addout->yhome ? "true" : "false",reader.addout->zhome ? "true" : "false",reader.addout->feedoverride);
-                        printf("X-Axis at neg Endstop: %s;       Y-Axis at neg Endstop: %s;      Z-Axis at neg Endstop: %s\n",reader.addout->xhardneg ? "true" : "false",reader.addout->yhardneg ? "true" : "false",reader.addout->zhardneg ? "true" : "false");
-                        printf("X-Axis at pos Endstop: %s;       Y-Axis at pos Endstop: %s;      Z-Axis at pos Endstop: %s\n",reader.addout->xhardpos ? "true" : "false",reader.addout->yhardpos ? "true" : "false",reader.addout->zhardpos ? "true" : "false");
-                        printf("Current Line Number: %d;                                         Tool Number: %d;                Mode: %d\n",reader.addout->lineno,reader.addout->tool,reader.addout->mode);
-                }
-                if (reader.flagmainin){
-                        sem_wait(reader.sem_mainin);
-                        sem_post(reader.sem_mainin);
-                        printf("\n##### Main Input Variables: (at %02d:%02d:%02d) #####\n", now_local.tm_hour, now_local.tm_min, now_local.tm_sec);
-                        printf("X-Position Current: %f mm;         Y-Position Current: %f mm;        Z-Position Current: %f mm;\n",reader.mainin->xpos_cur,reader.mainin->ypos_cur,reader.mainin->zpos_cur);
-                        printf("X-Axis faulty: %s;              Y-Axis faulty: %s;             Z-Axis faulty: %s;\n",reader.mainin->xfault ? "true" : "false",reader.mainin->yfault ? "true" : "false",reader.mainin->zfault ? "true" : "false");
-                }
-                usleep(reader.period);
+                if (!reader.flagring) {
+                        for (i = 0; i < reader.instances; i++)
+                                if (checkInstance(&reader.insts[i]) == -1)
+                                        run = 0;
+                        if (!run)
+                                break;
+                }
+                now = mk_shm_realtime();
+                for (i = 0; i < reader.instances; i++) {
+                        in = &reader.insts[i];
+                        if (reader.flaglatency)
+                                measureInstance(in);
+                        else if (reader.flagring)
+                                drainInstance(&reader,in,ringbuf,ringmax);
+                        else
+                                readInstance(&reader,in,now);
+                }
+                if (reader.flaglatency && dump) {
+                        dump = 0;
+                        for (i = 0; i < reader.instances; i++)
+                                printInstanceLatency(&reader.insts[i]);
+                }
+                waitUpdate(&reader,waithdr,&waitseq);
+        }
+
+        if (reader.flaglatency) {
+                for (i = 0; i < reader.instances; i++)
+                        printInstanceLatency(&reader.insts[i]);
         }
 
         // cleanup
-        if (reader.flagmainout)
-                closeShM((void**)&reader.mainout, sizeof(reader.mainout),&reader.sem_mainout);
-        if (reader.flagmainin)
-                closeShM((void**)&reader.mainin, sizeof(reader.mainin),&reader.sem_mainin);
-        if (reader.flagaddout)
-                closeShM((void**)&reader.addout, sizeof(reader.addout),&reader.sem_addout);
+        mk_output_close(&reader.out);
+        for (i = 0; i < reader.instances; i++) {
+                in = &reader.insts[i];
+                mk_shm_detach(&in->shm_axes);
+                free(in->mainoutlat);
+                free(in->maininlat);
+                free(in->addoutlat);
+                free(in->axeslat);
+        }
+        mk_shm_detach_insts(reader.shms,reader.instances);
+        free(reader.insts);
+        free(reader.shms);
+        free(ringbuf);
 
         return 0;
 }
@@ -0,0 +1,352 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* SHM-Demoapplication to record the shared memories every cycle into a binary trace file
+ *
+ * With -z the records are compressed into an archive file instead, see
+ * lib/mk_shmarchive.h, for recording over long times.
+ *
+ * Usage:
+ * -o           Records main output variables from control
+ * -i           Records main input variables to control
+ * -a           Records additional output variables from control
+ * -f [file]    Specifies the trace file
+ * -n [value]   Specifies the maximum number of records, 0 records until terminated with -z. Default 1000000
+ * -z           Records into a compressed archive file instead of a trace file
+ * -t [value]   Specifies sampling-period in milliseconds. Default 1 millisecond
+ * -u [value]   Specifies sampling-period in microseconds
+ * -w           Waits for updates of the writer, at most one period. Default
+ * -p           Polls with the sampling-period instead of waiting for updates of the writer
+ * -m           Locks the shared memories into RAM
+ * -H           Uses shared memories backed by hugepages (hugetlbfs)
+ * -h           Prints this help message and exits
+ *
+ */
+
+#include "../mk_shminterface.h"
+#include "../lib/mk_shmlib.h"
+#include "../lib/mk_shmtrace.h"
+#include "../lib/mk_shmarchive.h"
+#include "../lib/mk_shmsnap.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+
+uint8_t run = 1;
+struct demorecorder_t {
+        struct mk_mainoutput_shm * mainout;
+        struct mk_maininput_shm * mainin;
+        struct mk_additionaloutput_shm * addout;
+        struct mk_shm shm_mainout;
+        struct mk_shm shm_mainin;
+        struct mk_shm shm_addout;
+        struct mk_trace trace;
+        struct mk_archive archive;
+        struct mk_snapset snapset;
+        char* file;
+        uint64_t capacity;
+        int shmflags;
+        uint32_t period;
+        bool flagmainout;
+        bool flagmainin;
+        bool flagaddout;
+        bool flagwait;
+        bool flagarchive;
+        bool checked;   //layouts checked again after all writers published, see checkWriters
+};
+
+/* signal handler */
+void sigfunc(int sig)
+{
+        switch(sig)
+        {
+        case SIGINT:
+                if(run)
+                        run = 0;
+                else
+                        exit(0);
+                break;
+        case SIGTERM:
+                run = 0;
+                break;
+        }
+}
+
+/* Checks the layout of a shared memory again once its writer published, returns 1 if checked, 0 if not yet and -1 on a mismatch
+ *
+ * The recorder may have created the shared memory before the writer was
+ * started, which initializes the header again with its own layout.
+ */
+int checkWriter(const struct mk_shm* shm)
+{
+        const struct mk_shmhdr* hdr = (const struct mk_shmhdr*) shm->addr;
+
+        if (NULL == hdr)
+                return 1;
+        if (__atomic_load_n(&hdr->stamp, __ATOMIC_ACQUIRE) == 0)
+                return 0;
+        return (mk_shm_check(shm) == 0) ? 1 : -1;
+}
+
+/* Checks the layout of all selected shared memories, see checkWriter */
+int checkWriters(struct demorecorder_t* recorder)
+{
+        int mainoutok;
+        int maininok;
+        int addoutok;
+
+        if (recorder->checked)
+                return 1;
+        mainoutok = checkWriter(&recorder->shm_mainout);
+        maininok = checkWriter(&recorder->shm_mainin);
+        addoutok = checkWriter(&recorder->shm_addout);
+        if ((mainoutok == -1) || (maininok == -1) || (addoutok == -1))
+                return -1;
+        recorder->checked = (mainoutok == 1) && (maininok == 1) && (addoutok == 1);
+        return recorder->checked ? 1 : 0;
+}
+
+/* Print usage message */
+static void usage(char *appname)
+{
+        fprintf(stderr,
+                "\n"
+                "Usage: %s [options]\n"
+                " -o            Records main output variables from control\n"
+                " -i            Records main input variables to control\n"
+                " -a            Records additional output variables from control\n"
+                " -f [file]     Specifies the trace file\n"
+                " -n [value]    Specifies the maximum number of records, 0 records until terminated with -z. Default 1000000\n"
+                " -z            Records into a compressed archive file instead of a trace file\n"
+                " -t [value]    Specifies sampling-period in milliseconds. Default 1 millisecond.\n"
+                " -u [value]    Specifies sampling-period in microseconds\n"
+                " -w            Waits for updates of the writer, at most one period. Default\n"
+                " -p            Polls with the sampling-period instead of waiting for updates of the writer\n"
+                " -m            Locks the shared memories into RAM\n"
+                " -H            Uses shared memories backed by hugepages (hugetlbfs)\n"
+                " -h            Prints this help message and exits\n"
+                "\n",
+                appname);
+}
+
+/* Evaluate CLI-parameters */
+void evalCLI(int argc, char* argv[0],struct demorecorder_t * recorder)
+{
+        int c;
+        char* appname = strrchr(argv[0], '/');
+        appname = appname ? 1 + appname : argv[0];
+        while (EOF != (c = getopt(argc,argv,"oiahmHwpzf:n:t:u:"))) {
+                switch(c) {
+                case 'o':
+                        (*recorder).flagmainout = true;
+                        break;
+                case 'i':
+                        (*recorder).flagmainin = true;
+                        break;
+                case 'a':
+                        (*recorder).flagaddout = true;
+                        break;
+                case 'f':
+                        (*recorder).file = optarg;
+                        break;
+                case 'n':
+                        (*recorder).capacity = strtoull(optarg,NULL,10);
+                        break;
+                case 'm':
+                        (*recorder).shmflags |= MK_SHM_MLOCK;
+                        break;
+                case 'H':
+                        (*recorder).shmflags |= MK_SHM_HUGEPAGE;
+                        break;
+                case 'w':
+                        (*recorder).flagwait = true;
+                        break;
+                case 'p':
+                        (*recorder).flagwait = false;
+                        break;
+                case 'z':
+                        (*recorder).flagarchive = true;
+                        break;
+                case 't':
+                        (*recorder).period = atoi(optarg)*1000;
+                        break;
+                case 'u':
+                        (*recorder).period = atoi(optarg);
+                        break;
+                case 'h':
+                default:
+                        usage(appname);
+                        exit(0);
+                        break;
+                }
+        }
+        if (((*recorder).flagmainout == false) && ((*recorder).flagmainin == false) && ((*recorder).flagaddout) == false) {
+                printf("At minium, one block of variables needs to be selected\n");
+                exit(0);
+        };
+        if ((NULL == (*recorder).file) || (((*recorder).capacity == 0) && !(*recorder).flagarchive)) {
+                printf("A trace file and a number of records need to be specified\n");
+                exit(0);
+        }
+}
+
+int main(int argc, char* argv[])
+{
+        struct demorecorder_t recorder;
+        memset(&recorder,0,sizeof(recorder));
+        recorder.shmflags = MK_SHM_POPULATE;
+        recorder.capacity = 1000000;
+        recorder.period = 1000;         // 1 millisecond
+        recorder.flagwait = true;       // polling misses cycles of a writer with the same period
+        struct mk_snapshot snap;
+        struct mk_tracerec* rec;
+        struct mk_tracerec arcrec;
+        const struct mk_shmhdr* trighdr = NULL;
+        enum mk_shmseg trigseg;
+        uint32_t trigseq = 0;
+        uint32_t seq;
+        uint32_t segments = 0;
+        uint64_t missed = 0;
+        uint64_t lastcycle = 0;
+        uint64_t count = 0;
+
+        evalCLI(argc,argv,&recorder);
+
+        //register signal handlers
+        signal(SIGTERM, sigfunc);
+        signal(SIGINT, sigfunc);
+
+        // open and setup shm mapping
+        if (recorder.flagmainout) {
+                recorder.mainout = (struct mk_mainoutput_shm *) mk_shm_attach(&recorder.shm_mainout,MK_SHM_MAINOUT,recorder.shmflags);
+                if (NULL == recorder.mainout)
+                        recorder.flagmainout = false;
+                else
+                        segments |= 1 << MK_SHM_MAINOUT;
+        }
+        if (recorder.flagmainin) {
+                recorder.mainin = (struct mk_maininput_shm *) mk_shm_attach(&recorder.shm_mainin,MK_SHM_MAININ,recorder.shmflags);
+                if (NULL == recorder.mainin)
+                        recorder.flagmainin = false;
+                else
+                        segments |= 1 << MK_SHM_MAININ;
+        }
+        if (recorder.flagaddout) {
+                recorder.addout = (struct mk_additionaloutput_shm *) mk_shm_attach(&recorder.shm_addout,MK_SHM_ADDOUT,recorder.shmflags);
+                if (NULL == recorder.addout)
+                        recorder.flagaddout = false;
+                else
+                        segments |= 1 << MK_SHM_ADDOUT;
+        }
+        if (segments == 0)
+                exit(1);
+        mk_snap_init(&recorder.snapset);
+        mk_snap_add(&recorder.snapset,MK_SHM_MAINOUT,recorder.mainout);
+        mk_snap_add(&recorder.snapset,MK_SHM_MAININ,recorder.mainin);
+        mk_snap_add(&recorder.snapset,MK_SHM_ADDOUT,recorder.addout);
+
+        // a new record is taken whenever the first selected shared memory was updated
+        if (recorder.flagmainout) {
+                trighdr = &recorder.mainout->hdr;
+                trigseg = MK_SHM_MAINOUT;
+        } else if (recorder.flagaddout) {
+                trighdr = &recorder.addout->hdr;
+                trigseg = MK_SHM_ADDOUT;
+        } else {
+                trighdr = &recorder.mainin->hdr;
+                trigseg = MK_SHM_MAININ;
+        }
+
+        if (recorder.flagarchive) {
+                if (mk_archive_create(&recorder.archive,recorder.file,segments,recorder.period,MK_ARC_BLOCKLEN) == -1)
+                        exit(1);
+        } else if (mk_trace_create(&recorder.trace,recorder.file,recorder.capacity,segments,recorder.period) == -1) {
+                exit(1);
+        }
+
+        // mainloop
+        while(run) {
+                if (recorder.flagwait)
+                        mk_shm_wait(trighdr,trigseq,recorder.period);
+                else
+                        usleep(recorder.period);
+                seq = __atomic_load_n(&trighdr->seq, __ATOMIC_ACQUIRE);
+                // nothing published yet or no update since the last record
+                if ((seq == trigseq) || (trighdr->stamp == 0))
+                        continue;
+                trigseq = seq;
+                if (checkWriters(&recorder) == -1)
+                        break;
+
+                if (recorder.flagarchive && (recorder.capacity != 0) && (count >= recorder.capacity)) {
+                        fprintf(stderr,"Maximum number of records reached\n");
+                        break;
+                }
+                // the archive compresses a copy, the trace file is filled in place
+                rec = recorder.flagarchive ? &arcrec : mk_trace_next(&recorder.trace);
+                if (NULL == rec) {
+                        fprintf(stderr,"Trace file is full\n");
+                        break;
+                }
+                // the shared memories of a writer are taken from the same cycle, if they still differ each is
+                // recorded consistent in itself and the record shows it by the cycle counters of the shared memories
+                if (mk_snap_read(&recorder.snapset,&snap,MK_SNAP_TRIES) == -1)
+                        continue;
+                memset(rec,0,sizeof(*rec));
+                rec->stamp = mk_shm_taitime();
+                if (recorder.flagmainout) {
+                        rec->seg[MK_SHM_MAINOUT].cycle = snap.cycles[MK_SHM_MAINOUT];
+                        rec->seg[MK_SHM_MAINOUT].stamp = snap.stamps[MK_SHM_MAINOUT];
+                        mk_mainoutput_towire(&rec->mainout,&snap.mainout);
+                }
+                if (recorder.flagmainin) {
+                        rec->seg[MK_SHM_MAININ].cycle = snap.cycles[MK_SHM_MAININ];
+                        rec->seg[MK_SHM_MAININ].stamp = snap.stamps[MK_SHM_MAININ];
+                        mk_maininput_towire(&rec->mainin,&snap.mainin);
+                }
+                if (recorder.flagaddout) {
+                        rec->seg[MK_SHM_ADDOUT].cycle = snap.cycles[MK_SHM_ADDOUT];
+                        rec->seg[MK_SHM_ADDOUT].stamp = snap.stamps[MK_SHM_ADDOUT];
+                        mk_additionaloutput_towire(&rec->addout,&snap.addout);
+                }
+                // count cycles of the writer which were not recorded
+                if ((count > 0) && (rec->seg[trigseg].cycle > lastcycle + 1))
+                        missed += rec->seg[trigseg].cycle - lastcycle - 1;
+                lastcycle = rec->seg[trigseg].cycle;
+                if (!recorder.flagarchive) {
+                        mk_trace_commit(&recorder.trace);
+                } else if (mk_archive_append(&recorder.archive,rec) == -1) {
+                        break;
+                }
+                count++;
+        }
+
+        // cleanup
+        if (recorder.flagarchive) {
+                mk_archive_close(&recorder.archive);
+                printf("%llu records written to %s in %llu bytes (%.1f bytes per record), %llu cycles missed, %llu of different cycles, %llu pairs of different writers skewed\n",
+                        (unsigned long long) count,recorder.file,(unsigned long long) recorder.archive.bytes,
+                        count ? (double) recorder.archive.bytes / count : 0.0,(unsigned long long) missed,
+                        (unsigned long long) recorder.snapset.incoherent,(unsigned long long) recorder.snapset.skewed);
+        } else {
+                printf("%llu records written to %s, %llu cycles missed, %llu of different cycles, %llu pairs of different writers skewed\n",(unsigned long long) count,recorder.file,
+                        (unsigned long long) missed,(unsigned long long) recorder.snapset.incoherent,(unsigned long long) recorder.snapset.skewed);
+                mk_trace_close(&recorder.trace);
+        }
+        if (recorder.flagmainout)
+                mk_shm_detach(&recorder.shm_mainout);
+        if (recorder.flagmainin)
+                mk_shm_detach(&recorder.shm_mainin);
+        if (recorder.flagaddout)
+                mk_shm_detach(&recorder.shm_addout);
+
+        return 0;
+}
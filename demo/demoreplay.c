@@ -0,0 +1,386 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* SHM-Demoapplication to replay a trace file recorded by demorecorder into the shared memories
+ *
+ * Usage:
+ * -f [file]    Specifies the trace file
+ * -o           Replays main output variables from control
+ * -i           Replays main input variables to control
+ * -a           Replays additional output variables from control
+ *              Without -o, -i and -a all recorded shared memories are replayed
+ * -s [factor]  Replays with factor times the original speed. Default 1
+ * -l [count]   Replays the trace count times, 0 loops endlessly. Default 1
+ * -e [file]    Writes the timing error of every cycle to a csv file
+ * -m           Locks the shared memories into RAM
+ * -H           Uses shared memories backed by hugepages (hugetlbfs)
+ * -r [prio]    Runs as realtime process with SCHED_FIFO priority prio and locked memory
+ * -c [cpu]     Pins the process to the cpu
+ * -n           Notifies waiting readers after every update
+ * -h           Prints this help message and exits
+ *
+ */
+
+#define _GNU_SOURCE
+#include "../mk_shminterface.h"
+#include "../lib/mk_shmlib.h"
+#include "../lib/mk_shmtrace.h"
+#include "../lib/mk_shmhist.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+uint8_t run = 1;
+struct demoreplay_t {
+        struct mk_mainoutput_shm * mainout;
+        struct mk_maininput_shm * mainin;
+        struct mk_additionaloutput_shm * addout;
+        struct mk_shm shm_mainout;
+        struct mk_shm shm_mainin;
+        struct mk_shm shm_addout;
+        struct mk_trace trace;
+        char* file;
+        char* errfile;
+        double speed;
+        uint64_t loops;
+        int shmflags;
+        int rtprio;
+        int cpu;
+        bool flagmainout;
+        bool flagmainin;
+        bool flagaddout;
+};
+
+/* signal handler */
+void sigfunc(int sig)
+{
+        switch(sig)
+        {
+        case SIGINT:
+                if(run)
+                        run = 0;
+                else
+                        exit(0);
+                break;
+        case SIGTERM:
+                run = 0;
+                break;
+        }
+}
+
+/* Print usage message */
+static void usage(char *appname)
+{
+        fprintf(stderr,
+                "\n"
+                "Usage: %s [options]\n"
+                " -f [file]     Specifies the trace file\n"
+                " -o            Replays main output variables from control\n"
+                " -i            Replays main input variables to control\n"
+                " -a            Replays additional output variables from control\n"
+                "               Without -o, -i and -a all recorded shared memories are replayed\n"
+                " -s [factor]   Replays with factor times the original speed. Default 1\n"
+                " -l [count]    Replays the trace count times, 0 loops endlessly. Default 1\n"
+                " -e [file]     Writes the timing error of every cycle to a csv file\n"
+                " -m            Locks the shared memories into RAM\n"
+                " -H            Uses shared memories backed by hugepages (hugetlbfs)\n"
+                " -r [prio]     Runs as realtime process with SCHED_FIFO priority prio and locked memory\n"
+                " -c [cpu]      Pins the process to the cpu\n"
+                " -n            Notifies waiting readers after every update\n"
+                " -h            Prints this help message and exits\n"
+                "\n",
+                appname);
+}
+
+/* Evaluate CLI-parameters */
+void evalCLI(int argc, char* argv[0],struct demoreplay_t * replay)
+{
+        int c;
+        char* appname = strrchr(argv[0], '/');
+        appname = appname ? 1 + appname : argv[0];
+        while (EOF != (c = getopt(argc,argv,"oiahmHnf:s:l:e:r:c:"))) {
+                switch(c) {
+                case 'o':
+                        (*replay).flagmainout = true;
+                        break;
+                case 'i':
+                        (*replay).flagmainin = true;
+                        break;
+                case 'a':
+                        (*replay).flagaddout = true;
+                        break;
+                case 'f':
+                        (*replay).file = optarg;
+                        break;
+                case 's':
+                        (*replay).speed = atof(optarg);
+                        break;
+                case 'l':
+                        (*replay).loops = strtoull(optarg,NULL,10);
+                        break;
+                case 'e':
+                        (*replay).errfile = optarg;
+                        break;
+                case 'm':
+                        (*replay).shmflags |= MK_SHM_MLOCK;
+                        break;
+                case 'H':
+                        (*replay).shmflags |= MK_SHM_HUGEPAGE;
+                        break;
+                case 'r':
+                        (*replay).rtprio = atoi(optarg);
+                        break;
+                case 'c':
+                        (*replay).cpu = atoi(optarg);
+                        break;
+                case 'n':
+                        (*replay).shmflags |= MK_SHM_NOTIFY;
+                        break;
+                case 'h':
+                default:
+                        usage(appname);
+                        exit(0);
+                        break;
+                }
+        }
+        if (NULL == (*replay).file) {
+                printf("A trace file needs to be specified\n");
+                exit(0);
+        }
+        if ((*replay).speed <= 0) {
+                printf("The speed factor needs to be positive\n");
+                exit(0);
+        }
+}
+
+/* Configures cpu affinity, realtime scheduling and memory locking */
+int setupRT(struct demoreplay_t* replay)
+{
+        struct sched_param param;
+        cpu_set_t cpus;
+        if (replay->cpu >= 0) {
+                CPU_ZERO(&cpus);
+                CPU_SET(replay->cpu,&cpus);
+                if (sched_setaffinity(0,sizeof(cpus),&cpus) == -1) {
+                        perror("Setting cpu affinity failed");
+                        return -1;
+                }
+        }
+        if (replay->rtprio > 0) {
+                // also locks the trace file and the shared memories mapped later on
+                if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+                        perror("Locking memory failed");
+                        return -1;
+                }
+                param.sched_priority = replay->rtprio;
+                if (sched_setscheduler(0,SCHED_FIFO,&param) == -1) {
+                        perror("Setting realtime priority failed");
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+/* Sleeps until the absolute CLOCK_TAI time target in ns */
+void waitUntil(uint64_t target)
+{
+        struct timespec next;
+        next.tv_sec = target / 1000000000ULL;
+        next.tv_nsec = target % 1000000000ULL;
+        while (run && (clock_nanosleep(CLOCK_TAI,TIMER_ABSTIME,&next,NULL) == EINTR));
+}
+
+int main(int argc, char* argv[])
+{
+        struct demoreplay_t replay;
+        memset(&replay,0,sizeof(replay));
+        replay.shmflags = MK_SHM_WRITER | MK_SHM_POPULATE;
+        replay.speed = 1.0;
+        replay.loops = 1;
+        replay.cpu = -1;
+        mk_mainoutput_t mainout;
+        mk_maininput_t mainin;
+        mk_additionaloutput_t addout;
+        const struct mk_tracerec* rec;
+        const struct mk_tracerec* first;
+        const struct mk_tracerec* last;
+        const struct mk_tracerec* prev;
+        enum mk_shmseg trigseg;
+        uint64_t count;
+        uint64_t i;
+        uint64_t loop;
+        uint64_t origin;
+        uint64_t looplen;
+        uint32_t period;
+        uint64_t cyclelen;
+        uint64_t start;
+        uint64_t target;
+        uint64_t stamp;
+        uint64_t cycle;
+        uint64_t late;
+        uint64_t published = 0;
+        struct mk_hist* error;
+        FILE* errfile = NULL;
+
+        evalCLI(argc,argv,&replay);
+
+        //register signal handlers
+        signal(SIGTERM, sigfunc);
+        signal(SIGINT, sigfunc);
+
+        if (mk_trace_open(&replay.trace,replay.file) == -1)
+                exit(1);
+        count = replay.trace.hdr->count;
+        if (count == 0) {
+                fprintf(stderr,"Trace %s contains no records\n",replay.file);
+                exit(1);
+        }
+        // the records are read once front to back
+        madvise(replay.trace.hdr,replay.trace.maplen,MADV_SEQUENTIAL);
+        madvise(replay.trace.hdr,replay.trace.maplen,MADV_WILLNEED);
+
+        // replay all recorded shared memories if none is selected, but only recorded ones
+        if (!replay.flagmainout && !replay.flagmainin && !replay.flagaddout) {
+                replay.flagmainout = true;
+                replay.flagmainin = true;
+                replay.flagaddout = true;
+        }
+        replay.flagmainout = replay.flagmainout && (replay.trace.hdr->segments & (1 << MK_SHM_MAINOUT));
+        replay.flagmainin = replay.flagmainin && (replay.trace.hdr->segments & (1 << MK_SHM_MAININ));
+        replay.flagaddout = replay.flagaddout && (replay.trace.hdr->segments & (1 << MK_SHM_ADDOUT));
+        if (!replay.flagmainout && !replay.flagmainin && !replay.flagaddout) {
+                fprintf(stderr,"None of the selected shared memories is recorded in %s\n",replay.file);
+                exit(1);
+        }
+
+        // the recorder took a record whenever its first recorded shared memory was updated
+        if (replay.trace.hdr->segments & (1 << MK_SHM_MAINOUT))
+                trigseg = MK_SHM_MAINOUT;
+        else if (replay.trace.hdr->segments & (1 << MK_SHM_ADDOUT))
+                trigseg = MK_SHM_ADDOUT;
+        else
+                trigseg = MK_SHM_MAININ;
+
+        if (NULL != replay.errfile) {
+                errfile = fopen(replay.errfile,"w");
+                if (NULL == errfile) {
+                        perror("Opening error file failed");
+                        exit(1);
+                }
+                fprintf(errfile,"loop,record,cycle,target_ns,publish_ns,error_ns\n");
+        }
+        error = malloc(sizeof(*error));
+        if (NULL == error) {
+                perror("Allocating histogram failed");
+                exit(1);
+        }
+        mk_hist_init(error);
+
+        if (setupRT(&replay) == -1)
+                exit(1);
+
+        // open and setup shm mapping
+        if (replay.flagmainout) {
+                replay.mainout = (struct mk_mainoutput_shm *) mk_shm_attach(&replay.shm_mainout,MK_SHM_MAINOUT,replay.shmflags);
+                if (NULL == replay.mainout)
+                        replay.flagmainout = false;
+        }
+        if (replay.flagmainin) {
+                replay.mainin = (struct mk_maininput_shm *) mk_shm_attach(&replay.shm_mainin,MK_SHM_MAININ,replay.shmflags);
+                if (NULL == replay.mainin)
+                        replay.flagmainin = false;
+        }
+        if (replay.flagaddout) {
+                replay.addout = (struct mk_additionaloutput_shm *) mk_shm_attach(&replay.shm_addout,MK_SHM_ADDOUT,replay.shmflags);
+                if (NULL == replay.addout)
+                        replay.flagaddout = false;
+        }
+
+        // a loop lasts from the first to the last record plus one mean interval, so consecutive
+        // loops keep the recorded rate and the cycle counters keep increasing
+        first = mk_trace_record(&replay.trace,0);
+        last = mk_trace_record(&replay.trace,count - 1);
+        origin = first->seg[trigseg].stamp ? first->seg[trigseg].stamp : first->stamp;
+        looplen = (last->seg[trigseg].stamp ? last->seg[trigseg].stamp : last->stamp) - origin;
+        if (count > 1)
+                looplen += looplen / (count - 1);
+        cyclelen = last->seg[trigseg].cycle - first->seg[trigseg].cycle + 1;
+
+        // announce the mean interval at the replay speed as update-period to the readers
+        period = (uint32_t) ((double) looplen / count / replay.speed / 1000);
+        if (replay.flagmainout)
+                mk_shm_setperiod(&replay.mainout->hdr,period);
+        if (replay.flagmainin)
+                mk_shm_setperiod(&replay.mainin->hdr,period);
+        if (replay.flagaddout)
+                mk_shm_setperiod(&replay.addout->hdr,period);
+
+        // mainloop
+        start = mk_shm_taitime();
+        for (loop = 0; run && ((replay.loops == 0) || (loop < replay.loops)); loop++) {
+                prev = NULL;
+                for (i = 0; run && (i < count); i++) {
+                        rec = mk_trace_record(&replay.trace,i);
+                        stamp = rec->seg[trigseg].stamp ? rec->seg[trigseg].stamp : rec->stamp;
+                        target = start + (uint64_t) ((double) (loop * looplen + (stamp - origin)) / replay.speed);
+                        waitUntil(target);
+                        if (!run)
+                                break;
+
+                        stamp = mk_shm_taitime();
+                        cycle = loop * cyclelen + rec->seg[trigseg].cycle - first->seg[trigseg].cycle;
+                        // only shared memories updated since the previous record are published again
+                        if (replay.flagmainout && ((NULL == prev) || (rec->seg[MK_SHM_MAINOUT].cycle != prev->seg[MK_SHM_MAINOUT].cycle))) {
+                                mk_mainoutput_fromwire(&mainout,&rec->mainout);
+                                mk_shm_write(&replay.mainout->hdr,&replay.mainout->data,&mainout,sizeof(mainout),cycle,stamp);
+                                mk_shm_notify(&replay.mainout->hdr);
+                        }
+                        if (replay.flagaddout && ((NULL == prev) || (rec->seg[MK_SHM_ADDOUT].cycle != prev->seg[MK_SHM_ADDOUT].cycle))) {
+                                mk_additionaloutput_fromwire(&addout,&rec->addout);
+                                mk_shm_write(&replay.addout->hdr,&replay.addout->data,&addout,sizeof(addout),cycle,stamp);
+                                mk_shm_notify(&replay.addout->hdr);
+                        }
+                        if (replay.flagmainin && ((NULL == prev) || (rec->seg[MK_SHM_MAININ].cycle != prev->seg[MK_SHM_MAININ].cycle))) {
+                                mk_maininput_fromwire(&mainin,&rec->mainin);
+                                mk_shm_write(&replay.mainin->hdr,&replay.mainin->data,&mainin,sizeof(mainin),cycle,stamp);
+                                mk_shm_notify(&replay.mainin->hdr);
+                        }
+                        prev = rec;
+                        published++;
+
+                        late = stamp > target ? stamp - target : 0;
+                        mk_hist_record(error,late);
+                        if (NULL != errfile)
+                                fprintf(errfile,"%llu,%llu,%llu,%llu,%llu,%llu\n",(unsigned long long) loop,(unsigned long long) i,
+                                        (unsigned long long) cycle,(unsigned long long) target,(unsigned long long) stamp,(unsigned long long) late);
+                }
+        }
+
+        printf("%llu records of %s published in %llu loops at %gx speed\n",(unsigned long long) published,replay.file,(unsigned long long) loop,replay.speed);
+        mk_hist_print(error,stdout,"timing error [ns]");
+
+        // cleanup
+        if (NULL != errfile)
+                fclose(errfile);
+        free(error);
+        mk_trace_close(&replay.trace);
+        if (replay.flagmainout)
+                mk_shm_detach(&replay.shm_mainout);
+        if (replay.flagmainin)
+                mk_shm_detach(&replay.shm_mainin);
+        if (replay.flagaddout)
+                mk_shm_detach(&replay.shm_addout);
+
+        return 0;
+}
@@ -0,0 +1,340 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* SHM-Demoapplication to compute rolling window statistics of the shared memories
+ *
+ * The daemon feeds every update of the writer into a statistics aggregator
+ * and publishes min, max, mean, RMS and the number of changes and rising
+ * edges of all variables, the following errors and the effective feedrate
+ * over the last window in the statistics shared memory, see
+ * lib/mk_shmstats.h. With -p it reads the statistics shared memory instead
+ * and prints every publication.
+ *
+ * Usage:
+ * -o           Samples main output variables from control
+ * -i           Samples main input variables to control
+ * -a           Samples additional output variables from control
+ * -W [value]   Specifies the window in cycles of the writer. Default 1000
+ * -I [value]   Specifies the instance of the interface. Default MK_SHM_INSTANCE or 0
+ * -p           Prints the published statistics instead of computing them
+ * -t [value]   Specifies sampling-period in milliseconds. Default update-period of the writer
+ * -u [value]   Specifies sampling-period in microseconds
+ * -w           Waits for updates of the writer instead of polling, at most one period
+ * -m           Locks the shared memories into RAM
+ * -H           Uses shared memories backed by hugepages (hugetlbfs)
+ * -h           Prints this help message and exits
+ *
+ */
+
+#include "../mk_shminterface.h"
+#include "../lib/mk_shmlib.h"
+#include "../lib/mk_shmstats.h"
+#include "../lib/mk_shmsnap.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+
+// sampling period if neither given nor announced by the writer
+#define DEMOSTATS_PERIOD 1000
+
+uint8_t run = 1;
+
+struct demostats_t {
+        struct mk_mainoutput_shm * mainout;
+        struct mk_maininput_shm * mainin;
+        struct mk_additionaloutput_shm * addout;
+        struct mk_stats_shm * stats;
+        struct mk_shm shm_mainout;
+        struct mk_shm shm_mainin;
+        struct mk_shm shm_addout;
+        struct mk_shm shm_stats;
+        const struct mk_shmhdr* waithdr;        //selected shared memory published last in a cycle
+        struct mk_statsagg agg;
+        struct mk_stats result;
+        struct mk_snapset snapset;
+        struct mk_snapshot snap;
+        struct mk_mainoutput wire_mainout;
+        struct mk_additionaloutput wire_addout;
+        struct mk_maininput wire_mainin;
+        uint32_t seq;           //seq of the last sample
+        uint32_t window;
+        uint32_t inst;
+        uint32_t period;
+        int shmflags;
+        bool flagmainout;
+        bool flagmainin;
+        bool flagaddout;
+        bool flagprint;
+        bool flagwait;
+        uint64_t samples;
+        uint64_t published;
+};
+
+/* signal handler */
+void sigfunc(int sig)
+{
+        switch(sig)
+        {
+        case SIGINT:
+                if(run)
+                        run = 0;
+                else
+                        exit(0);
+                break;
+        case SIGTERM:
+                run = 0;
+                break;
+        }
+}
+
+/* Print usage message */
+static void usage(char *appname)
+{
+        fprintf(stderr,
+                "\n"
+                "Usage: %s [options]\n"
+                " -o            Samples main output variables from control\n"
+                " -i            Samples main input variables to control\n"
+                " -a            Samples additional output variables from control\n"
+                " -W [value]    Specifies the window in cycles of the writer. Default 1000\n"
+                " -I [value]    Specifies the instance of the interface. Default MK_SHM_INSTANCE or 0\n"
+                " -p            Prints the published statistics instead of computing them\n"
+                " -t [value]    Specifies sampling-period in milliseconds. Default update-period of the writer\n"
+                " -u [value]    Specifies sampling-period in microseconds\n"
+                " -w            Waits for updates of the writer instead of polling, at most one period\n"
+                " -m            Locks the shared memories into RAM\n"
+                " -H            Uses shared memories backed by hugepages (hugetlbfs)\n"
+                " -h            Prints this help message and exits\n"
+                "\n",
+                appname);
+}
+
+/* Evaluate CLI-parameters */
+void evalCLI(int argc, char* argv[0],struct demostats_t * stats)
+{
+        int c;
+        char* appname = strrchr(argv[0], '/');
+        appname = appname ? 1 + appname : argv[0];
+        while (EOF != (c = getopt(argc,argv,"oiahmHwpW:I:t:u:"))) {
+                switch(c) {
+                case 'o':
+                        (*stats).flagmainout = true;
+                        break;
+                case 'i':
+                        (*stats).flagmainin = true;
+                        break;
+                case 'a':
+                        (*stats).flagaddout = true;
+                        break;
+                case 'W':
+                        (*stats).window = atoi(optarg);
+                        break;
+                case 'I':
+                        (*stats).inst = atoi(optarg);
+                        break;
+                case 'p':
+                        (*stats).flagprint = true;
+                        break;
+                case 'm':
+                        (*stats).shmflags |= MK_SHM_MLOCK;
+                        break;
+                case 'H':
+                        (*stats).shmflags |= MK_SHM_HUGEPAGE;
+                        break;
+                case 'w':
+                        (*stats).flagwait = true;
+                        break;
+                case 't':
+                        (*stats).period = atoi(optarg)*1000;
+                        break;
+                case 'u':
+                        (*stats).period = atoi(optarg);
+                        break;
+                case 'h':
+                default:
+                        usage(appname);
+                        exit(0);
+                        break;
+                }
+        }
+        // sample all shared memories if none is selected
+        if (!(*stats).flagmainout && !(*stats).flagmainin && !(*stats).flagaddout) {
+                (*stats).flagmainout = true;
+                (*stats).flagmainin = true;
+                (*stats).flagaddout = true;
+        }
+        if ((*stats).window < MK_STATS_BUCKETS) {
+                printf("The window needs at least %d cycles\n",MK_STATS_BUCKETS);
+                exit(0);
+        }
+}
+
+/* Reads a cycle-coherent snapshot of the selected shared memories and adds it, returns true if a bucket was completed */
+bool sample(struct demostats_t* stats)
+{
+        uint32_t seq;
+
+        // nothing published yet, no update since the last sample or update in progress
+        seq = __atomic_load_n(&stats->waithdr->seq, __ATOMIC_ACQUIRE);
+        if ((seq == stats->seq) || (stats->waithdr->stamp == 0) || (seq & 1))
+                return false;
+        // setpoints and actual positions of the same cycle, otherwise the following errors are off by one cycle
+        if (mk_snap_read(&stats->snapset,&stats->snap,MK_SNAP_TRIES) == -1)
+                return false;
+        if (NULL != stats->mainout)
+                mk_mainoutput_towire(&stats->wire_mainout,&stats->snap.mainout);
+        if (NULL != stats->addout)
+                mk_additionaloutput_towire(&stats->wire_addout,&stats->snap.addout);
+        if (NULL != stats->mainin)
+                mk_maininput_towire(&stats->wire_mainin,&stats->snap.mainin);
+        stats->seq = seq;
+        stats->samples++;
+        if (!mk_stats_add(&stats->agg,stats->snap.cycle,
+                        stats->mainout ? &stats->wire_mainout : NULL,
+                        stats->addout ? &stats->wire_addout : NULL,
+                        stats->mainin ? &stats->wire_mainin : NULL))
+                return false;
+        mk_stats_result(&stats->agg,&stats->result);
+        mk_stats_write(stats->stats,&stats->result,stats->snap.cycle,stats->snap.stamp);
+        mk_shm_notify(&stats->stats->hdr);
+        stats->published++;
+        return true;
+}
+
+/* Prints the published statistics until terminated */
+int printStats(struct demostats_t* stats)
+{
+        struct mk_stats result;
+        uint64_t cycle;
+        uint64_t stamp;
+        uint32_t seq;
+        char at[64];
+
+        stats->stats = mk_stats_attach(&stats->shm_stats,stats->inst,stats->shmflags);
+        if (NULL == stats->stats)
+                return -1;
+        if (stats->period == 0)
+                stats->period = 1000000;
+        while(run) {
+                mk_shm_wait(&stats->stats->hdr,stats->seq,stats->period);
+                seq = __atomic_load_n(&stats->stats->hdr.seq, __ATOMIC_ACQUIRE);
+                if ((seq == stats->seq) || (stats->stats->hdr.stamp == 0) || (seq & 1))
+                        continue;
+                if (mk_shm_check(&stats->shm_stats) != 0)
+                        break;
+                seq = mk_stats_read(stats->stats,&result,&cycle,&stamp);
+                if ((seq & 1) || (result.channels != MK_STATS_CHANCNT))
+                        continue;
+                stats->seq = seq;
+                snprintf(at,sizeof(at),"cycle %llu",(unsigned long long) cycle);
+                mk_stats_fprint(stdout,&result,at);
+                fflush(stdout);
+        }
+        mk_shm_detach(&stats->shm_stats);
+        return 0;
+}
+
+int main(int argc, char* argv[])
+{
+        struct demostats_t* stats;
+        struct timespec next;
+        uint32_t waitseq;
+        uint64_t rounds = 0;
+
+        // the aggregator holds the buckets of all channels, too large for the stack
+        stats = calloc(1,sizeof(*stats));
+        if (NULL == stats) {
+                perror("Allocation of the aggregator failed");
+                exit(1);
+        }
+        stats->shmflags = MK_SHM_POPULATE;
+        stats->window = 1000;
+        stats->inst = mk_shm_instance();
+
+        evalCLI(argc,argv,stats);
+
+        //register signal handlers
+        signal(SIGTERM, sigfunc);
+        signal(SIGINT, sigfunc);
+
+        if (stats->flagprint) {
+                if (printStats(stats) == -1)
+                        exit(1);
+                free(stats);
+                return 0;
+        }
+
+        // open and setup shm mapping
+        if (stats->flagmainout)
+                stats->mainout = (struct mk_mainoutput_shm *) mk_shm_attach_inst(&stats->shm_mainout,MK_SHM_MAINOUT,stats->inst,stats->shmflags);
+        if (stats->flagaddout)
+                stats->addout = (struct mk_additionaloutput_shm *) mk_shm_attach_inst(&stats->shm_addout,MK_SHM_ADDOUT,stats->inst,stats->shmflags);
+        if (stats->flagmainin)
+                stats->mainin = (struct mk_maininput_shm *) mk_shm_attach_inst(&stats->shm_mainin,MK_SHM_MAININ,stats->inst,stats->shmflags);
+        mk_snap_init(&stats->snapset);
+        mk_snap_add(&stats->snapset,MK_SHM_MAINOUT,stats->mainout);
+        mk_snap_add(&stats->snapset,MK_SHM_ADDOUT,stats->addout);
+        mk_snap_add(&stats->snapset,MK_SHM_MAININ,stats->mainin);
+        // wake up on the shared memory published last, the others of the cycle are published then
+        if (stats->snapset.segments == 0)
+                exit(1);
+        stats->waithdr = stats->snapset.hdr[mk_shm_lastseg(stats->snapset.segments)];
+        stats->stats = mk_stats_attach(&stats->shm_stats,stats->inst,stats->shmflags | MK_SHM_WRITER | MK_SHM_NOTIFY);
+        if (NULL == stats->stats)
+                exit(1);
+
+        if (stats->period == 0)
+                stats->period = stats->waithdr->period ? stats->waithdr->period : DEMOSTATS_PERIOD;
+        mk_stats_init(&stats->agg,stats->window);
+        // one publication per completed bucket
+        mk_shm_setperiod(&stats->stats->hdr,stats->period * stats->agg.bucketlen);
+        printf("Publishing statistics of %u cycles every %u cycles to %s\n",
+                stats->agg.bucketlen * MK_STATS_BUCKETS,stats->agg.bucketlen,stats->shm_stats.name);
+        fflush(stdout);
+
+        // mainloop
+        clock_gettime(CLOCK_MONOTONIC,&next);
+        while(run) {
+                sample(stats);
+                rounds++;
+
+                if (stats->flagwait) {
+                        // before the first update of the writer wait for any change of seq
+                        waitseq = stats->seq;
+                        if (stats->waithdr->stamp == 0)
+                                waitseq = __atomic_load_n(&stats->waithdr->seq, __ATOMIC_ACQUIRE);
+                        mk_shm_wait(stats->waithdr,waitseq,stats->period);
+                } else {
+                        next.tv_nsec += (long) stats->period * 1000;
+                        while (next.tv_nsec >= 1000000000L) {
+                                next.tv_nsec -= 1000000000L;
+                                next.tv_sec++;
+                        }
+                        clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&next,NULL);
+                }
+        }
+
+        // cleanup
+        printf("%llu rounds, %llu samples, %llu statistics published\n",
+                (unsigned long long) rounds,(unsigned long long) stats->samples,(unsigned long long) stats->published);
+        printf("%llu samples of different cycles, %llu pairs of different writers skewed, %llu reads repeated\n",
+                (unsigned long long) stats->snapset.incoherent,(unsigned long long) stats->snapset.skewed,(unsigned long long) stats->snapset.retries);
+        mk_shm_detach(&stats->shm_stats);
+        if (NULL != stats->mainout)
+                mk_shm_detach(&stats->shm_mainout);
+        if (NULL != stats->addout)
+                mk_shm_detach(&stats->shm_addout);
+        if (NULL != stats->mainin)
+                mk_shm_detach(&stats->shm_mainin);
+        free(stats);
+
+        return 0;
+}
@@ -0,0 +1,600 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* SHM-Stress and soak test of the shared memories with fault injection
+ *
+ * Starts a writer process publishing all three shared memories at the given
+ * period and a number of reader processes taking cycle-coherent snapshots
+ * (lib/mk_shmsnap.h) after every update. The writer fills every shared
+ * memory with a byte pattern of the cycle, so a reader detects every torn
+ * read. Optionally faults are injected in turn:
+ * - k: the writer is killed with SIGKILL during an update of MK_MAININ, and
+ *      a new writer takes over the shared memories and finishes the update
+ * - s: a reader is stopped with SIGSTOP for the stall time
+ * - r: the writer terminates and removes the shared memories, the readers
+ *      attach them again and create them before the new writer starts
+ * At the end the throughput, the torn reads, the snapshots of different
+ * cycles, the reads stuck in the update of a killed writer and recovered
+ * after the takeover, the missed cycles and the latency from the update to
+ * the end of the snapshot of every reader are printed. The shared memories of instance
+ * 99 are used by default, so running demo applications are not disturbed.
+ *
+ * Usage:
+ * -r [value]   Specifies the number of reader processes. Default 4
+ * -d [value]   Specifies the duration of the test in seconds. Default 10
+ * -f [faults]  Injects the faults, any of k, s and r. Default none
+ * -F [value]   Specifies the time between two faults in milliseconds. Default 1000
+ * -S [value]   Specifies the stall time of a reader in milliseconds. Default 100
+ * -I [value]   Specifies the instance of the interface. Default 99
+ * -t [value]   Specifies the period of the writer in milliseconds. Default 1 millisecond
+ * -u [value]   Specifies the period of the writer in microseconds
+ * -m           Locks the shared memories into RAM
+ * -H           Uses shared memories backed by hugepages (hugetlbfs)
+ * -h           Prints this help message and exits
+ *
+ */
+
+#include "../mk_shminterface.h"
+#include "../lib/mk_shmlib.h"
+#include "../lib/mk_shmhist.h"
+#include "../lib/mk_shmsnap.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define STRESS_MAXREADERS 64
+#define STRESS_INST 99
+
+// faults which can be injected
+enum stress_fault {
+        STRESS_KILL = 0,        // SIGKILL of the writer
+        STRESS_STALL,           // SIGSTOP of a reader
+        STRESS_RESTART,         // writer removes the shared memories, readers create them again
+        STRESS_FAULTCNT
+};
+
+static const char faultnames[STRESS_FAULTCNT] = { 'k', 's', 'r' };
+
+// results of a reader process
+struct stress_reader {
+        uint64_t samples;
+        uint64_t torn;          // snapshots not matching the pattern of their cycle
+        uint64_t incoherent;    // snapshots of different cycles
+        uint64_t stuck;         // snapshots refused because a writer did not finish an update
+        uint64_t recovered;     // snapshots succeeding again after stuck ones
+        uint64_t missed;        // cycles of the writer not sampled
+        uint64_t reattaches;
+        struct mk_hist latency; // from the timestamp of the update to the end of the snapshot in ns
+};
+
+// state shared between the processes of the test, anonymous shared memory
+struct stress_shared {
+        uint32_t stop;
+        uint64_t cycle;         // next cycle of the writer, a new writer continues with it
+        uint64_t overruns;      // deadlines missed by the writers
+        uint64_t writers;       // writers started
+        uint32_t park;          // the writer stops in the next update of MK_MAININ until it is killed
+        uint32_t parked;        // set by the writer once it stopped in the update
+        struct stress_reader reader[STRESS_MAXREADERS];
+};
+
+struct demostress_t {
+        struct stress_shared* shared;
+        pid_t writer;
+        pid_t readers[STRESS_MAXREADERS];
+        int nreaders;
+        uint32_t duration;
+        uint32_t faults;        // bit (1 << enum stress_fault) set if injected
+        uint32_t faultint;
+        uint32_t stall;
+        uint32_t period;
+        uint32_t inst;
+        int shmflags;
+};
+
+// shared memories of a writer or reader process
+struct stress_segs {
+        struct mk_shm shm[MK_SHM_SEGCNT];
+        void* addr[MK_SHM_SEGCNT];
+};
+
+uint8_t run = 1;
+
+/* signal handler */
+void sigfunc(int sig)
+{
+        switch(sig)
+        {
+        case SIGINT:
+                if(run)
+                        run = 0;
+                else
+                        exit(0);
+                break;
+        case SIGTERM:
+                run = 0;
+                break;
+        }
+}
+
+/* Print usage message */
+static void usage(char *appname)
+{
+        fprintf(stderr,
+                "\n"
+                "Usage: %s [options]\n"
+                " -r [value]    Specifies the number of reader processes. Default 4\n"
+                " -d [value]    Specifies the duration of the test in seconds. Default 10\n"
+                " -f [faults]   Injects the faults, any of k (kill writer), s (stall reader) and r (restart writer). Default none\n"
+                " -F [value]    Specifies the time between two faults in milliseconds. Default 1000\n"
+                " -S [value]    Specifies the stall time of a reader in milliseconds. Default 100\n"
+                " -I [value]    Specifies the instance of the interface. Default %d\n"
+                " -t [value]    Specifies the period of the writer in milliseconds. Default 1 millisecond\n"
+                " -u [value]    Specifies the period of the writer in microseconds\n"
+                " -m            Locks the shared memories into RAM\n"
+                " -H            Uses shared memories backed by hugepages (hugetlbfs)\n"
+                " -h            Prints this help message and exits\n"
+                "\n",
+                appname,STRESS_INST);
+}
+
+/* Evaluate CLI-parameters */
+void evalCLI(int argc, char* argv[0],struct demostress_t * stress)
+{
+        int c;
+        int i;
+        char* appname = strrchr(argv[0], '/');
+        appname = appname ? 1 + appname : argv[0];
+        while (EOF != (c = getopt(argc,argv,"hmHr:d:f:F:S:I:t:u:"))) {
+                switch(c) {
+                case 'r':
+                        (*stress).nreaders = atoi(optarg);
+                        break;
+                case 'd':
+                        (*stress).duration = atoi(optarg);
+                        break;
+                case 'f':
+                        for (; *optarg; optarg++) {
+                                for (i = 0; i < STRESS_FAULTCNT; i++) {
+                                        if (*optarg == faultnames[i])
+                                                (*stress).faults |= 1U << i;
+                                }
+                        }
+                        break;
+                case 'F':
+                        (*stress).faultint = atoi(optarg);
+                        break;
+                case 'S':
+                        (*stress).stall = atoi(optarg);
+                        break;
+                case 'I':
+                        (*stress).inst = atoi(optarg);
+                        break;
+                case 't':
+                        (*stress).period = atoi(optarg)*1000;
+                        break;
+                case 'u':
+                        (*stress).period = atoi(optarg);
+                        break;
+                case 'm':
+                        (*stress).shmflags |= MK_SHM_MLOCK;
+                        break;
+                case 'H':
+                        (*stress).shmflags |= MK_SHM_HUGEPAGE;
+                        break;
+                case 'h':
+                default:
+                        usage(appname);
+                        exit(0);
+                        break;
+                }
+        }
+        if (((*stress).nreaders < 1) || ((*stress).nreaders > STRESS_MAXREADERS)) {
+                printf("The number of readers needs to be between 1 and %d\n",STRESS_MAXREADERS);
+                exit(0);
+        }
+        if (((*stress).period == 0) || ((*stress).faultint == 0)) {
+                printf("Period and time between faults need to be greater than 0\n");
+                exit(0);
+        }
+}
+
+/* Sleeps for the given number of milliseconds */
+static void sleepMs(uint32_t ms)
+{
+        struct timespec ts;
+        ts.tv_sec = ms / 1000;
+        ts.tv_nsec = (ms % 1000) * 1000000L;
+        while ((nanosleep(&ts,&ts) == -1) && (errno == EINTR) && run);
+}
+
+/* Returns the pattern a shared memory is filled with in a cycle */
+static inline uint8_t pattern(uint64_t cycle, int seg)
+{
+        return (uint8_t) (cycle * MK_SHM_SEGCNT + seg + 1);
+}
+
+/* Returns the address and size of the variables of a shared memory */
+static void* segdata(void* addr, int seg, size_t* len)
+{
+        switch (seg) {
+        case MK_SHM_MAINOUT:
+                *len = sizeof(mk_mainoutput_t);
+                return &((struct mk_mainoutput_shm*) addr)->data;
+        case MK_SHM_MAININ:
+                *len = sizeof(mk_maininput_t);
+                return &((struct mk_maininput_shm*) addr)->data;
+        default:
+                *len = sizeof(mk_additionaloutput_t);
+                return &((struct mk_additionaloutput_shm*) addr)->data;
+        }
+}
+
+/* Attaches all shared memories, returns 0 or -1 on error */
+static int attachSegs(struct stress_segs* segs, uint32_t inst, int flags)
+{
+        int seg;
+        for (seg = 0; seg < MK_SHM_SEGCNT; seg++) {
+                segs->addr[seg] = mk_shm_attach_inst(&segs->shm[seg],seg,inst,flags);
+                if (NULL == segs->addr[seg]) {
+                        while (--seg >= 0)
+                                mk_shm_detach(&segs->shm[seg]);
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+/* Detaches all shared memories */
+static void detachSegs(struct stress_segs* segs)
+{
+        int seg;
+        for (seg = 0; seg < MK_SHM_SEGCNT; seg++)
+                mk_shm_detach(&segs->shm[seg]);
+}
+
+/* Writer process, publishes the pattern of every cycle until terminated */
+static void writerProcess(struct demostress_t* stress)
+{
+        struct stress_shared* shared = stress->shared;
+        struct stress_segs segs;
+        struct timespec next;
+        struct timespec now;
+        union {
+                mk_mainoutput_t mainout;
+                mk_maininput_t mainin;
+                mk_additionaloutput_t addout;
+        } buf;
+        // same order of the updates as demowriter
+        const int order[MK_SHM_SEGCNT] = { MK_SHM_MAINOUT, MK_SHM_ADDOUT, MK_SHM_MAININ };
+        uint64_t cycle = __atomic_load_n(&shared->cycle, __ATOMIC_ACQUIRE);
+        uint64_t stamp;
+        struct mk_shmhdr* hdr;
+        void* data;
+        size_t len;
+        int i;
+
+        if (attachSegs(&segs,stress->inst,stress->shmflags | MK_SHM_WRITER | MK_SHM_NOTIFY) == -1)
+                _exit(1);
+        for (i = 0; i < MK_SHM_SEGCNT; i++)
+                mk_shm_setperiod((struct mk_shmhdr*) segs.addr[i],stress->period);
+        // terminated with SIGTERM after the readers stopped
+        clock_gettime(CLOCK_MONOTONIC,&next);
+        while (run) {
+                stamp = mk_shm_taitime();
+                for (i = 0; i < MK_SHM_SEGCNT; i++) {
+                        hdr = (struct mk_shmhdr*) segs.addr[order[i]];
+                        data = segdata(segs.addr[order[i]],order[i],&len);
+                        memset(&buf,pattern(cycle,order[i]),len);
+                        if ((i == MK_SHM_SEGCNT - 1) && __atomic_load_n(&shared->park, __ATOMIC_ACQUIRE)) {
+                                // leave the last update of the cycle half done, seq stays odd until a new writer takes over
+                                mk_shm_writebegin(hdr);
+                                memcpy(data,&buf,len / 2);
+                                __atomic_store_n(&shared->parked, 1, __ATOMIC_RELEASE);
+                                for (;;)
+                                        pause();
+                        }
+                        mk_shm_write(hdr,data,&buf,len,cycle,stamp);
+                        mk_shm_notify(hdr);
+                }
+                cycle++;
+                __atomic_store_n(&shared->cycle, cycle, __ATOMIC_RELEASE);
+
+                next.tv_nsec += (long) stress->period * 1000;
+                while (next.tv_nsec >= 1000000000L) {
+                        next.tv_nsec -= 1000000000L;
+                        next.tv_sec++;
+                }
+                clock_gettime(CLOCK_MONOTONIC,&now);
+                if ((now.tv_sec > next.tv_sec) || ((now.tv_sec == next.tv_sec) && (now.tv_nsec > next.tv_nsec))) {
+                        // deadline already missed, restart the cycle timing from now
+                        __atomic_fetch_add(&shared->overruns, 1, __ATOMIC_RELAXED);
+                        next = now;
+                        continue;
+                }
+                while (run && (clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&next,NULL) == EINTR));
+        }
+        // a terminated writer removes the shared memories
+        detachSegs(&segs);
+        _exit(0);
+}
+
+/* Reader process, takes a snapshot after every update until the test stops */
+static void readerProcess(struct demostress_t* stress, int id)
+{
+        struct stress_shared* shared = stress->shared;
+        struct stress_reader* res = &shared->reader[id];
+        struct stress_segs segs;
+        struct mk_snapset set;
+        struct mk_snapshot snap;
+        const struct mk_shmhdr* hdr;
+        const uint8_t* data[MK_SHM_SEGCNT] = { (uint8_t*) &snap.mainout, (uint8_t*) &snap.mainin, (uint8_t*) &snap.addout };
+        const size_t len[MK_SHM_SEGCNT] = { sizeof(snap.mainout), sizeof(snap.mainin), sizeof(snap.addout) };
+        uint64_t lastcycle = 0;
+        uint32_t lastseq = 0;
+        uint32_t seq;
+        bool owned = false;
+        bool stuck = false;
+        bool torn;
+        size_t j;
+        int seg;
+        int ok;
+
+        mk_hist_init(&res->latency);
+        if (attachSegs(&segs,stress->inst,stress->shmflags) == -1)
+                _exit(1);
+        mk_snap_init(&set);
+        for (seg = 0; seg < MK_SHM_SEGCNT; seg++)
+                mk_snap_add(&set,seg,segs.addr[seg]);
+        hdr = (const struct mk_shmhdr*) segs.addr[MK_SHM_MAINOUT];
+        while (run && !__atomic_load_n(&shared->stop, __ATOMIC_RELAXED)) {
+                mk_shm_wait(hdr,lastseq,2 * stress->period);
+                seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+                if ((seq == lastseq) || (seq & 1) || (hdr->stamp == 0)) {
+                        // the writer terminated and removed the shared memories, attach the ones of the next writer
+                        if (__atomic_load_n(&hdr->pid, __ATOMIC_RELAXED) != 0) {
+                                owned = true;
+                        } else if (owned) {
+                                detachSegs(&segs);
+                                if (attachSegs(&segs,stress->inst,stress->shmflags) == -1)
+                                        _exit(1);
+                                for (seg = 0; seg < MK_SHM_SEGCNT; seg++)
+                                        mk_snap_add(&set,seg,segs.addr[seg]);
+                                hdr = (const struct mk_shmhdr*) segs.addr[MK_SHM_MAINOUT];
+                                lastseq = 0;
+                                owned = false;
+                                res->reattaches++;
+                        }
+                        continue;
+                }
+                owned = true;
+                lastseq = seq;
+                ok = mk_snap_read(&set,&snap,MK_SNAP_TRIES);
+                if (ok == -1) {
+                        res->stuck++;
+                        stuck = true;
+                        continue;
+                }
+                // the new writer finished the update of the killed one
+                if (stuck)
+                        res->recovered++;
+                stuck = false;
+                mk_hist_record(&res->latency,mk_shm_taitime() - snap.stamp);
+                res->samples++;
+                if (ok == 1)
+                        res->incoherent++;
+                torn = false;
+                for (seg = 0; seg < MK_SHM_SEGCNT; seg++) {
+                        // not written since the shared memory was created
+                        if (snap.stamps[seg] == 0)
+                                continue;
+                        for (j = 0; j < len[seg]; j++) {
+                                if (data[seg][j] != pattern(snap.cycles[seg],seg))
+                                        torn = true;
+                        }
+                }
+                if (torn)
+                        res->torn++;
+                if ((lastcycle != 0) && (snap.cycle > lastcycle + 1))
+                        res->missed += snap.cycle - lastcycle - 1;
+                lastcycle = snap.cycle;
+        }
+        detachSegs(&segs);
+        _exit(0);
+}
+
+/* Starts a new writer, returns 0 or -1 on error */
+static int startWriter(struct demostress_t* stress)
+{
+        fflush(stdout);
+        stress->writer = fork();
+        if (stress->writer == -1) {
+                perror("Starting writer failed");
+                return -1;
+        }
+        if (stress->writer == 0)
+                writerProcess(stress);
+        stress->shared->writers++;
+        return 0;
+}
+
+/* Injects a fault */
+static void injectFault(struct demostress_t* stress, enum stress_fault fault, int* nextreader)
+{
+        pid_t reader;
+        int i;
+
+        switch (fault) {
+        case STRESS_KILL:
+                // kill the writer in the middle of an update, a random SIGKILL almost never hits one
+                __atomic_store_n(&stress->shared->parked, 0, __ATOMIC_RELAXED);
+                __atomic_store_n(&stress->shared->park, 1, __ATOMIC_RELEASE);
+                for (i = 0; (i < 1000) && !__atomic_load_n(&stress->shared->parked, __ATOMIC_ACQUIRE); i++)
+                        sleepMs(1);
+                // the readers run into the unfinished update meanwhile
+                sleepMs(4 * stress->period / 1000 + 10);
+                kill(stress->writer,SIGKILL);
+                waitpid(stress->writer,NULL,0);
+                __atomic_store_n(&stress->shared->park, 0, __ATOMIC_RELEASE);
+                startWriter(stress);
+                break;
+        case STRESS_STALL:
+                reader = stress->readers[*nextreader];
+                *nextreader = (*nextreader + 1) % stress->nreaders;
+                kill(reader,SIGSTOP);
+                sleepMs(stress->stall);
+                kill(reader,SIGCONT);
+                break;
+        case STRESS_RESTART:
+                kill(stress->writer,SIGTERM);
+                waitpid(stress->writer,NULL,0);
+                // the readers notice the removal within two periods and create the shared memories again
+                sleepMs(4 * stress->period / 1000 + 10);
+                startWriter(stress);
+                break;
+        default:
+                break;
+        }
+}
+
+int main(int argc, char* argv[])
+{
+        struct demostress_t stress;
+        struct stress_shared* shared;
+        struct stress_reader* res;
+        struct mk_hist* all;
+        uint64_t injected[STRESS_FAULTCNT] = { 0 };
+        uint64_t start;
+        uint64_t end;
+        uint64_t now;
+        uint64_t nextfault;
+        uint64_t samples = 0;
+        uint64_t torn = 0;
+        uint64_t incoherent = 0;
+        uint64_t missed = 0;
+        uint64_t stuck = 0;
+        uint64_t recovered = 0;
+        double secs;
+        char name[64];
+        int started;
+        int nextreader = 0;
+        int fault = 0;
+        int i;
+
+        memset(&stress,0,sizeof(stress));
+        stress.nreaders = 4;
+        stress.duration = 10;
+        stress.faultint = 1000;
+        stress.stall = 100;
+        stress.period = 1000;           // 1 millisecond
+        stress.inst = STRESS_INST;
+        stress.shmflags = MK_SHM_POPULATE;
+
+        evalCLI(argc,argv,&stress);
+
+        //register signal handlers
+        signal(SIGTERM, sigfunc);
+        signal(SIGINT, sigfunc);
+
+        shared = mmap(NULL,sizeof(*shared),PROT_READ | PROT_WRITE,MAP_SHARED | MAP_ANONYMOUS,-1,0);
+        if (MAP_FAILED == shared) {
+                perror("Mapping shared state failed");
+                exit(1);
+        }
+        memset(shared,0,sizeof(*shared));
+        shared->cycle = 1;
+        stress.shared = shared;
+        all = malloc(sizeof(*all));
+        if (NULL == all) {
+                perror("Allocating histogram failed");
+                exit(1);
+        }
+
+        if (startWriter(&stress) == -1)
+                exit(1);
+        for (started = 0; started < stress.nreaders; started++) {
+                fflush(stdout);
+                stress.readers[started] = fork();
+                if (stress.readers[started] == -1) {
+                        perror("Starting reader failed");
+                        break;
+                }
+                if (stress.readers[started] == 0)
+                        readerProcess(&stress,started);
+        }
+        stress.nreaders = started;
+        printf("Writer with a period of %u us and %d readers on instance %u for %u s\n",
+                stress.period,stress.nreaders,stress.inst,stress.duration);
+        fflush(stdout);
+
+        // mainloop, injects the selected faults in turn
+        start = mk_shm_taitime();
+        end = start + (uint64_t) stress.duration * 1000000000ULL;
+        nextfault = start + (uint64_t) stress.faultint * 1000000ULL;
+        while (run && ((now = mk_shm_taitime()) < end)) {
+                if ((stress.faults != 0) && (stress.nreaders > 0) && (now >= nextfault)) {
+                        while (!(stress.faults & (1U << fault)))
+                                fault = (fault + 1) % STRESS_FAULTCNT;
+                        injectFault(&stress,fault,&nextreader);
+                        injected[fault]++;
+                        fault = (fault + 1) % STRESS_FAULTCNT;
+                        nextfault += (uint64_t) stress.faultint * 1000000ULL;
+                }
+                sleepMs(10);
+        }
+        end = mk_shm_taitime();
+
+        // cleanup, the readers stop before the writer removes the shared memories
+        __atomic_store_n(&shared->stop, 1, __ATOMIC_RELEASE);
+        for (i = 0; i < stress.nreaders; i++) {
+                kill(stress.readers[i],SIGCONT);
+                waitpid(stress.readers[i],NULL,0);
+        }
+        kill(stress.writer,SIGTERM);
+        waitpid(stress.writer,NULL,0);
+
+        secs = (end - start) / 1e9;
+        printf("Writer: %llu cycles in %.1f s (%.1f cycles/s), %llu deadlines missed, %llu writers started\n",
+                (unsigned long long) (shared->cycle - 1),secs,(shared->cycle - 1) / secs,
+                (unsigned long long) shared->overruns,(unsigned long long) shared->writers);
+        printf("Faults: %llu writers killed, %llu readers stalled, %llu writers restarted\n",
+                (unsigned long long) injected[STRESS_KILL],(unsigned long long) injected[STRESS_STALL],
+                (unsigned long long) injected[STRESS_RESTART]);
+        mk_hist_init(all);
+        for (i = 0; i < stress.nreaders; i++) {
+                res = &shared->reader[i];
+                printf("Reader %d: %llu samples (%.1f samples/s), %llu cycles missed, %llu torn, %llu of different cycles, %llu stuck, %llu recovered, %llu reattaches\n",
+                        i,(unsigned long long) res->samples,res->samples / secs,(unsigned long long) res->missed,
+                        (unsigned long long) res->torn,(unsigned long long) res->incoherent,
+                        (unsigned long long) res->stuck,(unsigned long long) res->recovered,(unsigned long long) res->reattaches);
+                snprintf(name,sizeof(name),"Reader %d latency [ns]",i);
+                mk_hist_print(&res->latency,stdout,name);
+                mk_hist_merge(all,&res->latency);
+                samples += res->samples;
+                torn += res->torn;
+                incoherent += res->incoherent;
+                missed += res->missed;
+                stuck += res->stuck;
+                recovered += res->recovered;
+        }
+        printf("All readers: %llu samples (%.1f samples/s), %llu cycles missed, %llu torn, %llu of different cycles, %llu stuck, %llu recovered after the takeover\n",
+                (unsigned long long) samples,samples / secs,(unsigned long long) missed,
+                (unsigned long long) torn,(unsigned long long) incoherent,(unsigned long long) stuck,(unsigned long long) recovered);
+        mk_hist_print(all,stdout,"All readers latency [ns]");
+
+        free(all);
+        munmap(shared,sizeof(*shared));
+
+        return (torn == 0) ? 0 : 1;
+}
@@ -11,87 +11,87 @@
  * -i           Create main input variables to control
  * -a           Create additional output variables from control
  * -t [value]   Specifies update-period in milliseconds. Default 10 seconds
+ * -m           Locks the shared memories into RAM
+ * -H           Uses shared memories backed by hugepages (hugetlbfs)
+ * -b [depth]   Additionally appends every sample to ring buffers with depth slots
+ * -u [value]   Specifies update-period in microseconds
+ * -r [prio]    Runs as realtime process with SCHED_FIFO priority prio and locked memory
+ * -c [cpu]     Pins the process to the cpu
+ * -T           Uses CLOCK_TAI instead of CLOCK_MONOTONIC for the cycle timing
+ * -q           Quiet, does not output the values
+ * -n           Notifies waiting readers after every update
+ * -d           Publishes only changed variables and marks them in the dirty bitmaps
+ * -g           Generates plausible trajectories instead of random values
+ * -L [value]   Generator: time constant of the actual positions in microseconds. Default 2000
+ * -N [value]   Generator: noise of the actual positions in mm. Default 0.001
+ * -x           Additionally publishes the axes shared memory in struct-of-arrays layout
+ * -I [value]   Instance of the first written interface. Default MK_SHM_INSTANCE or 0
+ * -M [value]   Writes this many instances of the interface in one loop, starting at -I. Default 1
  * -h           Prints this help message and exits
  * 
  */
 
+#define _GNU_SOURCE
 #include "../mk_shminterface.h"
+#include "../lib/mk_shmlib.h"
+#include "../lib/mk_shmring.h"
+#include "../lib/mk_shmfields.h"
+#include "../lib/mk_shmaxes.h"
+#include "demogen.h"
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <semaphore.h>
-#include <fcntl.h>
 #include <signal.h>
 #include <time.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/mman.h>
 
 uint8_t run = 1;
+
+// shared memories, ring buffers and generator of one instance of the interface
+struct instance_t {
+        uint32_t inst;
+        struct mk_mainoutput_shm * mainout;
+        struct mk_maininput_shm * mainin;
+        struct mk_additionaloutput_shm * addout;
+        struct mk_shm * shm;	//handles of the shared memories by enum mk_shmseg, in demowriter_t.shms
+        struct mk_shmring * mainoutring;
+        struct mk_shmring * maininring;
+        struct mk_shmring * addoutring;
+        struct mk_shm shm_mainoutring;
+        struct mk_shm shm_maininring;
+        struct mk_shm shm_addoutring;
+        struct mk_axes_shm * axes;
+        struct mk_shm shm_axes;
+        struct demogen_t gen;
+};
+
 struct demowriter_t {
-        struct mk_mainoutput * mainout;
-        struct mk_maininput * mainin;
-        struct mk_additionaloutput * addout;
-        sem_t* sem_mainout;
-        sem_t* sem_mainin;
-        sem_t* sem_addout;
+        struct instance_t * insts;
+        struct mk_shminst * shms;	//shared memories of all instances, attached together
+        uint32_t firstinst;	//instance of the first written interface
+        uint32_t instances;	//number of written instances
+        uint32_t ringdepth;
+        int shmflags;
         uint32_t period;
+        clockid_t clock;
+        int rtprio;
+        int cpu;
+        uint64_t overruns;
+        uint32_t genlag;
+        double gennoise;
+        bool generate;
+        bool quiet;
         bool flagmainout;
         bool flagmainin;
         bool flagaddout;
+        bool flagaxes;
 };
 
-/* Opens a shared memory (write) and created it if necessary */
-void* openShM(const char* name, uint32_t size, sem_t** sem)
-{
-        int fd;
-        void* shm;
-        fd = shm_open(name, O_RDWR | O_CREAT, 0666);
-        if (fd == -1) {
-                perror("SHM Open failed");
-                return(NULL);
-        }
-        ftruncate(fd,size);
-        shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-        if (MAP_FAILED == shm) {
-                perror("SHM Map failed");
-                shm = NULL;
-                shm_unlink(name);
-        }
-        *sem = sem_open(name,O_CREAT,0666,0);
-        if (*sem == SEM_FAILED) {
-                perror("Semaphore open failed");
-                munmap(shm, size);
-                shm_unlink(name);
-                return(NULL);
-        }
-        //initialize shared memory
-        memset(shm,0,size);
-        sem_post(*sem);
-        
-        return shm;
-}
-
-/* Closes a shared memroy */
-int closeShM(const char* name,void** shm, int len,sem_t** sem)
-{
-        int ok;
-        ok = munmap(*shm,len);
-        if (ok < 0) {
-              return ok;  
-        }
-        *shm = NULL;
-        shm_unlink(name);
-        ok = sem_close(*sem);
-        if (ok < 0)
-                return ok;
-        *sem = NULL;
-        ok =+ sem_unlink(name);
-        return ok;
-}
-
 /* signal handler */
 void sigfunc(int sig)
 {
@@ -119,6 +119,22 @@ static void usage(char *appname)
                 " -i            Create main input variables to control\n"
                 " -a            Create additional output variables from control\n"
                 " -t [value]    Specifies update-period in milliseconds. Default 10 seconds.\n"
+                " -m            Locks the shared memories into RAM\n"
+                " -H            Uses shared memories backed by hugepages (hugetlbfs)\n"
+                " -b [depth]    Additionally appends every sample to ring buffers with depth slots (power of two)\n"
+                " -u [value]    Specifies update-period in microseconds\n"
+                " -r [prio]     Runs as realtime process with SCHED_FIFO priority prio and locked memory\n"
+                " -c [cpu]      Pins the process to the cpu\n"
+                " -T            Uses CLOCK_TAI instead of CLOCK_MONOTONIC for the cycle timing\n"
+                " -q            Quiet, does not output the values\n"
+                " -n            Notifies waiting readers after every update\n"
+                " -d            Publishes only changed variables and marks them in the dirty bitmaps\n"
+                " -g            Generates plausible trajectories instead of random values\n"
+                " -L [value]    Generator: time constant of the actual positions in microseconds. Default 2000\n"
+                " -N [value]    Generator: noise of the actual positions in mm. Default 0.001\n"
+                " -x            Additionally publishes the axes shared memory in struct-of-arrays layout\n"
+                " -I [value]    Instance of the first written interface. Default MK_SHM_INSTANCE or 0\n"
+                " -M [value]    Writes this many instances of the interface in one loop, starting at -I. Default 1\n"
                 " -h            Prints this help message and exits\n"
                 "\n",
                 appname);
@@ -130,7 +146,7 @@ void evalCLI(int argc, char* argv[0],struct demowriter_t * writer)
         int c;
         char* appname = strrchr(argv[0], '/');
         appname = appname ? 1 + appname : argv[0];
-        while (EOF != (c = getopt(argc,argv,"oiaht:"))) {
+        while (EOF != (c = getopt(argc,argv,"oiahmHTqndgxb:t:u:r:c:L:N:I:M:"))) {
                 switch(c) {
                 case 'o':
                         (*writer).flagmainout = true;
@@ -141,9 +157,57 @@ void evalCLI(int argc, char* argv[0],struct demowriter_t * writer)
                 case 'a':
                         (*writer).flagaddout = true;
                         break;
+                case 'm':
+                        (*writer).shmflags |= MK_SHM_MLOCK;
+                        break;
+                case 'H':
+                        (*writer).shmflags |= MK_SHM_HUGEPAGE;
+                        break;
+                case 'b':
+                        (*writer).ringdepth = atoi(optarg);
+                        break;
                 case 't':
                         (*writer).period = atoi(optarg)*1000;
                         break;
+                case 'u':
+                        (*writer).period = atoi(optarg);
+                        break;
+                case 'r':
+                        (*writer).rtprio = atoi(optarg);
+                        break;
+                case 'c':
+                        (*writer).cpu = atoi(optarg);
+                        break;
+                case 'T':
+                        (*writer).clock = CLOCK_TAI;
+                        break;
+                case 'q':
+                        (*writer).quiet = true;
+                        break;
+                case 'n':
+                        (*writer).shmflags |= MK_SHM_NOTIFY;
+                        break;
+                case 'd':
+                        (*writer).shmflags |= MK_SHM_DELTA;
+                        break;
+                case 'g':
+                        (*writer).generate = true;
+                        break;
+                case 'L':
+                        (*writer).genlag = atoi(optarg);
+                        break;
+                case 'N':
+                        (*writer).gennoise = atof(optarg);
+                        break;
+                case 'x':
+                        (*writer).flagaxes = true;
+                        break;
+                case 'I':
+                        (*writer).firstinst = atoi(optarg);
+                        break;
+                case 'M':
+                        (*writer).instances = atoi(optarg);
+                        break;
                 case 'h':
                 default:
                         usage(appname);
@@ -151,11 +215,243 @@ void evalCLI(int argc, char* argv[0],struct demowriter_t * writer)
                         break;
                 }
         }
-        if (((*writer).flagmainout == false) && ((*writer).flagmainin == false) && ((*writer).flagaddout) == false) {
+        if (((*writer).flagmainout == false) && ((*writer).flagmainin == false) && ((*writer).flagaddout == false) && ((*writer).flagaxes == false)) {
                 printf("At minium, one block of variables needs to be selected\n");
                 exit(0);
         };
+        if ((*writer).period == 0) {
+                printf("The update-period needs to be at least one microsecond\n");
+                exit(0);
+        }
+        if ((*writer).instances == 0) {
+                printf("At minimum, one instance needs to be written\n");
+                exit(0);
+        }
+
+}
+
+/* Fills a struct in wire format with random values */
+void randomFill(enum mk_shmseg seg, void* wire)
+{
+        const struct mk_fieldset* set = mk_shm_fields(seg);
+        char* p;
+        double d;
+        int32_t i;
+        uint32_t f;
+        for (f = 0; f < set->count; f++) {
+                p = (char*) wire + set->fields[f].offset;
+                switch (set->fields[f].type) {
+                case MK_FIELD_DOUBLE:
+                        d = (double) (rand() * 0.000001);
+                        memcpy(p,&d,sizeof(d));
+                        break;
+                case MK_FIELD_BOOL:
+                        *(bool*) p = rand() > RAND_MAX/2;
+                        break;
+                case MK_FIELD_UINT8:
+                        // small enumerations like the mode
+                        *(uint8_t*) p = rand() %4 +1;
+                        break;
+                default:
+                        i = rand();
+                        memcpy(p,&i,sizeof(i));
+                        break;
+                }
+        }
+}
+
+/* Fills the axes with random values */
+void randomAxes(struct mk_axes* axes)
+{
+        int i;
+        for (i = 0; i < MK_NAXES; i++) {
+                axes->vel_set[i] = (double) (rand() * 0.000001);
+                axes->pos_set[i] = (double) (rand() * 0.000001);
+                axes->pos_cur[i] = (double) (rand() * 0.000001);
+        }
+        axes->enable = rand() & MK_AXESMASK;
+        axes->fault = rand() & MK_AXESMASK;
+        axes->home = rand() & MK_AXESMASK;
+        axes->hardneg = rand() & MK_AXESMASK;
+        axes->hardpos = rand() & MK_AXESMASK;
+}
+
+/* Configures cpu affinity, realtime scheduling and memory locking */
+int setupRT(struct demowriter_t* writer)
+{
+        struct sched_param param;
+        cpu_set_t cpus;
+        if (writer->cpu >= 0) {
+                CPU_ZERO(&cpus);
+                CPU_SET(writer->cpu,&cpus);
+                if (sched_setaffinity(0,sizeof(cpus),&cpus) == -1) {
+                        perror("Setting cpu affinity failed");
+                        return -1;
+                }
+        }
+        if (writer->rtprio > 0) {
+                // also locks the shared memories mapped later on
+                if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+                        perror("Locking memory failed");
+                        return -1;
+                }
+                param.sched_priority = writer->rtprio;
+                if (sched_setscheduler(0,SCHED_FIFO,&param) == -1) {
+                        perror("Setting realtime priority failed");
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+/* Sleeps until the absolute deadline of the next cycle */
+void waitNextCycle(struct demowriter_t* writer, struct timespec* next)
+{
+        struct timespec now;
+        next->tv_nsec += (long) writer->period * 1000;
+        while (next->tv_nsec >= 1000000000L) {
+                next->tv_nsec -= 1000000000L;
+                next->tv_sec++;
+        }
+        clock_gettime(writer->clock,&now);
+        if ((now.tv_sec > next->tv_sec) || ((now.tv_sec == next->tv_sec) && (now.tv_nsec > next->tv_nsec))) {
+                // deadline already missed, restart the cycle timing from now
+                writer->overruns++;
+                *next = now;
+                return;
+        }
+        while (run && (clock_nanosleep(writer->clock,TIMER_ABSTIME,next,NULL) == EINTR));
+}
 
+/* Sets up an instance whose shared memories are attached, attaches its axes and ring buffers, a failed one stays NULL */
+void attachInstance(struct demowriter_t* writer, struct instance_t* in)
+{
+        in->mainout = (struct mk_mainoutput_shm *) in->shm[MK_SHM_MAINOUT].addr;
+        in->mainin = (struct mk_maininput_shm *) in->shm[MK_SHM_MAININ].addr;
+        in->addout = (struct mk_additionaloutput_shm *) in->shm[MK_SHM_ADDOUT].addr;
+        // announce the update-period to the readers
+        if (NULL != in->mainout)
+                mk_shm_setperiod(&in->mainout->hdr,writer->period);
+        if (NULL != in->mainin)
+                mk_shm_setperiod(&in->mainin->hdr,writer->period);
+        if (NULL != in->addout)
+                mk_shm_setperiod(&in->addout->hdr,writer->period);
+        // the axes are always published as a whole
+        if (writer->flagaxes) {
+                in->axes = mk_axes_attach(&in->shm_axes,in->inst,writer->shmflags & ~MK_SHM_DELTA);
+                if (NULL != in->axes)
+                        mk_shm_setperiod(&in->axes->hdr,writer->period);
+        }
+
+        // open ring buffers, the slots always hold the whole struct
+        if (writer->ringdepth > 0) {
+                if (NULL != in->mainout)
+                        in->mainoutring = mk_ring_attach_inst(&in->shm_mainoutring,MK_SHM_MAINOUT,in->inst,writer->ringdepth,writer->shmflags & ~MK_SHM_DELTA);
+                if (NULL != in->mainin)
+                        in->maininring = mk_ring_attach_inst(&in->shm_maininring,MK_SHM_MAININ,in->inst,writer->ringdepth,writer->shmflags & ~MK_SHM_DELTA);
+                if (NULL != in->addout)
+                        in->addoutring = mk_ring_attach_inst(&in->shm_addoutring,MK_SHM_ADDOUT,in->inst,writer->ringdepth,writer->shmflags & ~MK_SHM_DELTA);
+        }
+        if (writer->generate)
+                demogen_init(&in->gen,writer->period,writer->genlag,writer->gennoise);
+}
+
+/* Publishes new values of all shared memories of an instance
+ *
+ * Each shared memory is stamped right before it is published, so the
+ * latency seen by readers does not include the generator and the output of
+ * the shared memories published before; readers match the shared memories
+ * of a cycle by cycle.
+ */
+void writeInstance(struct demowriter_t* writer, struct instance_t* in, uint64_t cycle, const char* at)
+{
+        mk_mainoutput_t mainout;
+        mk_maininput_t mainin;
+        mk_additionaloutput_t addout;
+        struct mk_mainoutput mainoutwire;
+        struct mk_maininput maininwire;
+        struct mk_additionaloutput addoutwire;
+        struct mk_axes axes;
+        uint64_t stamp;
+
+        if (writer->generate)
+                demogen_step(&in->gen,&mainout,&addout,&mainin);
+        if (NULL != in->mainout){
+                if (writer->generate) {
+                        mk_mainoutput_towire(&mainoutwire,&mainout);
+                } else {
+                        randomFill(MK_SHM_MAINOUT,&mainoutwire);
+                        mk_mainoutput_fromwire(&mainout,&mainoutwire);
+                }
+                stamp = mk_shm_taitime();
+                if (writer->shmflags & MK_SHM_DELTA)
+                        mk_mainoutput_writedelta(in->mainout,&mainout,cycle,stamp);
+                else
+                        mk_shm_write(&in->mainout->hdr,&in->mainout->data,&mainout,sizeof(mainout),cycle,stamp);
+                mk_shm_notify(&in->mainout->hdr);
+                if (NULL != in->mainoutring)
+                        mk_ring_append(in->mainoutring,cycle,stamp,&mainoutwire);
+                if (!writer->quiet)
+                        mk_shm_fprint(stdout,MK_SHM_MAINOUT,&mainoutwire,at);
+        }
+        if (NULL != in->addout){
+                if (writer->generate) {
+                        mk_additionaloutput_towire(&addoutwire,&addout);
+                } else {
+                        randomFill(MK_SHM_ADDOUT,&addoutwire);
+                        mk_additionaloutput_fromwire(&addout,&addoutwire);
+                }
+                stamp = mk_shm_taitime();
+                if (writer->shmflags & MK_SHM_DELTA)
+                        mk_additionaloutput_writedelta(in->addout,&addout,cycle,stamp);
+                else
+                        mk_shm_write(&in->addout->hdr,&in->addout->data,&addout,sizeof(addout),cycle,stamp);
+                mk_shm_notify(&in->addout->hdr);
+                if (NULL != in->addoutring)
+                        mk_ring_append(in->addoutring,cycle,stamp,&addoutwire);
+                if (!writer->quiet)
+                        mk_shm_fprint(stdout,MK_SHM_ADDOUT,&addoutwire,at);
+        }
+        if (NULL != in->mainin){
+                if (writer->generate) {
+                        mk_maininput_towire(&maininwire,&mainin);
+                } else {
+                        randomFill(MK_SHM_MAININ,&maininwire);
+                        mk_maininput_fromwire(&mainin,&maininwire);
+                }
+                stamp = mk_shm_taitime();
+                if (writer->shmflags & MK_SHM_DELTA)
+                        mk_maininput_writedelta(in->mainin,&mainin,cycle,stamp);
+                else
+                        mk_shm_write(&in->mainin->hdr,&in->mainin->data,&mainin,sizeof(mainin),cycle,stamp);
+                mk_shm_notify(&in->mainin->hdr);
+                if (NULL != in->maininring)
+                        mk_ring_append(in->maininring,cycle,stamp,&maininwire);
+                if (!writer->quiet)
+                        mk_shm_fprint(stdout,MK_SHM_MAININ,&maininwire,at);
+        }
+        if (NULL != in->axes) {
+                // the generator drives X, Y and Z, further axes stay at zero
+                memset(&axes,0,sizeof(axes));
+                if (writer->generate)
+                        mk_axes_gather(&axes,&mainout,&addout,&mainin);
+                else
+                        randomAxes(&axes);
+                stamp = mk_shm_taitime();
+                mk_axes_write(in->axes,&axes,cycle,stamp);
+                mk_shm_notify(&in->axes->hdr);
+                if (!writer->quiet)
+                        mk_axes_fprint(stdout,&axes,at);
+        }
+}
+
+/* Detaches and removes the axes and ring buffers of an instance, the shared memories are detached together */
+void detachInstance(struct instance_t* in)
+{
+        mk_shm_detach(&in->shm_mainoutring);
+        mk_shm_detach(&in->shm_maininring);
+        mk_shm_detach(&in->shm_addoutring);
+        mk_shm_detach(&in->shm_axes);
 }
 
 int main(int argc, char* argv[])
@@ -164,11 +460,31 @@ int main(int argc, char* argv[])
         writer.flagaddout = false;
         writer.flagmainout = false;
         writer.flagmainin = false;
+        writer.flagaxes = false;
+        writer.insts = NULL;
+        writer.shms = NULL;
+        writer.firstinst = mk_shm_instance();
+        writer.instances = 1;
+        writer.ringdepth = 0;
+        writer.shmflags = MK_SHM_WRITER | MK_SHM_POPULATE;
         writer.period = 10000000;       // 10 seconds 
+        writer.clock = CLOCK_MONOTONIC;
+        writer.rtprio = 0;
+        writer.cpu = -1;
+        writer.overruns = 0;
+        writer.quiet = false;
+        writer.generate = false;
+        writer.genlag = 2000;           // 2 milliseconds
+        writer.gennoise = 0.001;        // 1 micrometer
         time_t now;
-        struct tm now_local;
-        int randhalf;
-        randhalf = RAND_MAX/2;
+        struct tm now_local = { 0 };
+        char at[48];
+        uint64_t cycle = 0;
+        struct timespec next;
+        struct instance_t* in;
+        uint32_t attached;
+        uint32_t segments = 0;
+        uint32_t i;
 
         evalCLI(argc,argv,&writer);
 
@@ -176,101 +492,70 @@ int main(int argc, char* argv[])
         signal(SIGTERM, sigfunc);
         signal(SIGINT, sigfunc);
 
-        // open and setup shm mapping
-        if (writer.flagmainout) {
-                writer.mainout = (struct mk_mainoutput *) openShM(MK_MAINOUTKEY,sizeof(struct mk_mainoutput),&writer.sem_mainout);
-                if (NULL == writer.mainout)
-                        writer.flagmainout = false;
+        if (setupRT(&writer) == -1)
+                exit(1);
+
+        //initialize rand-function, every generator draws its own start position from it
+        srand((unsigned) time(&now));
+
+        // open and setup shm mapping of all instances, they are written in the same loop
+        writer.insts = calloc(writer.instances,sizeof(struct instance_t));
+        writer.shms = calloc(writer.instances,sizeof(struct mk_shminst));
+        if ((NULL == writer.insts) || (NULL == writer.shms)) {
+                perror("Allocation of instances failed");
+                exit(1);
         }
-        if (writer.flagmainin) {
-                writer.mainin = (struct mk_maininput *) openShM(MK_MAININKEY,sizeof(struct mk_maininput),&writer.sem_mainin);
-                if (NULL == writer.mainin)
-                        writer.flagmainin = false;
+        if (writer.flagmainout)
+                segments |= 1 << MK_SHM_MAINOUT;
+        if (writer.flagmainin)
+                segments |= 1 << MK_SHM_MAININ;
+        if (writer.flagaddout)
+                segments |= 1 << MK_SHM_ADDOUT;
+        attached = mk_shm_attach_insts(writer.shms,writer.firstinst,writer.instances,segments,writer.shmflags);
+        for (i = 0; i < writer.instances; i++) {
+                in = &writer.insts[i];
+                in->inst = writer.shms[i].inst;
+                in->shm = writer.shms[i].shm;
+                attachInstance(&writer,in);
+                attached += (NULL != in->axes);
         }
-        if (writer.flagaddout) {
-                writer.addout = (struct mk_additionaloutput *) openShM(MK_ADDAOUTKEY,sizeof(struct mk_additionaloutput),&writer.sem_addout);
-                if (NULL == writer.addout)
-                        writer.flagaddout = false;
+        // e.g. all are owned by other running writers
+        if (attached == 0) {
+                fprintf(stderr,"No shared memory could be attached\n");
+                free(writer.insts);
+                free(writer.shms);
+                exit(1);
         }
-
-        //initialize rand-function
-        srand((unsigned) time(&now));
         
 	// mainloop
+        clock_gettime(writer.clock,&next);
         while(run) {
-                now = time(NULL);
-                now_local = *localtime(&now);
-                if (writer.flagmainout){
-                        sem_wait(writer.sem_mainout);
-                        printf("\n##### Main Output Variables: (at %02d:%02d:%02d) #####\n", now_local.tm_hour, now_local.tm_min, now_local.tm_sec);
-                        writer.mainout->xvel_set = (double) (rand() * 0.000001);
-                        writer.mainout->yvel_set = (double) (rand() * 0.000001);
-                        writer.mainout->zvel_set = (double) (rand() * 0.000001);
-                        writer.mainout->spindlespeed = (double) (rand() * 0.000001);
-                        printf("X-Velocity Setpoint: %f mm/s;        Y-Velocity Setpoint: %f mm/s;        Z-Velocity Setpoint: %f mm/s;        Spindlespeed Setpoint: %f rpm\n",writer.mainout->xvel_set,writer.mainout->yvel_set,writer.mainout->zvel_set,writer.mainout->spindlespeed);
-                        writer.mainout->xenable = rand() > randhalf;
-                        writer.mainout->yenable = rand() > randhalf;
-                        writer.mainout->zenable = rand() > randhalf;
-                        writer.mainout->spindleenable = rand() > randhalf;
-                        printf("X-Axis enabled: %s;             Y-Axis enabled: %s;             Z-Axis enabled: %s;             Spindle enabled: %s\n",writer.mainout->xenable ? "true" : "false",writer.mainout->yenable ? "true" : "false",writer.mainout->zenable ? "true" : "false",writer.mainout->spindleenable ? "true" : "false");
-                        writer.mainout->spindlebrake = rand() > randhalf;
-                        writer.mainout->machinestatus = rand() > randhalf;
-                        writer.mainout->estopstatus = rand() > randhalf;
-                        printf("Spindlebranke engaged: %s;      Machine on: %s;                 Emergency Stop activated: %s\n",writer.mainout->spindlebrake ? "true" : "false",writer.mainout->machinestatus ? "true" : "false",writer.mainout->estopstatus ? "true" : "false");
-                        sem_post(writer.sem_mainout);
-                }
-                
-                if (writer.flagaddout){
-                        sem_wait(writer.sem_addout);
-                        printf("\n##### Additional Output Variables: (at %02d:%02d:%02d) #####\n", now_local.tm_hour, now_local.tm_min, now_local.tm_sec);
-                        writer.addout->xpos_set = (double) (rand() * 0.000001);
-                        writer.addout->ypos_set = (double) (rand() * 0.000001);
-                        writer.addout->zpos_set = (double) (rand() * 0.000001);
-                        writer.addout->feedrate = (double) (rand() * 0.000001);
-                        printf("X-Position Setpoint: %f mm;         Y-Position Setpoint: %f mm;        Z-Position Setpoint: %f mm;        Feedrate planned: %f mm/s\n",writer.addout->xpos_set,writer.addout->ypos_set,writer.addout->zpos_set,writer.addout->feedrate);
-                        writer.addout->xhome = rand() > randhalf;
-                        writer.addout->yhome = rand() > randhalf;
-                        writer.addout->zhome = rand() > randhalf;
-                        writer.addout->feedoverride = (double) (rand() * 0.000001);
-                        printf("X-Axis at home: %s;              Y-Axis at home: %s;             Z-Axis at home: %s;             Feedrate override: %f %%\n",writer.addout->xhome ? "true" : "false",writer.addout->yhome ? "true" : "false",writer.addout->zhome ? "true" : "false",writer.addout->feedoverride);
-                        writer.addout->xhardneg = rand() > randhalf;
-                        writer.addout->yhardneg = rand() > randhalf;
-                        writer.addout->zhardneg = rand() > randhalf;
-                        printf("X-Axis at neg Endstop: %s;       Y-Axis at neg Endstop: %s;      Z-Axis at neg Endstop: %s\n",writer.addout->xhardneg ? "true" : "false",writer.addout->yhardneg ? "true" : "false",writer.addout->zhardneg ? "true" : "false");
-                        writer.addout->xhardpos = rand() > randhalf;
-                        writer.addout->yhardpos = rand() > randhalf;
-                        writer.addout->zhardpos = rand() > randhalf;
-                        printf("X-Axis at pos Endstop: %s;       Y-Axis at pos Endstop: %s;      Z-Axis at pos Endstop: %s\n",writer.addout->xhardpos ? "true" : "false",writer.addout->yhardpos ? "true" : "false",writer.addout->zhardpos ? "true" : "false");
-                        writer.addout->lineno = rand();
-                        writer.addout->tool = rand ();
-                        writer.addout->mode = rand() %4 +1;
-                        printf("Current Line Number: %d;                                         Tool Number: %d;                Mode: %d\n",writer.addout->lineno,writer.addout->tool,writer.addout->mode);
-                        sem_post(writer.sem_addout);
+                if (!writer.quiet) {
+                        now = time(NULL);
+                        now_local = *localtime(&now);
                 }
-                if (writer.flagmainin){
-                        sem_wait(writer.sem_mainin);
-                        printf("\n##### Main Input Variables: (at %02d:%02d:%02d) #####\n", now_local.tm_hour, now_local.tm_min, now_local.tm_sec);
-                        writer.mainin->xpos_cur = (double) (rand() * 0.000001);
-                        writer.mainin->ypos_cur = (double) (rand() * 0.000001);
-                        writer.mainin->zpos_cur = (double) (rand() * 0.000001);
-                        printf("X-Position Current: %f mm;         Y-Position Current: %f mm;        Z-Position Current mm: %f;\n",writer.mainin->xpos_cur,writer.mainin->ypos_cur,writer.mainin->zpos_cur);
-                        writer.mainin->xfault = rand() > randhalf;
-                        writer.mainin->yfault = rand() > randhalf;
-                        writer.mainin->zfault = rand() > randhalf;
-                        printf("X-Axis faulty: %s;              Y-Axis faulty: %s;             Z-Axis faulty: %s;\n",writer.mainin->xfault ? "true" : "false",writer.mainin->yfault ? "true" : "false",writer.mainin->zfault ? "true" : "false");
-                        sem_post(writer.sem_mainin);
+                for (i = 0; i < writer.instances; i++) {
+                        if (!writer.quiet) {
+                                if (writer.instances > 1)
+                                        snprintf(at,sizeof(at),"at %02d:%02d:%02d, instance %u",now_local.tm_hour, now_local.tm_min, now_local.tm_sec, writer.insts[i].inst);
+                                else
+                                        snprintf(at,sizeof(at),"at %02d:%02d:%02d",now_local.tm_hour, now_local.tm_min, now_local.tm_sec);
+                        }
+                        writeInstance(&writer,&writer.insts[i],cycle,at);
                 }
-                
-                usleep(writer.period);
+
+                cycle++;
+                waitNextCycle(&writer,&next);
         }
+        if (writer.overruns > 0)
+                fprintf(stderr,"%llu deadlines missed in %llu cycles\n",(unsigned long long) writer.overruns,(unsigned long long) cycle);
 
         // cleanup
-        if (writer.flagmainout)
-                closeShM(MK_MAINOUTKEY,(void**)&writer.mainout,sizeof(writer.mainout),&writer.sem_mainout);   
-        if (writer.flagmainin)
-                closeShM(MK_MAININKEY,(void**)&writer.mainin,sizeof(writer.mainin),&writer.sem_mainin);
-        if (writer.flagaddout)
-                closeShM(MK_ADDAOUTKEY,(void**)&writer.addout,sizeof(writer.addout),&writer.sem_addout);
+        for (i = 0; i < writer.instances; i++)
+                detachInstance(&writer.insts[i]);
+        mk_shm_detach_insts(writer.shms,writer.instances);
+        free(writer.insts);
+        free(writer.shms);
 
         return 0;
 }
@@ -0,0 +1,645 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Compressed archive files of the shared memories (libmkshm) */
+
+#include "mk_shmarchive.h"
+#include "mk_shmfields.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// offsets of the structs of the shared memories in a record
+static const uint32_t segoffsets[MK_SHM_SEGCNT] = {
+        [MK_SHM_MAINOUT] = offsetof(struct mk_tracerec, mainout),
+        [MK_SHM_MAININ] = offsetof(struct mk_tracerec, mainin),
+        [MK_SHM_ADDOUT] = offsetof(struct mk_tracerec, addout),
+};
+
+/* Appends the n lowest bits of v, the buffer has to be zeroed */
+static inline void putbits(struct mk_arcbits* b, uint64_t v, uint32_t n)
+{
+        uint32_t room;
+        uint32_t take;
+
+        while (n > 0) {
+                room = 8 - (b->pos & 7);
+                take = (n < room) ? n : room;
+                b->buf[b->pos >> 3] |= (uint8_t) (((v >> (n - take)) & ((1U << take) - 1)) << (room - take));
+                b->pos += take;
+                n -= take;
+        }
+}
+
+/* Reads n bits, reading beyond the end returns zeros and is detected by the caller with pos */
+static inline uint64_t getbits(struct mk_arcbits* b, uint32_t n)
+{
+        uint64_t v = 0;
+        uint32_t room;
+        uint32_t take;
+
+        while (n > 0) {
+                room = 8 - (b->pos & 7);
+                take = (n < room) ? n : room;
+                v <<= take;
+                if ((b->pos >> 3) < b->cap)
+                        v |= (b->buf[b->pos >> 3] >> (room - take)) & ((1U << take) - 1);
+                b->pos += take;
+                n -= take;
+        }
+        return v;
+}
+
+/* Appends a signed value, small magnitudes take few bits: 0 one bit, else 9, 15, 24 or 68 bits */
+static void putvalue(struct mk_arcbits* b, int64_t v)
+{
+        uint64_t z = ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+
+        if (z == 0) {
+                putbits(b,0,1);
+        } else if (z < (1ULL << 7)) {
+                putbits(b,2,2);
+                putbits(b,z,7);
+        } else if (z < (1ULL << 12)) {
+                putbits(b,6,3);
+                putbits(b,z,12);
+        } else if (z < (1ULL << 20)) {
+                putbits(b,14,4);
+                putbits(b,z,20);
+        } else {
+                putbits(b,15,4);
+                putbits(b,z,64);
+        }
+}
+
+/* Reads a value appended by putvalue */
+static int64_t getvalue(struct mk_arcbits* b)
+{
+        uint64_t z;
+
+        if (getbits(b,1) == 0)
+                return 0;
+        if (getbits(b,1) == 0)
+                z = getbits(b,7);
+        else if (getbits(b,1) == 0)
+                z = getbits(b,12);
+        else if (getbits(b,1) == 0)
+                z = getbits(b,20);
+        else
+                z = getbits(b,64);
+        return (int64_t) ((z >> 1) ^ -(z & 1));
+}
+
+/* Appends the XOR of a double with its previous value */
+static void putxor(struct mk_arcbits* b, struct mk_arccol* col, uint64_t x)
+{
+        uint32_t lead;
+        uint32_t trail;
+        uint32_t len;
+
+        if (x == 0) {
+                putbits(b,0,1);
+                return;
+        }
+        lead = __builtin_clzll(x);
+        trail = __builtin_ctzll(x);
+        // the meaningful bits fit into those of the previous XOR
+        if ((col->lead < 64) && (lead >= col->lead) && (trail >= col->trail)) {
+                putbits(b,2,2);
+                putbits(b,x >> col->trail,64 - col->lead - col->trail);
+                return;
+        }
+        len = 64 - lead - trail;
+        putbits(b,3,2);
+        putbits(b,lead,6);
+        putbits(b,len - 1,6);
+        putbits(b,x >> trail,len);
+        col->lead = lead;
+        col->trail = trail;
+}
+
+/* Reads a XOR appended by putxor */
+static uint64_t getxor(struct mk_arcbits* b, struct mk_arccol* col)
+{
+        uint32_t len;
+
+        if (getbits(b,1) == 0)
+                return 0;
+        if (getbits(b,1) == 0) {
+                if (col->lead >= 64)
+                        return 0;
+                return getbits(b,64 - col->lead - col->trail) << col->trail;
+        }
+        col->lead = getbits(b,6);
+        len = getbits(b,6) + 1;
+        if (col->lead + len > 64) {
+                // corrupt, the caller detects it by the position
+                b->pos = b->cap * 8 + 1;
+                return 0;
+        }
+        col->trail = 64 - col->lead - len;
+        return getbits(b,len) << col->trail;
+}
+
+/* Returns the value of a column of a record, integers sign or zero extended */
+static uint64_t loadcol(const struct mk_arccol* col, const struct mk_tracerec* rec)
+{
+        const char* p = (const char*) rec + col->offset;
+        uint64_t u64;
+        uint32_t u32;
+        int32_t i32;
+
+        switch (col->type) {
+        case MK_FIELD_INT32:
+                memcpy(&i32,p,sizeof(i32));
+                return (uint64_t) (int64_t) i32;
+        case MK_FIELD_UINT32:
+                memcpy(&u32,p,sizeof(u32));
+                return u32;
+        case MK_FIELD_UINT8:
+                return *(const uint8_t*) p;
+        default:
+                memcpy(&u64,p,sizeof(u64));
+                return u64;
+        }
+}
+
+/* Stores the value of a column into a record */
+static void storecol(const struct mk_arccol* col, struct mk_tracerec* rec, uint64_t v)
+{
+        char* p = (char*) rec + col->offset;
+        uint32_t u32 = (uint32_t) v;
+
+        switch (col->type) {
+        case MK_FIELD_INT32:
+        case MK_FIELD_UINT32:
+                memcpy(p,&u32,sizeof(u32));
+                break;
+        case MK_FIELD_UINT8:
+                *(uint8_t*) p = (uint8_t) v;
+                break;
+        default:
+                memcpy(p,&v,sizeof(v));
+                break;
+        }
+}
+
+/* Adds a column */
+static void addcol(struct mk_archive* arc, uint32_t offset, uint16_t type, uint16_t size)
+{
+        struct mk_arccol* col = &arc->cols[arc->ncols++];
+        col->offset = offset;
+        col->type = type;
+        col->size = size;
+}
+
+/* Sets up the columns of the recorded shared memories, returns 0 or -1 if there are too many bools */
+static int setupcols(struct mk_archive* arc)
+{
+        const struct mk_fieldset* set;
+        uint32_t s;
+        uint32_t i;
+
+        arc->ncols = 0;
+        arc->nbools = 0;
+        addcol(arc,offsetof(struct mk_tracerec, stamp),MK_ARC_STAMP,sizeof(uint64_t));
+        for (s = 0; s < MK_SHM_SEGCNT; s++) {
+                if (!(arc->hdr.segments & (1 << s)))
+                        continue;
+                addcol(arc,offsetof(struct mk_tracerec, seg) + s * sizeof(struct mk_tracestamp) + offsetof(struct mk_tracestamp, cycle),
+                        MK_ARC_STAMP,sizeof(uint64_t));
+                addcol(arc,offsetof(struct mk_tracerec, seg) + s * sizeof(struct mk_tracestamp) + offsetof(struct mk_tracestamp, stamp),
+                        MK_ARC_STAMP,sizeof(uint64_t));
+                set = mk_shm_fields(s);
+                for (i = 0; i < set->count; i++) {
+                        if (set->fields[i].type != MK_FIELD_BOOL) {
+                                addcol(arc,segoffsets[s] + set->fields[i].offset,set->fields[i].type,set->fields[i].size);
+                                continue;
+                        }
+                        if (arc->nbools == 64) {
+                                fprintf(stderr,"Archive: more than 64 bools per record\n");
+                                return -1;
+                        }
+                        arc->boolofs[arc->nbools++] = segoffsets[s] + set->fields[i].offset;
+                }
+        }
+        return 0;
+}
+
+/* Resets the coder state at the start of a block, so every block is decoded on its own */
+static void resetcols(struct mk_archive* arc)
+{
+        uint32_t i;
+        for (i = 0; i < arc->ncols; i++) {
+                arc->cols[i].prev = 0;
+                arc->cols[i].delta = 0;
+                arc->cols[i].lead = 64;
+                arc->cols[i].trail = 0;
+        }
+        arc->boolset = 0;
+        arc->boolrun = 0;
+}
+
+/* Allocates the buffers of a block with the worst case size */
+static int allocbufs(struct mk_archive* arc)
+{
+        // at most 78 bits per column, at most 132 bits per run of bools
+        arc->vals.cap = (size_t) arc->hdr.blocklen * arc->ncols * 10 + 16;
+        arc->bools.cap = (size_t) arc->hdr.blocklen * 17 + 16;
+        arc->vals.buf = calloc(1,arc->vals.cap);
+        arc->bools.buf = calloc(1,arc->bools.cap);
+        if ((NULL == arc->vals.buf) || (NULL == arc->bools.buf)) {
+                perror("Archive Allocation failed");
+                return -1;
+        }
+        return 0;
+}
+
+/* Appends an entry to the index, the index grows at block boundaries only */
+static int addindex(struct mk_archive* arc, const struct mk_arcblock* block, uint64_t offset)
+{
+        struct mk_arcindex* index;
+        uint64_t cap;
+
+        if (arc->blocks == arc->indexcap) {
+                cap = arc->indexcap ? 2 * arc->indexcap : 256;
+                index = realloc(arc->index,cap * sizeof(*index));
+                if (NULL == index) {
+                        perror("Archive Allocation failed");
+                        return -1;
+                }
+                arc->index = index;
+                arc->indexcap = cap;
+        }
+        arc->index[arc->blocks].first = block->first;
+        arc->index[arc->blocks].last = block->last;
+        arc->index[arc->blocks].offset = offset;
+        arc->index[arc->blocks].count = block->count;
+        arc->blocks++;
+        return 0;
+}
+
+/* Writes a buffer completely */
+static int writeall(int fd, const void* buf, size_t len)
+{
+        const char* p = buf;
+        ssize_t n;
+
+        while (len > 0) {
+                n = write(fd,p,len);
+                if (n == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        perror("Archive Write failed");
+                        return -1;
+                }
+                p += n;
+                len -= n;
+        }
+        return 0;
+}
+
+/* Reads a buffer completely at an offset, returns 0 or -1 */
+static int readall(int fd, void* buf, size_t len, uint64_t offset)
+{
+        char* p = buf;
+        ssize_t n;
+
+        while (len > 0) {
+                n = pread(fd,p,len,offset);
+                if ((n == -1) && (errno == EINTR))
+                        continue;
+                if (n <= 0)
+                        return -1;
+                p += n;
+                len -= n;
+                offset += n;
+        }
+        return 0;
+}
+
+/* Appends the current run of bools */
+static void putrun(struct mk_archive* arc)
+{
+        putvalue(&arc->bools,arc->boolrun);
+        putbits(&arc->bools,arc->boolset,arc->nbools);
+}
+
+/* Writes the current block and starts a new one */
+static int flushblock(struct mk_archive* arc)
+{
+        struct mk_arcblock* block = &arc->block;
+        uint64_t offset = arc->bytes;
+
+        if (block->count == 0)
+                return 0;
+        if ((arc->nbools > 0) && (arc->boolrun > 0))
+                putrun(arc);
+        block->magic = MK_ARC_BLOCKMAGIC;
+        block->valbytes = (arc->vals.pos + 7) / 8;
+        block->boolbytes = (arc->bools.pos + 7) / 8;
+        if ((writeall(arc->fd,block,sizeof(*block)) == -1) ||
+            (writeall(arc->fd,arc->vals.buf,block->valbytes) == -1) ||
+            (writeall(arc->fd,arc->bools.buf,block->boolbytes) == -1))
+                return -1;
+        arc->bytes += sizeof(*block) + block->valbytes + block->boolbytes;
+        if (addindex(arc,block,offset) == -1)
+                return -1;
+        memset(arc->vals.buf,0,block->valbytes);
+        memset(arc->bools.buf,0,block->boolbytes);
+        arc->vals.pos = 0;
+        arc->bools.pos = 0;
+        block->count = 0;
+        resetcols(arc);
+        return 0;
+}
+
+int mk_archive_create(struct mk_archive* arc, const char* path, uint32_t segments, uint32_t period, uint32_t blocklen)
+{
+        memset(arc,0,sizeof(*arc));
+        arc->fd = -1;
+        arc->writer = true;
+        if ((blocklen == 0) || (blocklen > MK_ARC_MAXBLOCKLEN)) {
+                fprintf(stderr,"Archive block length %u is not between 1 and %u\n",blocklen,MK_ARC_MAXBLOCKLEN);
+                return -1;
+        }
+        arc->hdr.magic = MK_ARC_MAGIC;
+        arc->hdr.version = MK_ARC_VERSION;
+        arc->hdr.layout = MK_SHM_LAYOUT_REV;
+        arc->hdr.hash = MK_SHM_LAYOUT_HASH;
+        arc->hdr.segments = segments;
+        arc->hdr.period = period;
+        arc->hdr.blocklen = blocklen;
+        if ((setupcols(arc) == -1) || (allocbufs(arc) == -1)) {
+                mk_archive_close(arc);
+                return -1;
+        }
+        resetcols(arc);
+
+        arc->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (arc->fd == -1) {
+                perror("Archive Open failed");
+                mk_archive_close(arc);
+                return -1;
+        }
+        if (writeall(arc->fd,&arc->hdr,sizeof(arc->hdr)) == -1) {
+                mk_archive_close(arc);
+                unlink(path);
+                return -1;
+        }
+        arc->bytes = sizeof(arc->hdr);
+        return 0;
+}
+
+int mk_archive_append(struct mk_archive* arc, const struct mk_tracerec* rec)
+{
+        struct mk_arccol* col;
+        uint64_t v;
+        uint64_t set = 0;
+        int64_t delta;
+        uint32_t i;
+
+        if (arc->block.count == 0)
+                arc->block.first = rec->stamp;
+        arc->block.last = rec->stamp;
+        for (i = 0; i < arc->ncols; i++) {
+                col = &arc->cols[i];
+                v = loadcol(col,rec);
+                switch (col->type) {
+                case MK_ARC_STAMP:
+                        delta = (int64_t) (v - col->prev);
+                        putvalue(&arc->vals,delta - col->delta);
+                        col->delta = delta;
+                        break;
+                case MK_FIELD_DOUBLE:
+                        putxor(&arc->vals,col,v ^ col->prev);
+                        break;
+                default:
+                        putvalue(&arc->vals,(int64_t) (v - col->prev));
+                        break;
+                }
+                col->prev = v;
+        }
+        if (arc->nbools > 0) {
+                for (i = 0; i < arc->nbools; i++)
+                        set |= (uint64_t) (*((const uint8_t*) rec + arc->boolofs[i]) != 0) << i;
+                if ((arc->boolrun > 0) && (set == arc->boolset)) {
+                        arc->boolrun++;
+                } else {
+                        if (arc->boolrun > 0)
+                                putrun(arc);
+                        arc->boolset = set;
+                        arc->boolrun = 1;
+                }
+        }
+        arc->records++;
+        if (++arc->block.count < arc->hdr.blocklen)
+                return 0;
+        return flushblock(arc);
+}
+
+int mk_archive_open(struct mk_archive* arc, const char* path)
+{
+        struct stat st;
+        struct mk_arctrailer trailer;
+        struct mk_arcblock block;
+        uint64_t offset;
+        uint64_t i;
+
+        memset(arc,0,sizeof(*arc));
+        arc->fd = open(path, O_RDONLY);
+        if (arc->fd == -1) {
+                perror("Archive Open failed");
+                return -1;
+        }
+        if ((fstat(arc->fd,&st) == -1) || (readall(arc->fd,&arc->hdr,sizeof(arc->hdr),0) == -1) ||
+            (arc->hdr.magic != MK_ARC_MAGIC) || (arc->hdr.version != MK_ARC_VERSION)) {
+                fprintf(stderr,"Archive %s is not an archive file of version %u\n",path,MK_ARC_VERSION);
+                mk_archive_close(arc);
+                return -1;
+        }
+        // the revision also changes with the header of the shared memories, the records only depend on the structs
+        if (arc->hdr.hash != MK_SHM_LAYOUT_HASH) {
+                fprintf(stderr,"Archive %s was recorded with layout hash %08x, expected %08x\n",path,arc->hdr.hash,MK_SHM_LAYOUT_HASH);
+                mk_archive_close(arc);
+                return -1;
+        }
+        if ((arc->hdr.blocklen == 0) || (arc->hdr.blocklen > MK_ARC_MAXBLOCKLEN) ||
+            (setupcols(arc) == -1) || (allocbufs(arc) == -1)) {
+                mk_archive_close(arc);
+                return -1;
+        }
+        arc->bytes = st.st_size;
+
+        // load the index written on close
+        if ((arc->bytes >= sizeof(arc->hdr) + sizeof(trailer)) &&
+            (readall(arc->fd,&trailer,sizeof(trailer),arc->bytes - sizeof(trailer)) == 0) &&
+            (trailer.magic == MK_ARC_INDEXMAGIC) &&
+            (trailer.offset + trailer.blocks * sizeof(struct mk_arcindex) + sizeof(trailer) == arc->bytes)) {
+                arc->index = malloc((trailer.blocks ? trailer.blocks : 1) * sizeof(*arc->index));
+                if ((NULL == arc->index) ||
+                    (readall(arc->fd,arc->index,trailer.blocks * sizeof(*arc->index),trailer.offset) == -1)) {
+                        fprintf(stderr,"Archive %s: reading the index failed\n",path);
+                        mk_archive_close(arc);
+                        return -1;
+                }
+                arc->blocks = trailer.blocks;
+                arc->indexcap = trailer.blocks;
+        } else {
+                // not closed by the writer, rebuild the index from the complete blocks
+                offset = sizeof(arc->hdr);
+                while ((offset + sizeof(block) <= arc->bytes) && (readall(arc->fd,&block,sizeof(block),offset) == 0)) {
+                        if ((block.magic != MK_ARC_BLOCKMAGIC) || (block.count == 0) || (block.count > arc->hdr.blocklen) ||
+                            (offset + sizeof(block) + block.valbytes + block.boolbytes > arc->bytes))
+                                break;
+                        if (addindex(arc,&block,offset) == -1) {
+                                mk_archive_close(arc);
+                                return -1;
+                        }
+                        offset += sizeof(block) + block.valbytes + block.boolbytes;
+                }
+        }
+        for (i = 0; i < arc->blocks; i++)
+                arc->records += arc->index[i].count;
+        return 0;
+}
+
+/* Loads block i for decoding, returns 0 or -1 on error */
+static int loadblock(struct mk_archive* arc, uint64_t i)
+{
+        struct mk_arcblock* block = &arc->block;
+
+        if ((readall(arc->fd,block,sizeof(*block),arc->index[i].offset) == -1) ||
+            (block->magic != MK_ARC_BLOCKMAGIC) || (block->count == 0) || (block->count > arc->hdr.blocklen) ||
+            (block->valbytes > arc->vals.cap) || (block->boolbytes > arc->bools.cap) ||
+            (readall(arc->fd,arc->vals.buf,block->valbytes,arc->index[i].offset + sizeof(*block)) == -1) ||
+            (readall(arc->fd,arc->bools.buf,block->boolbytes,arc->index[i].offset + sizeof(*block) + block->valbytes) == -1)) {
+                fprintf(stderr,"Archive: block %llu is corrupt\n",(unsigned long long) i);
+                block->count = 0;
+                return -1;
+        }
+        arc->vals.pos = 0;
+        arc->bools.pos = 0;
+        resetcols(arc);
+        arc->done = 0;
+        arc->next = i + 1;
+        arc->peeked = false;
+        return 0;
+}
+
+int mk_archive_next(struct mk_archive* arc, struct mk_tracerec* rec)
+{
+        struct mk_arccol* col;
+        uint64_t v;
+        uint32_t i;
+
+        if (arc->peeked) {
+                *rec = arc->peek;
+                arc->peeked = false;
+                return 1;
+        }
+        while (arc->done >= arc->block.count) {
+                if (arc->next >= arc->blocks)
+                        return 0;
+                if (loadblock(arc,arc->next) == -1)
+                        return -1;
+        }
+
+        memset(rec,0,sizeof(*rec));
+        for (i = 0; i < arc->ncols; i++) {
+                col = &arc->cols[i];
+                switch (col->type) {
+                case MK_ARC_STAMP:
+                        col->delta += getvalue(&arc->vals);
+                        v = col->prev + col->delta;
+                        break;
+                case MK_FIELD_DOUBLE:
+                        v = col->prev ^ getxor(&arc->vals,col);
+                        break;
+                default:
+                        v = col->prev + getvalue(&arc->vals);
+                        break;
+                }
+                storecol(col,rec,v);
+                col->prev = v;
+        }
+        if (arc->nbools > 0) {
+                if (arc->boolrun == 0) {
+                        arc->boolrun = getvalue(&arc->bools);
+                        arc->boolset = getbits(&arc->bools,arc->nbools);
+                }
+                for (i = 0; i < arc->nbools; i++)
+                        *((uint8_t*) rec + arc->boolofs[i]) = (arc->boolset >> i) & 1;
+                if (arc->boolrun > 0)
+                        arc->boolrun--;
+        }
+        arc->done++;
+        if ((arc->vals.pos > (size_t) arc->block.valbytes * 8) || (arc->bools.pos > (size_t) arc->block.boolbytes * 8)) {
+                fprintf(stderr,"Archive: block %llu is corrupt\n",(unsigned long long) arc->next - 1);
+                return -1;
+        }
+        return 1;
+}
+
+int mk_archive_seek(struct mk_archive* arc, uint64_t stamp)
+{
+        uint64_t lo = 0;
+        uint64_t hi = arc->blocks;
+        uint64_t mid;
+
+        // first block whose last record is not before stamp
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (arc->index[mid].last < stamp)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        if (lo == arc->blocks)
+                return -1;
+        if (loadblock(arc,lo) == -1)
+                return -1;
+        while (mk_archive_next(arc,&arc->peek) == 1) {
+                if (arc->peek.stamp >= stamp) {
+                        arc->peeked = true;
+                        return 0;
+                }
+        }
+        return -1;
+}
+
+int mk_archive_close(struct mk_archive* arc)
+{
+        struct mk_arctrailer trailer;
+        int ok = 0;
+
+        if (arc->writer && (arc->fd != -1)) {
+                if (flushblock(arc) == -1)
+                        ok = -1;
+                trailer.magic = MK_ARC_INDEXMAGIC;
+                trailer.offset = arc->bytes;
+                trailer.blocks = arc->blocks;
+                if ((ok == 0) && ((writeall(arc->fd,arc->index,arc->blocks * sizeof(*arc->index)) == -1) ||
+                    (writeall(arc->fd,&trailer,sizeof(trailer)) == -1)))
+                        ok = -1;
+                arc->bytes += arc->blocks * sizeof(*arc->index) + sizeof(trailer);
+        }
+        if (arc->fd != -1)
+                close(arc->fd);
+        arc->fd = -1;
+        free(arc->index);
+        free(arc->vals.buf);
+        free(arc->bools.buf);
+        arc->index = NULL;
+        arc->vals.buf = NULL;
+        arc->bools.buf = NULL;
+        return ok;
+}
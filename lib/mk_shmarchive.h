@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Compressed archive files of the shared memories (libmkshm)
+ *
+ * An archive holds the same records as a trace file (struct mk_tracerec),
+ * compressed for long-term storage. The records are grouped into blocks of
+ * up to blocklen records, each block is coded independently:
+ * - timestamps and cycle counters as delta of delta, 1 bit if the period did
+ *   not change
+ * - doubles XOR coded with the previous value of the variable (Gorilla), 1
+ *   bit if unchanged, else only the bits between the leading and trailing
+ *   zeros of the XOR
+ * - integers as delta to the previous value
+ * - the bools of a record as one bitset, run-length coded in a separate
+ *   section of the block
+ * Every block starts with a header holding the timestamps of its first and
+ * last record. On close an index of all blocks is appended, so a range of
+ * records is found by a binary search without decoding the file. If the
+ * writer terminated without closing, the index is rebuilt from the block
+ * headers when the archive is opened.
+ */
+
+#ifndef _MK_SHMARCHIVE_H_
+#define _MK_SHMARCHIVE_H_
+
+#include "mk_shmlib.h"
+#include "mk_shmtrace.h"
+#include <stdbool.h>
+
+#define MK_ARC_MAGIC 0x31484352414b4d41ULL	// "AMKARCH1"
+#define MK_ARC_VERSION 1
+#define MK_ARC_BLOCKMAGIC 0x4b4c4241U		// "ABLK"
+#define MK_ARC_INDEXMAGIC 0x5845444e494b4d41ULL	// "AMKINDEX"
+// default number of records of a block
+#define MK_ARC_BLOCKLEN 1024
+// maximum number of records of a block
+#define MK_ARC_MAXBLOCKLEN 65536
+// type of the columns of the timestamps and cycle counters
+#define MK_ARC_STAMP 0x100
+// maximum number of columns, the variables of all shared memories and the timestamps
+#define MK_ARC_MAXCOLS (MK_MAINOUTPUT_FIELDCNT + MK_ADDITIONALOUTPUT_FIELDCNT + MK_MAININPUT_FIELDCNT + 1 + 2 * MK_SHM_SEGCNT)
+
+// header of an archive file
+struct mk_archdr {
+	uint64_t magic;		//MK_ARC_MAGIC
+	uint32_t version;	//version of the archive format, MK_ARC_VERSION
+	uint32_t layout;	//MK_SHM_LAYOUT_REV of the recorded structs, informational
+	uint32_t hash;		//MK_SHM_LAYOUT_HASH of the recorded structs, the order of the variables
+	uint32_t segments;	//recorded shared memories, bit (1 << enum mk_shmseg) set if recorded
+	uint32_t period;	//sampling period of the recorder in us
+	uint32_t blocklen;	//maximum number of records of a block
+};
+
+// header of a block, followed by the coded variables and the coded bools
+struct mk_arcblock {
+	uint32_t magic;		//MK_ARC_BLOCKMAGIC
+	uint32_t count;		//number of records
+	uint32_t valbytes;	//size of the coded variables
+	uint32_t boolbytes;	//size of the coded bools
+	uint64_t first;		//timestamp of the first record
+	uint64_t last;		//timestamp of the last record
+};
+
+// entry of the index
+struct mk_arcindex {
+	uint64_t first;		//timestamp of the first record of the block
+	uint64_t last;		//timestamp of the last record of the block
+	uint64_t offset;	//offset of the block header in the file
+	uint64_t count;		//number of records of the block
+};
+
+// trailer of an archive file, the index is stored in front of it
+struct mk_arctrailer {
+	uint64_t magic;		//MK_ARC_INDEXMAGIC
+	uint64_t offset;	//offset of the index in the file
+	uint64_t blocks;	//number of index entries
+};
+
+// column of a record and its coder state
+struct mk_arccol {
+	uint32_t offset;	//offset in struct mk_tracerec
+	uint16_t type;		//enum mk_fieldtype or MK_ARC_STAMP
+	uint16_t size;		//size in bytes
+	uint64_t prev;		//previous value, bits of a double
+	int64_t delta;		//previous delta of a timestamp
+	uint8_t lead;		//leading zeros of the previous XOR of a double, 64 if none
+	uint8_t trail;		//trailing zeros of the previous XOR of a double
+};
+
+// buffer of bits, most significant bit first
+struct mk_arcbits {
+	uint8_t* buf;
+	size_t cap;		//size of the buffer in bytes
+	size_t pos;		//position in bits
+};
+
+// handle of an open archive
+struct mk_archive {
+	int fd;
+	bool writer;
+	struct mk_archdr hdr;
+	struct mk_arccol cols[MK_ARC_MAXCOLS];
+	uint32_t ncols;
+	uint32_t boolofs[64];	//offsets of the bools in struct mk_tracerec
+	uint32_t nbools;
+	struct mk_arcindex* index;
+	uint64_t blocks;	//number of blocks
+	uint64_t indexcap;	//number of entries the index has space for
+	struct mk_arcbits vals;	//coded variables of the current block
+	struct mk_arcbits bools;	//coded bools of the current block
+	struct mk_arcblock block;	//header of the current block
+	uint64_t boolset;	//bools of the current run
+	uint32_t boolrun;	//records of the current run, remaining records of the run when reading
+	uint64_t next;		//block to be read next
+	uint32_t done;		//records of the current block read
+	bool peeked;		//true if peek holds the next record, found by mk_archive_seek
+	struct mk_tracerec peek;
+	uint64_t records;	//records written or in the archive
+	uint64_t bytes;		//size of the file
+};
+
+// creates an archive file with blocks of up to blocklen records, returns 0 or -1 on error
+int mk_archive_create(struct mk_archive* arc, const char* path, uint32_t segments, uint32_t period, uint32_t blocklen);
+
+// appends a record, a completed block is written to the file, returns 0 or -1 on a write error
+int mk_archive_append(struct mk_archive* arc, const struct mk_tracerec* rec);
+
+// opens an existing archive file read-only and loads or rebuilds its index, returns 0 or -1 on error
+int mk_archive_open(struct mk_archive* arc, const char* path);
+
+// positions the archive at the first record with a timestamp at or after stamp, returns 0 or -1 if there is none
+int mk_archive_seek(struct mk_archive* arc, uint64_t stamp);
+
+// decodes the next record, returns 1, 0 at the end of the archive or -1 on error
+int mk_archive_next(struct mk_archive* arc, struct mk_tracerec* rec);
+
+// closes an archive, a created one gets its last block and the index written, returns 0 or -1 on error
+int mk_archive_close(struct mk_archive* arc);
+
+#endif /* _MK_SHMARCHIVE_H_ */
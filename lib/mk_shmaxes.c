@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Axes shared memory in struct-of-arrays layout (libmkshm) */
+
+#include "mk_shmaxes.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+struct mk_axes_shm* mk_axes_attach(struct mk_shm* shm, uint32_t inst, int flags)
+{
+        char name[64];
+        mk_shm_instkey(name,sizeof(name),MK_AXESKEY,inst);
+        return (struct mk_axes_shm*) mk_shm_attachname(shm,name,sizeof(struct mk_axes_shm),flags);
+}
+
+double mk_axes_ferror(const struct mk_axes* axes, double* err)
+{
+        double max = 0.0;
+        int i;
+        // the padding is zero, so the loops run over whole vectors
+        for (i = 0; i < MK_AXES_STRIDE; i++)
+                err[i] = axes->pos_set[i] - axes->pos_cur[i];
+        for (i = 0; i < MK_AXES_STRIDE; i++)
+                max = fmax(max,fabs(err[i]));
+        return max;
+}
+
+uint32_t mk_axes_overlimit(const struct mk_axes* axes, double limit)
+{
+        uint32_t mask = 0;
+        int i;
+        for (i = 0; i < MK_NAXES; i++)
+                mask |= (uint32_t) (fabs(axes->pos_set[i] - axes->pos_cur[i]) > limit) << i;
+        return mask;
+}
+
+void mk_axes_fprint(FILE* file, const struct mk_axes* axes, const char* at)
+{
+        int i;
+
+        fprintf(file, "\n##### Axes: (%s) #####\n", at);
+        for (i = 0; i < MK_NAXES; i++)
+                fprintf(file, "Axis %d: Velocity Setpoint: %f mm/s; Position Setpoint: %f mm; Position Current: %f mm; enabled: %s; faulty: %s; at home: %s; at neg Endstop: %s; at pos Endstop: %s;\n",
+                        i, axes->vel_set[i], axes->pos_set[i], axes->pos_cur[i],
+                        (axes->enable >> i) & 1 ? "true" : "false", (axes->fault >> i) & 1 ? "true" : "false",
+                        (axes->home >> i) & 1 ? "true" : "false", (axes->hardneg >> i) & 1 ? "true" : "false",
+                        (axes->hardpos >> i) & 1 ? "true" : "false");
+}
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Axes shared memory in struct-of-arrays layout (libmkshm)
+ *
+ * Optionally the writer additionally publishes the per-axis variables of all
+ * MK_NAXES axes in the shared memory MK_AXES (struct mk_axes in
+ * mk_shminterface.h), instance n > 0 is named MK_AXES.n. The functions below
+ * process all axes at once: the loops run over whole arrays of
+ * MK_AXES_STRIDE elements, so the compiler vectorizes them, and the flags of
+ * all axes are tested with single mask operations.
+ */
+
+#ifndef _MK_SHMAXES_H_
+#define _MK_SHMAXES_H_
+
+#include "mk_shmlib.h"
+#include <stdio.h>
+
+// attaches the axes shared memory of an instance of the interface like mk_shm_attach_inst
+struct mk_axes_shm* mk_axes_attach(struct mk_shm* shm, uint32_t inst, int flags);
+
+// publishes the axes together with cycle counter and timestamp, never blocks
+static inline void mk_axes_write(struct mk_axes_shm* shm, const struct mk_axes* src, uint64_t cycle, uint64_t stamp)
+{
+	mk_shm_write(&shm->hdr, &shm->data, src, sizeof(*src), cycle, stamp);
+}
+
+// copies a consistent snapshot of the axes, see mk_shm_read
+static inline uint32_t mk_axes_read(const struct mk_axes_shm* shm, struct mk_axes* dst, uint64_t* cycle, uint64_t* stamp)
+{
+	return mk_shm_read(&shm->hdr, dst, &shm->data, sizeof(*dst), cycle, stamp);
+}
+
+// returns the mask of the axes which are faulty or at a hard limit
+static inline uint32_t mk_axes_alarms(const struct mk_axes* axes)
+{
+	return (axes->fault | axes->hardneg | axes->hardpos) & MK_AXESMASK;
+}
+
+// returns true if all axes of mask are enabled and none of them has an alarm
+static inline bool mk_axes_ready(const struct mk_axes* axes, uint32_t mask)
+{
+	return ((axes->enable & mask) == mask) && !(mk_axes_alarms(axes) & mask);
+}
+
+/* Computes the following errors pos_set - pos_cur of all axes into err and returns the largest absolute one
+ *
+ * err has to hold MK_AXES_STRIDE elements.
+ */
+double mk_axes_ferror(const struct mk_axes* axes, double* err);
+
+// returns the mask of the axes whose absolute following error exceeds limit in mm
+uint32_t mk_axes_overlimit(const struct mk_axes* axes, double limit);
+
+// prints the variables of all axes with label and unit, at describes the time of the sample
+void mk_axes_fprint(FILE* file, const struct mk_axes* axes, const char* at);
+
+#endif /* _MK_SHMAXES_H_ */
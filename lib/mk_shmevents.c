@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Event detector and event queue of the shared memories (libmkshm) */
+
+#include "mk_shmevents.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char* typenames[MK_EVENT_TYPECNT] = {
+        "Following error exceeded",
+        "Position rate exceeded",
+        "Drive faulty",
+        "At hard limit",
+        "Emergency stop activated",
+};
+
+/* Returns the slot at a position of the event queue */
+static inline struct mk_eventslot* slotat(const struct mk_eventq* q, uint64_t pos)
+{
+        return (struct mk_eventslot*) (q + 1) + (pos & (q->depth - 1));
+}
+
+struct mk_eventq* mk_events_attach(struct mk_shm* shm, uint32_t inst, uint32_t depth, int flags)
+{
+        char name[64];
+        struct mk_eventq* q;
+        uint32_t i;
+
+        mk_shm_instkey(name,sizeof(name),MK_EVENTSKEY,inst);
+        if (flags & MK_SHM_WRITER) {
+                if ((depth == 0) || (depth > MK_EVENTS_MAXDEPTH) || (depth & (depth - 1))) {
+                        fprintf(stderr,"Event queue depth %u is not a power of two up to %u\n",depth,MK_EVENTS_MAXDEPTH);
+                        return(NULL);
+                }
+                q = mk_shm_attachname(shm,name,sizeof(*q) + (size_t) depth * sizeof(struct mk_eventslot),flags);
+                if (NULL == q)
+                        return(NULL);
+                mk_shm_writebegin(&q->hdr);
+                q->depth = depth;
+                q->dropped = 0;
+                q->tail = 0;
+                q->head = 0;
+                for (i = 0; i < depth; i++)
+                        slotat(q,i)->seq = i;
+                mk_shm_writeend(&q->hdr);
+                return q;
+        }
+
+        // a producer takes the depth from the existing event queue
+        q = mk_shm_attachname(shm,name,0,flags);
+        if (NULL == q)
+                return(NULL);
+        if ((shm->size < sizeof(*q)) || (q->depth == 0) || (q->depth & (q->depth - 1)) ||
+            (sizeof(*q) + (size_t) q->depth * sizeof(struct mk_eventslot) > shm->size)) {
+                fprintf(stderr,"Event queue %s has an invalid layout\n",name);
+                mk_shm_detach(shm);
+                return(NULL);
+        }
+        return q;
+}
+
+int mk_events_push(struct mk_eventq* q, const struct mk_event* ev)
+{
+        struct mk_eventslot* slot;
+        uint64_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        int64_t dif;
+
+        for (;;) {
+                slot = slotat(q,pos);
+                dif = (int64_t) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+                if (dif == 0) {
+                        // the slot is free, claim the position
+                        if (__atomic_compare_exchange_n(&q->tail,&pos,pos + 1,true,__ATOMIC_RELAXED,__ATOMIC_RELAXED))
+                                break;
+                } else if (dif < 0) {
+                        // the consumer did not pop the event of the previous round yet
+                        __atomic_fetch_add(&q->dropped, 1, __ATOMIC_RELAXED);
+                        return -1;
+                } else {
+                        // another producer claimed the position meanwhile
+                        pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+                }
+        }
+        slot->ev = *ev;
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+        // seq of the header stays even and only serves as notification word
+        __atomic_fetch_add(&q->hdr.seq, 2, __ATOMIC_RELEASE);
+        mk_shm_notify(&q->hdr);
+        return 0;
+}
+
+bool mk_events_pop(struct mk_eventq* q, struct mk_event* ev)
+{
+        uint64_t pos = q->head;
+        struct mk_eventslot* slot = slotat(q,pos);
+
+        // empty or the producer of the oldest event did not publish it yet
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+                return false;
+        *ev = slot->ev;
+        __atomic_store_n(&slot->seq, pos + q->depth, __ATOMIC_RELEASE);
+        __atomic_store_n(&q->head, pos + 1, __ATOMIC_RELAXED);
+        return true;
+}
+
+const char* mk_events_typename(enum mk_eventtype type)
+{
+        if (type >= MK_EVENT_TYPECNT)
+                return "Unknown event";
+        return typenames[type];
+}
+
+void mk_events_fprint(FILE* file, const struct mk_event* ev)
+{
+        char axis[16] = "";
+
+        if (ev->type != MK_EVENT_ESTOP)
+                snprintf(axis,sizeof(axis),"%c-Axis ",'X' + ev->axis);
+        fprintf(file, "Instance %u, cycle %llu: %s%s %s (value: %f; limit: %f; detected after %lld ns by process %u)\n",
+                ev->inst, (unsigned long long) ev->cycle, axis, mk_events_typename(ev->type),
+                ev->active ? "raised" : "cleared", ev->value, ev->limit,
+                (long long) (ev->detected - ev->stamp), ev->source);
+}
+
+void mk_detector_init(struct mk_detector* det, const struct mk_detlimits* limits, uint32_t inst)
+{
+        memset(det,0,sizeof(*det));
+        det->limits = *limits;
+        det->inst = inst;
+        det->source = getpid();
+}
+
+/* Pushes an event if a condition of an axis started or ended, returns 1 if it did */
+static uint32_t edge(struct mk_detector* det, struct mk_eventq* q, struct mk_event* ev, enum mk_eventtype type,
+                uint32_t axis, bool cond, double value, double limit)
+{
+        uint32_t bit = 1U << axis;
+
+        if (cond == !!(det->active[type] & bit))
+                return 0;
+        det->active[type] ^= bit;
+        ev->detected = mk_shm_taitime();
+        ev->type = type;
+        ev->axis = axis;
+        ev->active = cond;
+        ev->value = value;
+        ev->limit = limit;
+        det->events++;
+        if (mk_events_push(q,ev) == -1)
+                det->dropped++;
+        return 1;
+}
+
+uint32_t mk_detector_run(struct mk_detector* det, struct mk_eventq* q, uint64_t cycle, uint64_t stamp,
+                const struct mk_mainoutput* mainout, const struct mk_additionaloutput* addout, const struct mk_maininput* mainin)
+{
+        const struct mk_detlimits* lim = &det->limits;
+        struct mk_event ev;
+        double set[MK_EVENTS_AXES];
+        double cur[MK_EVENTS_AXES];
+        double err;
+        double rate;
+        double dt = 0.0;
+        uint32_t n = 0;
+        uint32_t i;
+
+        memset(&ev,0,sizeof(ev));
+        ev.cycle = cycle;
+        ev.stamp = stamp;
+        ev.inst = det->inst;
+        ev.source = det->source;
+
+        if (NULL != mainin) {
+                cur[0] = mainin->xpos_cur;
+                cur[1] = mainin->ypos_cur;
+                cur[2] = mainin->zpos_cur;
+                if ((det->laststamp != 0) && (stamp > det->laststamp))
+                        dt = (stamp - det->laststamp) / 1e9;
+                for (i = 0; i < MK_EVENTS_AXES; i++) {
+                        if ((dt > 0.0) && (lim->rate[i] > 0.0)) {
+                                rate = (cur[i] - det->lastpos[i]) / dt;
+                                n += edge(det,q,&ev,MK_EVENT_RATE,i,fabs(rate) > lim->rate[i],rate,lim->rate[i]);
+                        }
+                        det->lastpos[i] = cur[i];
+                }
+                det->laststamp = stamp;
+                n += edge(det,q,&ev,MK_EVENT_FAULT,0,mainin->xfault,mainin->xfault,0.0);
+                n += edge(det,q,&ev,MK_EVENT_FAULT,1,mainin->yfault,mainin->yfault,0.0);
+                n += edge(det,q,&ev,MK_EVENT_FAULT,2,mainin->zfault,mainin->zfault,0.0);
+        }
+        if ((NULL != addout) && (NULL != mainin)) {
+                set[0] = addout->xpos_set;
+                set[1] = addout->ypos_set;
+                set[2] = addout->zpos_set;
+                for (i = 0; i < MK_EVENTS_AXES; i++) {
+                        if (lim->ferror[i] <= 0.0)
+                                continue;
+                        err = set[i] - cur[i];
+                        n += edge(det,q,&ev,MK_EVENT_FERROR,i,fabs(err) > lim->ferror[i],err,lim->ferror[i]);
+                }
+        }
+        if (NULL != addout) {
+                // value -1 at the negative, 1 at the positive hard limit
+                n += edge(det,q,&ev,MK_EVENT_HARDLIMIT,0,addout->xhardneg || addout->xhardpos,
+                        (double) addout->xhardpos - (double) addout->xhardneg,0.0);
+                n += edge(det,q,&ev,MK_EVENT_HARDLIMIT,1,addout->yhardneg || addout->yhardpos,
+                        (double) addout->yhardpos - (double) addout->yhardneg,0.0);
+                n += edge(det,q,&ev,MK_EVENT_HARDLIMIT,2,addout->zhardneg || addout->zhardpos,
+                        (double) addout->zhardpos - (double) addout->zhardneg,0.0);
+        }
+        if (NULL != mainout)
+                n += edge(det,q,&ev,MK_EVENT_ESTOP,0,mainout->estopstatus,mainout->estopstatus,0.0);
+        return n;
+}
@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Event detector and event queue of the shared memories (libmkshm)
+ *
+ * The detector is run with every sample of the writer and checks per axis
+ * the following error xpos_set - xpos_cur against a threshold, the rate of
+ * change of the actual position against a limit and watches the transitions
+ * of the drive faults, the hard limits and the emergency stop. Every start
+ * and end of a condition is pushed as timestamped event into the event
+ * queue, so an alarm reaches the consumer one cycle after the writer
+ * published it, independent of the polling period of the consumer.
+ *
+ * The event queue is the shared memory MK_EVENTS (MK_EVENTS.n of instance n)
+ * with a fixed number of slots. It is created and owned by its consumer
+ * (MK_SHM_WRITER), producers attach it with MK_SHM_SHARED. Any number of
+ * producers push events lock-free: a producer claims a position with a
+ * compare-and-swap of tail and publishes the slot with its sequence number,
+ * the consumer pops the slots in order. Neither side allocates or blocks, a
+ * full queue drops the event and counts it. seq of the header is incremented
+ * by 2 on every push, so the consumer can wait for events with mk_shm_wait.
+ * A producer which terminates between claiming and publishing a slot stalls
+ * the queue at that slot, producers have to attach again when the consumer
+ * is restarted.
+ */
+
+#ifndef _MK_SHMEVENTS_H_
+#define _MK_SHMEVENTS_H_
+
+#include "mk_shmlib.h"
+#include <stdio.h>
+
+#define MK_EVENTSKEY "MK_EVENTS"
+// maximum number of slots of the event queue
+#define MK_EVENTS_MAXDEPTH (1 << 16)
+// axes checked by the detector, X, Y and Z of the interface
+#define MK_EVENTS_AXES 3
+
+// types of events
+enum mk_eventtype {
+	MK_EVENT_FERROR = 0,	//following error of an axis exceeds the limit
+	MK_EVENT_RATE,		//actual position of an axis changes faster than the limit
+	MK_EVENT_FAULT,		//drive of an axis is faulty
+	MK_EVENT_HARDLIMIT,	//axis is at a hard limit
+	MK_EVENT_ESTOP,		//emergency stop is activated
+	MK_EVENT_TYPECNT
+};
+
+// event
+struct mk_event {
+	uint64_t cycle;		//cycle counter of the writer of the sample
+	uint64_t stamp;		//CLOCK_TAI timestamp of the sample of the writer in ns
+	uint64_t detected;	//CLOCK_TAI timestamp of the detection in ns
+	double value;		//value of the condition, e.g. the following error in mm, 1 or -1 for flags
+	double limit;		//limit of the value, 0 for flags
+	uint16_t type;		//enum mk_eventtype
+	uint8_t axis;		//axis 0 (X) to 2 (Z), 0 if the event does not belong to an axis
+	uint8_t active;		//1 when the condition starts, 0 when it ends
+	uint32_t inst;		//instance of the interface
+	uint32_t source;	//process id of the producer
+	uint32_t reserved;
+};
+
+// slot of the event queue
+struct mk_eventslot {
+	uint64_t seq;		//position + 1 once the event is published, position + depth once it is popped
+	struct mk_event ev;
+};
+
+// header of the event queue shared memory, followed by depth slots
+struct mk_eventq {
+	struct mk_shmhdr hdr;
+	uint32_t depth;		//number of slots, power of two
+	uint32_t reserved;
+	uint64_t dropped;	//events not queued because the queue was full
+	uint64_t tail __attribute__((aligned(64)));	//next position claimed by a producer
+	uint64_t head __attribute__((aligned(64)));	//next position popped by the consumer
+};
+
+/* Attaches the event queue of an instance of the interface
+ *
+ * The consumer attaches with MK_SHM_WRITER and creates the queue with the
+ * given depth (power of two), producers attach with MK_SHM_SHARED and pass 0.
+ */
+struct mk_eventq* mk_events_attach(struct mk_shm* shm, uint32_t inst, uint32_t depth, int flags);
+
+// pushes an event and notifies the consumer, never blocks, returns 0 or -1 if the queue is full
+int mk_events_push(struct mk_eventq* q, const struct mk_event* ev);
+
+// pops the oldest event, consumer only, returns false if there is none
+bool mk_events_pop(struct mk_eventq* q, struct mk_event* ev);
+
+// returns a description of a type of events
+const char* mk_events_typename(enum mk_eventtype type);
+
+// prints an event in one line
+void mk_events_fprint(FILE* file, const struct mk_event* ev);
+
+// limits of the detector, a limit of 0 disables the check
+struct mk_detlimits {
+	double ferror[MK_EVENTS_AXES];	//maximum absolute following error in mm
+	double rate[MK_EVENTS_AXES];	//maximum absolute rate of change of the actual position in mm/s
+};
+
+// detector of one instance of the interface, run by one thread
+struct mk_detector {
+	struct mk_detlimits limits;
+	uint32_t inst;
+	uint32_t source;		//process id
+	uint32_t active[MK_EVENT_TYPECNT];	//conditions which are active, bit per axis
+	double lastpos[MK_EVENTS_AXES];	//actual positions of the previous sample
+	uint64_t laststamp;		//timestamp of the previous sample, 0 if none
+	uint64_t events;		//events detected
+	uint64_t dropped;		//events not queued because the queue was full
+};
+
+// resets the detector
+void mk_detector_init(struct mk_detector* det, const struct mk_detlimits* limits, uint32_t inst);
+
+/* Checks a sample of the writer and pushes the events into the queue, returns the number of detected events
+ *
+ * The structs are in wire format, a shared memory which is not sampled is
+ * passed as NULL. The following errors need MK_ADDOUT and MK_MAININ, rates
+ * and faults MK_MAININ, hard limits MK_ADDOUT and the emergency stop
+ * MK_MAINOUT.
+ */
+uint32_t mk_detector_run(struct mk_detector* det, struct mk_eventq* q, uint64_t cycle, uint64_t stamp,
+		const struct mk_mainoutput* mainout, const struct mk_additionaloutput* addout, const struct mk_maininput* mainin);
+
+#endif /* _MK_SHMEVENTS_H_ */
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Client of the fan-out daemon (libmkshm) */
+
+#include "mk_shmfanout.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int mk_fanout_connect(const char* path, uint32_t segments, uint32_t interval, struct mk_fanout_hello* hello)
+{
+        struct sockaddr_un addr;
+        struct mk_fanout_hello h;
+        ssize_t n;
+        int fd;
+
+        memset(&addr,0,sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+                fprintf(stderr,"Fanout socket path %s is too long\n",path);
+                return -1;
+        }
+        strcpy(addr.sun_path,path);
+
+        fd = socket(AF_UNIX,SOCK_SEQPACKET | SOCK_CLOEXEC,0);
+        if (fd == -1) {
+                perror("Fanout socket failed");
+                return -1;
+        }
+        if (connect(fd,(struct sockaddr*) &addr,sizeof(addr)) == -1) {
+                perror("Fanout connect failed");
+                close(fd);
+                return -1;
+        }
+        do {
+                n = recv(fd,&h,sizeof(h),0);
+        } while ((n == -1) && (errno == EINTR));
+        if (n != sizeof(h) || (h.type != MK_FANOUT_HELLO) || (h.magic != MK_FANOUT_MAGIC)) {
+                fprintf(stderr,"Fanout daemon at %s did not send a valid hello\n",path);
+                close(fd);
+                return -1;
+        }
+        if (h.version != MK_FANOUT_VERSION) {
+                fprintf(stderr,"Fanout daemon at %s has protocol version %u, expected %u\n",path,h.version,MK_FANOUT_VERSION);
+                close(fd);
+                return -1;
+        }
+        if ((h.layout != MK_SHM_LAYOUT_VERSION) || (h.hash != MK_SHM_LAYOUT_HASH)) {
+                fprintf(stderr,"Fanout daemon at %s has layout %u/%08x, expected %u/%08x\n",path,h.layout,h.hash,MK_SHM_LAYOUT_VERSION,MK_SHM_LAYOUT_HASH);
+                close(fd);
+                return -1;
+        }
+        if (mk_fanout_subscribe(fd,segments,interval) == -1) {
+                close(fd);
+                return -1;
+        }
+        if (NULL != hello)
+                *hello = h;
+        return fd;
+}
+
+int mk_fanout_subscribe(int fd, uint32_t segments, uint32_t interval)
+{
+        struct mk_fanout_sub sub;
+
+        memset(&sub,0,sizeof(sub));
+        sub.type = MK_FANOUT_SUBSCRIBE;
+        sub.segments = segments;
+        sub.interval = interval;
+        if (send(fd,&sub,sizeof(sub),MSG_NOSIGNAL) != sizeof(sub)) {
+                perror("Fanout subscribe failed");
+                return -1;
+        }
+        return 0;
+}
+
+int mk_fanout_recv(int fd, struct mk_fanout_sample* sample)
+{
+        ssize_t n;
+
+        for (;;) {
+                n = recv(fd,sample,sizeof(*sample),0);
+                if (n == 0)
+                        return 0;
+                if (n == -1)
+                        return -1;
+                // skip messages of other types and truncated samples
+                if ((n >= (ssize_t) sizeof(sample->hdr)) && (sample->hdr.type == MK_FANOUT_SAMPLE) &&
+                    (sample->hdr.seg < MK_SHM_SEGCNT) && (sample->hdr.size == mk_shm_datasize(sample->hdr.seg)) &&
+                    ((size_t) n == sizeof(sample->hdr) + sample->hdr.size))
+                        return 1;
+        }
+}
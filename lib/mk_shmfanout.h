@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Protocol and client of the fan-out daemon (libmkshm)
+ *
+ * The fan-out daemon (demo/demofanout.c) is the only process reading the
+ * shared memories, it samples them once per cycle and pushes every update to
+ * its clients over a unix domain socket of type SOCK_SEQPACKET, so each
+ * message is one sample. After connecting, a client receives a hello message
+ * with the layout of the daemon and sends a subscription with the shared
+ * memories it wants and the minimum interval between two samples of the same
+ * shared memory. It may send a new subscription at any time. Rate limited
+ * clients always get the latest sample. A client which does not keep up
+ * loses samples, which it can see in the cycle counters.
+ */
+
+#ifndef _MK_SHMFANOUT_H_
+#define _MK_SHMFANOUT_H_
+
+#include "mk_shmlib.h"
+
+#define MK_FANOUT_MAGIC 0x4e46534d	// "MSFN"
+#define MK_FANOUT_VERSION 1
+// default path of the socket of the daemon
+#define MK_FANOUT_PATH "/tmp/mk_shmfanout.sock"
+
+// types of the messages
+enum mk_fanout_type {
+	MK_FANOUT_HELLO = 1,	//daemon to client, once after connecting
+	MK_FANOUT_SUBSCRIBE,	//client to daemon
+	MK_FANOUT_SAMPLE	//daemon to client, one per update of a shared memory
+};
+
+// first message of the daemon
+struct mk_fanout_hello {
+	uint16_t type;		//MK_FANOUT_HELLO
+	uint16_t reserved;
+	uint32_t magic;		//MK_FANOUT_MAGIC
+	uint32_t version;	//MK_FANOUT_VERSION
+	uint32_t layout;	//MK_SHM_LAYOUT_VERSION of the daemon
+	uint32_t hash;		//MK_SHM_LAYOUT_HASH of the daemon
+	uint32_t segments;	//shared memories sampled by the daemon, bit (1 << enum mk_shmseg)
+	uint32_t period;	//sampling period of the daemon in us
+};
+
+// subscription of a client
+struct mk_fanout_sub {
+	uint16_t type;		//MK_FANOUT_SUBSCRIBE
+	uint16_t reserved;
+	uint32_t segments;	//wanted shared memories, bit (1 << enum mk_shmseg)
+	uint32_t interval;	//minimum interval between two samples in us, 0 for every update
+};
+
+// header of a sample, followed by the struct in wire format
+struct mk_fanout_msghdr {
+	uint16_t type;		//MK_FANOUT_SAMPLE
+	uint16_t seg;		//enum mk_shmseg
+	uint32_t size;		//size of the struct in wire format
+	uint64_t cycle;		//cycle counter of the writer
+	uint64_t stamp;		//CLOCK_TAI timestamp of the writer in ns
+};
+
+// a received sample
+struct mk_fanout_sample {
+	struct mk_fanout_msghdr hdr;
+	union {
+		struct mk_mainoutput mainout;
+		struct mk_maininput mainin;
+		struct mk_additionaloutput addout;
+	} data;
+};
+
+/* Connects to the daemon and subscribes, returns the socket or -1 on error
+ *
+ * The hello message of the daemon is stored in hello, which may be NULL. The
+ * connection is refused if the daemon was built with a different layout.
+ */
+int mk_fanout_connect(const char* path, uint32_t segments, uint32_t interval, struct mk_fanout_hello* hello);
+
+// changes the subscription, returns 0 or -1 on error
+int mk_fanout_subscribe(int fd, uint32_t segments, uint32_t interval);
+
+// receives the next sample, blocks unless the socket is non-blocking, returns 1, 0 if the daemon closed the connection or -1 on error
+int mk_fanout_recv(int fd, struct mk_fanout_sample* sample);
+
+#endif /* _MK_SHMFANOUT_H_ */
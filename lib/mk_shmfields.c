@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Field descriptors of the shared memories (libmkshm) */
+
+#include "mk_shmfields.h"
+#include <stdint.h>
+#include <string.h>
+
+// variables printed in one line by mk_shm_fprint
+#define MK_FIELDS_PERLINE 4
+
+#define MK_FIELD_TYPEOF(var) _Generic((var), double: MK_FIELD_DOUBLE, bool: MK_FIELD_BOOL, \
+        int32_t: MK_FIELD_INT32, uint32_t: MK_FIELD_UINT32, uint8_t: MK_FIELD_UINT8)
+#define MK_FIELD_DESC(wire, type, name, unit, label) \
+        { #name, label, unit, MK_FIELD_TYPEOF(((struct wire*) 0)->name), sizeof(type), offsetof(struct wire, name) },
+#define MK_FIELD_DESC_MAINOUT(type, name, block, unit, label) MK_FIELD_DESC(mk_mainoutput, type, name, unit, label)
+#define MK_FIELD_DESC_ADDOUT(type, name, block, unit, label) MK_FIELD_DESC(mk_additionaloutput, type, name, unit, label)
+#define MK_FIELD_DESC_MAININ(type, name, block, unit, label) MK_FIELD_DESC(mk_maininput, type, name, unit, label)
+
+static const struct mk_field mainoutfields[] = {
+        MK_MAINOUTPUT_FIELDS(MK_FIELD_DESC_MAINOUT)
+};
+
+static const struct mk_field maininfields[] = {
+        MK_MAININPUT_FIELDS(MK_FIELD_DESC_MAININ)
+};
+
+static const struct mk_field addoutfields[] = {
+        MK_ADDITIONALOUTPUT_FIELDS(MK_FIELD_DESC_ADDOUT)
+};
+
+static const struct mk_fieldset fieldsets[MK_SHM_SEGCNT] = {
+        [MK_SHM_MAINOUT] = { "Main Output Variables", mainoutfields, sizeof(mainoutfields) / sizeof(mainoutfields[0]), sizeof(struct mk_mainoutput) },
+        [MK_SHM_MAININ] = { "Main Input Variables", maininfields, sizeof(maininfields) / sizeof(maininfields[0]), sizeof(struct mk_maininput) },
+        [MK_SHM_ADDOUT] = { "Additional Output Variables", addoutfields, sizeof(addoutfields) / sizeof(addoutfields[0]), sizeof(struct mk_additionaloutput) },
+};
+
+const struct mk_fieldset* mk_shm_fields(enum mk_shmseg seg)
+{
+        if ((unsigned) seg >= MK_SHM_SEGCNT)
+                return NULL;
+        return &fieldsets[seg];
+}
+
+const struct mk_field* mk_field_find(enum mk_shmseg seg, const char* name)
+{
+        const struct mk_fieldset* set = mk_shm_fields(seg);
+        uint32_t i;
+        if (NULL == set)
+                return NULL;
+        for (i = 0; i < set->count; i++)
+                if (strcmp(set->fields[i].name, name) == 0)
+                        return &set->fields[i];
+        return NULL;
+}
+
+double mk_field_value(const struct mk_field* field, const void* wire)
+{
+        const char* p = (const char*) wire + field->offset;
+        double d;
+        int32_t i;
+        uint32_t u;
+        // the wire format is packed, the variables may be unaligned
+        switch (field->type) {
+        case MK_FIELD_DOUBLE:
+                memcpy(&d, p, sizeof(d));
+                return d;
+        case MK_FIELD_INT32:
+                memcpy(&i, p, sizeof(i));
+                return i;
+        case MK_FIELD_UINT32:
+                memcpy(&u, p, sizeof(u));
+                return u;
+        case MK_FIELD_BOOL:
+                return *(const bool*) p ? 1.0 : 0.0;
+        default:
+                return *(const uint8_t*) p;
+        }
+}
+
+int mk_field_format(char* buf, size_t len, const struct mk_field* field, const void* wire)
+{
+        const char* p = (const char*) wire + field->offset;
+        double d;
+        int32_t i;
+        uint32_t u;
+        switch (field->type) {
+        case MK_FIELD_DOUBLE:
+                memcpy(&d, p, sizeof(d));
+                return snprintf(buf, len, "%f", d);
+        case MK_FIELD_INT32:
+                memcpy(&i, p, sizeof(i));
+                return snprintf(buf, len, "%d", i);
+        case MK_FIELD_UINT32:
+                memcpy(&u, p, sizeof(u));
+                return snprintf(buf, len, "%u", u);
+        case MK_FIELD_BOOL:
+                return snprintf(buf, len, "%s", *(const bool*) p ? "true" : "false");
+        default:
+                return snprintf(buf, len, "%u", *(const uint8_t*) p);
+        }
+}
+
+void mk_shm_fprint(FILE* file, enum mk_shmseg seg, const void* wire, const char* at)
+{
+        const struct mk_fieldset* set = mk_shm_fields(seg);
+        char value[32];
+        char entry[96];
+        uint32_t i;
+
+        if (NULL == set)
+                return;
+        fprintf(file, "\n##### %s: (%s) #####\n", set->title, at);
+        for (i = 0; i < set->count; i++) {
+                mk_field_format(value, sizeof(value), &set->fields[i], wire);
+                snprintf(entry, sizeof(entry), "%s: %s%s%s;", set->fields[i].label, value,
+                        set->fields[i].unit[0] ? " " : "", set->fields[i].unit);
+                if (((i + 1) % MK_FIELDS_PERLINE == 0) || (i + 1 == set->count))
+                        fprintf(file, "%s\n", entry);
+                else
+                        fprintf(file, "%-44s", entry);
+        }
+}
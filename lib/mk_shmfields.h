@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Field descriptors of the shared memories (libmkshm)
+ *
+ * Name, label, unit, type, size and wire format offset of every variable,
+ * generated from the field tables in mk_shminterface.h. Consumers which
+ * format, filter or convert variables iterate over the descriptors instead
+ * of naming every variable, so they pick up new variables without changes.
+ */
+
+#ifndef _MK_SHMFIELDS_H_
+#define _MK_SHMFIELDS_H_
+
+#include "mk_shmlib.h"
+#include <stdio.h>
+
+// types of the variables
+enum mk_fieldtype {
+	MK_FIELD_DOUBLE = 0,
+	MK_FIELD_BOOL,
+	MK_FIELD_INT32,
+	MK_FIELD_UINT32,
+	MK_FIELD_UINT8
+};
+
+// descriptor of a variable
+struct mk_field {
+	const char* name;	//name of the variable in the structs
+	const char* label;	//human readable name
+	const char* unit;	//unit, empty if none
+	uint16_t type;		//enum mk_fieldtype
+	uint16_t size;		//size in bytes
+	uint32_t offset;	//offset in the wire format
+};
+
+// descriptors of all variables of a shared memory
+struct mk_fieldset {
+	const char* title;		//human readable name of the struct of variables
+	const struct mk_field* fields;
+	uint32_t count;			//number of variables
+	uint32_t wiresize;		//size of the struct in wire format
+};
+
+// returns the descriptors of the variables of a shared memory
+const struct mk_fieldset* mk_shm_fields(enum mk_shmseg seg);
+
+// returns the descriptor of a variable by name or NULL if there is none
+const struct mk_field* mk_field_find(enum mk_shmseg seg, const char* name);
+
+// returns the value of a variable of a struct in wire format as double
+double mk_field_value(const struct mk_field* field, const void* wire);
+
+// formats the value of a variable of a struct in wire format into buf, returns the result of snprintf
+int mk_field_format(char* buf, size_t len, const struct mk_field* field, const void* wire);
+
+// prints all variables of a struct in wire format with label and unit, at describes the time of the sample
+void mk_shm_fprint(FILE* file, enum mk_shmseg seg, const void* wire, const char* at);
+
+#endif /* _MK_SHMFIELDS_H_ */
@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Log-linear histogram for latency measurements (libmkshm) */
+
+#include "mk_shmhist.h"
+#include <stdbool.h>
+#include <string.h>
+
+/* Returns the bucket of a value */
+static inline uint32_t bucketof(uint64_t value)
+{
+        uint32_t msb;
+        if (value < MK_HIST_SUB)
+                return value;
+        if (value >= (1ULL << MK_HIST_MAXBITS))
+                value = (1ULL << MK_HIST_MAXBITS) - 1;
+        msb = 63 - __builtin_clzll(value);
+        return (msb - MK_HIST_SUBBITS + 1) * MK_HIST_SUB + (value >> (msb - MK_HIST_SUBBITS)) - MK_HIST_SUB;
+}
+
+/* Returns the highest value counted in a bucket */
+static inline uint64_t bucketmax(uint32_t bucket)
+{
+        uint32_t group = bucket / MK_HIST_SUB;
+        uint64_t sub = bucket % MK_HIST_SUB;
+        if (group == 0)
+                return sub;
+        return ((MK_HIST_SUB + sub + 1) << (group - 1)) - 1;
+}
+
+void mk_hist_init(struct mk_hist* hist)
+{
+        memset(hist,0,sizeof(*hist));
+        hist->min = UINT64_MAX;
+}
+
+void mk_hist_record(struct mk_hist* hist, uint64_t value)
+{
+        uint64_t cur;
+        __atomic_fetch_add(&hist->buckets[bucketof(value)], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+        cur = __atomic_load_n(&hist->min, __ATOMIC_RELAXED);
+        while ((value < cur) && !__atomic_compare_exchange_n(&hist->min, &cur, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        cur = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+        while ((value > cur) && !__atomic_compare_exchange_n(&hist->max, &cur, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELEASE);
+}
+
+void mk_hist_merge(struct mk_hist* dst, const struct mk_hist* src)
+{
+        uint32_t i;
+        if (src->count == 0)
+                return;
+        for (i = 0; i < MK_HIST_BUCKETS; i++)
+                dst->buckets[i] += src->buckets[i];
+        dst->sum += src->sum;
+        if (src->min < dst->min)
+                dst->min = src->min;
+        if (src->max > dst->max)
+                dst->max = src->max;
+        dst->count += src->count;
+}
+
+uint64_t mk_hist_percentile(const struct mk_hist* hist, double percent)
+{
+        uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_ACQUIRE);
+        uint64_t rank;
+        uint64_t seen = 0;
+        uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+        uint32_t i;
+
+        if (count == 0)
+                return 0;
+        rank = (uint64_t) (percent / 100.0 * count + 0.5);
+        if (rank < 1)
+                rank = 1;
+        for (i = 0; i < MK_HIST_BUCKETS; i++) {
+                seen += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+                if (seen >= rank)
+                        return bucketmax(i) < max ? bucketmax(i) : max;
+        }
+        return max;
+}
+
+void mk_hist_print(const struct mk_hist* hist, FILE* file, const char* name)
+{
+        uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_ACQUIRE);
+        if (count == 0) {
+                fprintf(file,"%s: no samples\n",name);
+                return;
+        }
+        fprintf(file,"%s: count %llu; min %llu; mean %llu; p50 %llu; p99 %llu; p99.9 %llu; max %llu\n",name,
+                (unsigned long long) count,
+                (unsigned long long) hist->min,
+                (unsigned long long) (hist->sum / count),
+                (unsigned long long) mk_hist_percentile(hist,50.0),
+                (unsigned long long) mk_hist_percentile(hist,99.0),
+                (unsigned long long) mk_hist_percentile(hist,99.9),
+                (unsigned long long) hist->max);
+}
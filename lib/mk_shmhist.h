@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Log-linear histogram for latency measurements (libmkshm)
+ *
+ * Values (usually ns) are counted in buckets whose width grows with the value:
+ * every power of two is split into MK_HIST_SUB linear sub-buckets, so the
+ * relative error of a reported percentile is below 1/MK_HIST_SUB. Recording is
+ * lock-free and never allocates, so it can be used in a cyclic loop while
+ * another thread or a signal triggered dump reads the histogram.
+ */
+
+#ifndef _MK_SHMHIST_H_
+#define _MK_SHMHIST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define MK_HIST_SUBBITS 5
+#define MK_HIST_SUB (1 << MK_HIST_SUBBITS)
+// values are clamped to 2^MK_HIST_MAXBITS - 1, about 18 minutes in ns
+#define MK_HIST_MAXBITS 40
+#define MK_HIST_BUCKETS ((MK_HIST_MAXBITS - MK_HIST_SUBBITS + 1) * MK_HIST_SUB)
+
+struct mk_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[MK_HIST_BUCKETS];
+};
+
+// resets the histogram
+void mk_hist_init(struct mk_hist* hist);
+
+// records one value
+void mk_hist_record(struct mk_hist* hist, uint64_t value);
+
+// adds the values recorded in src to dst, e.g. to combine the histograms of several processes
+void mk_hist_merge(struct mk_hist* dst, const struct mk_hist* src);
+
+// returns the value below which the given percentage of the recorded values lie
+uint64_t mk_hist_percentile(const struct mk_hist* hist, double percent);
+
+// prints count, min, mean, p50, p99, p99.9 and max of the histogram in one line
+void mk_hist_print(const struct mk_hist* hist, FILE* file, const char* name);
+
+#endif /* _MK_SHMHIST_H_ */
@@ -0,0 +1,601 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Common functions to access the Shared-Memory-Interface (libmkshm) */
+
+#include "mk_shmlib.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <limits.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <errno.h>
+
+static const char* const segnames[MK_SHM_SEGCNT] = {
+        [MK_SHM_MAINOUT] = MK_MAINOUTKEY,
+        [MK_SHM_MAININ] = MK_MAININKEY,
+        [MK_SHM_ADDOUT] = MK_ADDAOUTKEY,
+};
+
+static const size_t segsizes[MK_SHM_SEGCNT] = {
+        [MK_SHM_MAINOUT] = sizeof(struct mk_mainoutput_shm),
+        [MK_SHM_MAININ] = sizeof(struct mk_maininput_shm),
+        [MK_SHM_ADDOUT] = sizeof(struct mk_additionaloutput_shm),
+};
+
+static const size_t datasizes[MK_SHM_SEGCNT] = {
+        [MK_SHM_MAINOUT] = sizeof(struct mk_mainoutput),
+        [MK_SHM_MAININ] = sizeof(struct mk_maininput),
+        [MK_SHM_ADDOUT] = sizeof(struct mk_additionaloutput),
+};
+
+// order in which a writer publishes the shared memories of a cycle
+static const enum mk_shmseg puborder[MK_SHM_SEGCNT] = {
+        MK_SHM_MAINOUT,
+        MK_SHM_ADDOUT,
+        MK_SHM_MAININ,
+};
+
+/* Writable mappings of the headers, looked up by mk_shm_wait through the address of the header
+ *
+ * Waiting readers count themselves in waiters of the header, but readers map
+ * the shared memory read-only. Their header is mapped a second time
+ * writable on its own (len > 0), writable mappings are used directly (len 0).
+ * Readers without write permission have none and are only woken by the
+ * timeout of mk_shm_wait or together with other readers.
+ */
+#define MK_SHM_CTLMAX 256
+
+static struct {
+        const struct mk_shmhdr* hdr;
+        struct mk_shmhdr* ctl;
+        size_t len;
+} ctls[MK_SHM_CTLMAX];
+
+static void addctl(const struct mk_shmhdr* hdr, struct mk_shmhdr* ctl, size_t len)
+{
+        int i;
+        for (i = 0; i < MK_SHM_CTLMAX; i++) {
+                if (NULL == ctls[i].hdr) {
+                        ctls[i].ctl = ctl;
+                        ctls[i].len = len;
+                        __atomic_store_n(&ctls[i].hdr, hdr, __ATOMIC_RELEASE);
+                        return;
+                }
+        }
+        if (len > 0)
+                munmap(ctl,len);
+}
+
+static struct mk_shmhdr* findctl(const struct mk_shmhdr* hdr)
+{
+        int i;
+        for (i = 0; i < MK_SHM_CTLMAX; i++) {
+                if (__atomic_load_n(&ctls[i].hdr, __ATOMIC_ACQUIRE) == hdr)
+                        return ctls[i].ctl;
+        }
+        return NULL;
+}
+
+static void delctl(const struct mk_shmhdr* hdr)
+{
+        int i;
+        for (i = 0; i < MK_SHM_CTLMAX; i++) {
+                if (ctls[i].hdr == hdr) {
+                        __atomic_store_n(&ctls[i].hdr, NULL, __ATOMIC_RELEASE);
+                        if (ctls[i].len > 0)
+                                munmap(ctls[i].ctl,ctls[i].len);
+                        return;
+                }
+        }
+}
+
+const char* mk_shm_segname(enum mk_shmseg seg)
+{
+        return segnames[seg];
+}
+
+int mk_shm_lastseg(uint32_t segments)
+{
+        int i;
+        for (i = MK_SHM_SEGCNT - 1; i >= 0; i--) {
+                if (segments & (1U << puborder[i]))
+                        return puborder[i];
+        }
+        return -1;
+}
+
+int mk_shm_instname(char* name, size_t len, enum mk_shmseg seg, uint32_t inst)
+{
+        return mk_shm_instkey(name,len,segnames[seg],inst);
+}
+
+int mk_shm_instkey(char* name, size_t len, const char* key, uint32_t inst)
+{
+        if (inst == 0)
+                return snprintf(name,len,"%s",key);
+        return snprintf(name,len,"%s" MK_SHM_INSTSEP "%u",key,inst);
+}
+
+uint32_t mk_shm_instance(void)
+{
+        const char* inst = getenv("MK_SHM_INSTANCE");
+        return (NULL != inst) ? (uint32_t) strtoul(inst,NULL,10) : 0;
+}
+
+size_t mk_shm_segsize(enum mk_shmseg seg)
+{
+        return segsizes[seg];
+}
+
+size_t mk_shm_datasize(enum mk_shmseg seg)
+{
+        return datasizes[seg];
+}
+
+uint64_t mk_shm_taitime(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_TAI,&ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t mk_shm_realtime(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME,&ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Builds the path of the file on hugetlbfs backing a shared memory */
+static void hugepath(const struct mk_shm* shm, char* path, size_t len)
+{
+        const char* dir = getenv("MK_SHM_HUGEDIR");
+        if (NULL == dir)
+                dir = MK_SHM_HUGEDIR;
+        snprintf(path,len,"%s/%s",dir,shm->name);
+}
+
+/* Opens the file backing a shared memory */
+static int openfd(const struct mk_shm* shm, int oflag)
+{
+        char path[PATH_MAX];
+        if (shm->flags & MK_SHM_HUGEPAGE) {
+                hugepath(shm,path,sizeof(path));
+                return open(path, oflag, 0666);
+        }
+        return shm_open(shm->name, oflag, 0666);
+}
+
+/* Removes the name of a shared memory */
+static int unlinkfd(const struct mk_shm* shm)
+{
+        char path[PATH_MAX];
+        if (shm->flags & MK_SHM_HUGEPAGE) {
+                hugepath(shm,path,sizeof(path));
+                return unlink(path);
+        }
+        return shm_unlink(shm->name);
+}
+
+/* Returns the size of the pages backing a file, the hugepage size on hugetlbfs */
+static size_t pagesize(int fd, int flags)
+{
+        struct statfs fs;
+        if ((flags & MK_SHM_HUGEPAGE) && (fstatfs(fd,&fs) == 0))
+                return fs.f_bsize;
+        return sysconf(_SC_PAGESIZE);
+}
+
+/* Returns true if a process is running */
+static bool alive(uint32_t pid)
+{
+        // EPERM: the process exists, but belongs to another user
+        return (kill((pid_t) pid,0) == 0) || (errno == EPERM);
+}
+
+/* Makes the calling process the owner of a shared memory, unless another running process owns it
+ *
+ * A running owner is never replaced, whatever layout it uses, as the shared
+ * memory is initialized and resized only after the claim.
+ */
+static int claim(const char* name, struct mk_shmhdr* hdr)
+{
+        uint32_t self = getpid();
+        uint32_t owner = __atomic_load_n(&hdr->pid, __ATOMIC_ACQUIRE);
+
+        do {
+                if ((owner != 0) && (owner != self) && alive(owner)) {
+                        fprintf(stderr,"SHM %s is already written by process %u\n",name,owner);
+                        return -1;
+                }
+        } while (!__atomic_compare_exchange_n(&hdr->pid,&owner,self,false,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE));
+        if ((owner != 0) && (owner != self))
+                fprintf(stderr,"SHM %s: taking over from terminated writer %u\n",name,owner);
+        return 0;
+}
+
+/* Claims an existing shared memory through its header before the writer resizes it, returns 0 or -1 if it is owned
+ *
+ * The header is mapped on its own, so it stays valid while the file is
+ * resized. A file too small for a header has no owner yet.
+ */
+static int claimfd(const char* name, int fd, struct mk_shmhdr** hdr, size_t* len)
+{
+        struct stat st;
+        *hdr = NULL;
+        *len = sysconf(_SC_PAGESIZE);
+        if ((fstat(fd,&st) == -1) || ((size_t) st.st_size < sizeof(**hdr)))
+                return 0;
+        *len = (st.st_size < (off_t) *len) ? *len : (size_t) st.st_size;
+        *hdr = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (MAP_FAILED == *hdr) {
+                *hdr = NULL;
+                return 0;
+        }
+        if (claim(name,*hdr) == -1) {
+                munmap(*hdr,*len);
+                *hdr = NULL;
+                return -1;
+        }
+        return 0;
+}
+
+/* Gives up the ownership taken by claimfd if the writer failed to attach afterwards */
+static void unclaim(struct mk_shmhdr* hdr, size_t len, uint32_t self)
+{
+        if (NULL == hdr)
+                return;
+        __atomic_compare_exchange_n(&hdr->pid,&self,0,false,__ATOMIC_RELEASE,__ATOMIC_RELAXED);
+        munmap(hdr,len);
+}
+
+/* Returns true for the axes shared memory of an instance, the only one whose layout depends on MK_NAXES */
+static bool isaxes(const char* name)
+{
+        size_t len = strlen(MK_AXESKEY);
+        return (strncmp(name,MK_AXESKEY,len) == 0) && ((name[len] == '\0') || (name[len] == MK_SHM_INSTSEP[0]));
+}
+
+/* Checks that the header of a shared memory matches the layout of this build */
+static int checkhdr(const char* name, const struct mk_shmhdr* hdr, size_t size)
+{
+        uint32_t incompat;
+        if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != MK_SHM_MAGIC) {
+                fprintf(stderr,"SHM %s is not initialized or not a shared memory of the interface\n",name);
+                return -1;
+        }
+        if (hdr->version != MK_SHM_LAYOUT_VERSION) {
+                fprintf(stderr,"SHM %s has layout version %u, expected %u\n",name,hdr->version,MK_SHM_LAYOUT_VERSION);
+                return -1;
+        }
+        if (hdr->hash != MK_SHM_LAYOUT_HASH) {
+                fprintf(stderr,"SHM %s has layout hash %08x, expected %08x\n",name,hdr->hash,MK_SHM_LAYOUT_HASH);
+                return -1;
+        }
+        if (hdr->size != size) {
+                fprintf(stderr,"SHM %s has size %u, expected %zu\n",name,hdr->size,size);
+                return -1;
+        }
+        if (isaxes(name) && (hdr->naxes != MK_NAXES)) {
+                fprintf(stderr,"SHM %s has %u axes, expected %u\n",name,hdr->naxes,MK_NAXES);
+                return -1;
+        }
+        incompat = hdr->features & MK_SHM_FEAT_INCOMPAT_MASK & ~MK_SHM_FEAT_INCOMPAT_KNOWN;
+        if (incompat != 0) {
+                fprintf(stderr,"SHM %s uses unknown features %08x\n",name,incompat);
+                return -1;
+        }
+        return 0;
+}
+
+void* mk_shm_attachname(struct mk_shm* shm, const char* name, size_t size, int flags)
+{
+        int fd;
+        bool init = false;
+        bool created = false;
+        bool filesize = (size == 0);
+        int prot = PROT_READ;
+        int mapflg = MAP_SHARED;
+        size_t pgsize;
+        struct stat st;
+        struct mk_shmhdr* hdr;
+        struct mk_shmhdr* claimed = NULL;
+        size_t claimlen = 0;
+        struct mk_shmhdr* ctl;
+        int ctlfd;
+        uint32_t self = getpid();
+
+        memset(shm,0,sizeof(*shm));
+        snprintf(shm->name,sizeof(shm->name),"%s",name);
+        shm->size = size;
+        shm->flags = flags;
+
+        if (flags & MK_SHM_WRITER) {
+                //only a shared memory created here may be removed on errors, an existing one is claimed before it is resized
+                init = true;
+                fd = openfd(shm, O_RDWR | O_CREAT | O_EXCL);
+                if (fd != -1) {
+                        created = true;
+                } else if (errno == EEXIST) {
+                        fd = openfd(shm, O_RDWR);
+                        if ((fd != -1) && (claimfd(name,fd,&claimed,&claimlen) == -1)) {
+                                close(fd);
+                                return(NULL);
+                        }
+                }
+        } else if (flags & MK_SHM_SHARED) {
+                //the owner creates and initializes it
+                fd = openfd(shm, O_RDWR);
+        } else {
+                fd = openfd(shm, O_RDONLY);
+                if ((fd == -1) && (errno == ENOENT) && (size > 0)) {
+                        //shm not available yet -> create and initialize
+                        init = true;
+                        fd = openfd(shm, O_RDWR | O_CREAT | O_EXCL);
+                        created = (fd != -1);
+                        if ((fd == -1) && (errno == EEXIST)) {
+                                //created by someone else meanwhile
+                                init = false;
+                                fd = openfd(shm, O_RDONLY);
+                        }
+                }
+        }
+        if (fd == -1) {
+                perror("SHM Open failed");
+                return(NULL);
+        }
+        if (init || (flags & MK_SHM_SHARED))
+                prot |= PROT_WRITE;
+
+        if ((size == 0) && (fstat(fd,&st) == 0))
+                shm->size = size = st.st_size;
+        pgsize = pagesize(fd,flags);
+        shm->maplen = (size + pgsize - 1) / pgsize * pgsize;
+        if (init) {
+                if (ftruncate(fd,shm->maplen) == -1) {
+                        perror("SHM Resize failed");
+                        close(fd);
+                        unclaim(claimed,claimlen,self);
+                        if (created)
+                                unlinkfd(shm);
+                        return(NULL);
+                }
+        } else if ((fstat(fd,&st) == -1) || ((size_t) st.st_size < size) || (size < sizeof(*hdr))) {
+                fprintf(stderr,"SHM %s is smaller than expected %zu bytes\n",name,size);
+                close(fd);
+                return(NULL);
+        }
+
+        if (flags & MK_SHM_POPULATE)
+                mapflg |= MAP_POPULATE;
+        shm->addr = mmap(NULL, shm->maplen, prot, mapflg, fd, 0);
+        close(fd);
+        if (MAP_FAILED == shm->addr) {
+                perror("SHM Map failed");
+                shm->addr = NULL;
+                unclaim(claimed,claimlen,self);
+                if (created)
+                        unlinkfd(shm);
+                return(NULL);
+        }
+        //the whole shared memory is mapped now, it stays claimed
+        if (NULL != claimed)
+                munmap(claimed,claimlen);
+
+        hdr = (struct mk_shmhdr*) shm->addr;
+        if ((flags & MK_SHM_WRITER) && (claim(name,hdr) == -1)) {
+                munmap(shm->addr,shm->maplen);
+                shm->addr = NULL;
+                return(NULL);
+        }
+        if (init) {
+                //initialize shared memory, readers may already have it mapped
+                __atomic_store_n(&hdr->magic, 0, __ATOMIC_RELAXED);
+                //finish an update of a crashed writer, so seq is even again
+                if (__atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) & 1)
+                        mk_shm_writeend(hdr);
+                mk_shm_writebegin(hdr);
+                memset(hdr + 1,0,shm->maplen - sizeof(*hdr));
+                hdr->version = MK_SHM_LAYOUT_VERSION;
+                hdr->hash = MK_SHM_LAYOUT_HASH;
+                hdr->size = size;
+                hdr->naxes = MK_NAXES;
+                hdr->period = 0;
+                hdr->features = 0;
+                if (flags & MK_SHM_NOTIFY)
+                        hdr->features |= MK_SHM_FEAT_NOTIFY;
+                if (flags & MK_SHM_DELTA)
+                        hdr->features |= MK_SHM_FEAT_DELTA;
+                hdr->cycle = 0;
+                hdr->stamp = 0;
+                mk_shm_writeend(hdr);
+                __atomic_store_n(&hdr->magic, MK_SHM_MAGIC, __ATOMIC_RELEASE);
+                if (!(flags & MK_SHM_WRITER))
+                        mprotect(shm->addr,shm->maplen,PROT_READ);
+        } else if (filesize && (hdr->size >= sizeof(*hdr)) && (hdr->size <= size)) {
+                //mapped with the size of the file, the struct itself may be smaller
+                shm->size = size = hdr->size;
+        }
+        if (checkhdr(name,hdr,size) == -1) {
+                munmap(shm->addr,shm->maplen);
+                shm->addr = NULL;
+                return(NULL);
+        }
+        //writable header for mk_shm_wait, a reader without write permission waits without it
+        if (flags & (MK_SHM_WRITER | MK_SHM_SHARED)) {
+                addctl(hdr,hdr,0);
+        } else if ((ctlfd = openfd(shm, O_RDWR)) != -1) {
+                ctl = mmap(NULL, pgsize, PROT_READ | PROT_WRITE, MAP_SHARED, ctlfd, 0);
+                close(ctlfd);
+                if (MAP_FAILED != ctl)
+                        addctl(hdr,ctl,pgsize);
+        }
+
+        // a failed lock is not fatal, but page faults may occur later on
+        if ((flags & MK_SHM_MLOCK) && (mlock(shm->addr,shm->maplen) == -1))
+                perror("SHM Lock failed");
+
+        return shm->addr;
+}
+
+void* mk_shm_attach(struct mk_shm* shm, enum mk_shmseg seg, int flags)
+{
+        return mk_shm_attach_inst(shm,seg,mk_shm_instance(),flags);
+}
+
+void* mk_shm_attach_inst(struct mk_shm* shm, enum mk_shmseg seg, uint32_t inst, int flags)
+{
+        char name[64];
+        mk_shm_instname(name,sizeof(name),seg,inst);
+        return mk_shm_attachname(shm,name,segsizes[seg],flags);
+}
+
+uint32_t mk_shm_attach_insts(struct mk_shminst* insts, uint32_t first, uint32_t count, uint32_t segments, int flags)
+{
+        uint32_t attached = 0;
+        uint32_t i;
+        int seg;
+
+        for (i = 0; i < count; i++) {
+                insts[i].inst = first + i;
+                for (seg = 0; seg < MK_SHM_SEGCNT; seg++) {
+                        insts[i].shm[seg].addr = NULL;
+                        if ((segments & (1U << seg)) && (NULL != mk_shm_attach_inst(&insts[i].shm[seg],seg,first + i,flags)))
+                                attached++;
+                }
+        }
+        return attached;
+}
+
+int mk_shm_check(const struct mk_shm* shm)
+{
+        if (NULL == shm->addr)
+                return -1;
+        return checkhdr(shm->name,(const struct mk_shmhdr*) shm->addr,shm->size);
+}
+
+enum mk_shm_wstate mk_shm_writerstate(const struct mk_shmhdr* hdr, uint32_t maxcycles)
+{
+        uint32_t pid = __atomic_load_n(&hdr->pid, __ATOMIC_ACQUIRE);
+        uint32_t period = __atomic_load_n(&hdr->period, __ATOMIC_RELAXED);
+        uint64_t stamp = __atomic_load_n(&hdr->stamp, __ATOMIC_RELAXED);
+        uint64_t now;
+
+        if (pid == 0)
+                return MK_SHM_WSTATE_NONE;
+        if (!alive(pid))
+                return MK_SHM_WSTATE_DEAD;
+        if ((maxcycles == 0) || (period == 0) || (stamp == 0))
+                return MK_SHM_WSTATE_OK;
+        now = mk_shm_taitime();
+        if ((now > stamp) && (now - stamp > (uint64_t) maxcycles * period * 1000)) {
+                if (__atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE) & 1)
+                        return MK_SHM_WSTATE_STUCK;
+                return MK_SHM_WSTATE_STALE;
+        }
+        return MK_SHM_WSTATE_OK;
+}
+
+const char* mk_shm_wstatename(enum mk_shm_wstate state)
+{
+        switch (state) {
+        case MK_SHM_WSTATE_OK:
+                return "writer alive";
+        case MK_SHM_WSTATE_NONE:
+                return "no writer";
+        case MK_SHM_WSTATE_STALE:
+                return "writer stale";
+        case MK_SHM_WSTATE_STUCK:
+                return "writer stuck in an update";
+        default:
+                return "writer terminated";
+        }
+}
+
+void mk_shm_setperiod(struct mk_shmhdr* hdr, uint32_t period)
+{
+        __atomic_store_n(&hdr->period, period, __ATOMIC_RELAXED);
+}
+
+int mk_shm_detach(struct mk_shm* shm)
+{
+        int ok;
+        uint32_t self = getpid();
+        if (NULL == shm->addr)
+                return 0;
+        // give up the ownership, unless another writer took over meanwhile
+        if (shm->flags & MK_SHM_WRITER)
+                __atomic_compare_exchange_n(&((struct mk_shmhdr*) shm->addr)->pid,&self,0,false,__ATOMIC_RELEASE,__ATOMIC_RELAXED);
+        delctl(shm->addr);
+        ok = munmap(shm->addr,shm->maplen);
+        if (ok < 0)
+                return ok;
+        shm->addr = NULL;
+        // readers do not remove the name, so other readers can still open it
+        if (shm->flags & MK_SHM_WRITER)
+                ok = unlinkfd(shm);
+        return ok;
+}
+
+void mk_shm_detach_insts(struct mk_shminst* insts, uint32_t count)
+{
+        uint32_t i;
+        int seg;
+
+        for (i = 0; i < count; i++) {
+                for (seg = 0; seg < MK_SHM_SEGCNT; seg++)
+                        mk_shm_detach(&insts[i].shm[seg]);
+        }
+}
+
+void mk_shm_notify(struct mk_shmhdr* hdr)
+{
+        if (!(hdr->features & MK_SHM_FEAT_NOTIFY))
+                return;
+        //orders the store of seq before the load of waiters, pairs with the increment in mk_shm_wait
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&hdr->waiters, __ATOMIC_RELAXED) != 0)
+                syscall(SYS_futex, &hdr->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+int mk_shm_wait(const struct mk_shmhdr* hdr, uint32_t seq, uint32_t timeout)
+{
+        struct timespec ts;
+        struct mk_shmhdr* ctl;
+        long ok;
+        int err;
+        ts.tv_sec = timeout / 1000000;
+        ts.tv_nsec = (timeout % 1000000) * 1000L;
+        if (__atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE) != seq)
+                return 0;
+        if (!(__atomic_load_n(&hdr->features, __ATOMIC_RELAXED) & MK_SHM_FEAT_NOTIFY)) {
+                // writer does not notify, poll after the timeout
+                nanosleep(&ts,NULL);
+                return (__atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE) != seq) ? 0 : -1;
+        }
+        //the writer only wakes if a reader is counted, the futex checks seq after the increment
+        ctl = findctl(hdr);
+        if (NULL != ctl)
+                __atomic_fetch_add(&ctl->waiters, 1, __ATOMIC_SEQ_CST);
+        ok = syscall(SYS_futex, &hdr->seq, FUTEX_WAIT, seq, &ts, NULL, 0);
+        err = errno;
+        if (NULL != ctl)
+                __atomic_fetch_sub(&ctl->waiters, 1, __ATOMIC_SEQ_CST);
+        if ((ok == 0) || (err == EAGAIN) || (errno == EAGAIN))
+                return (__atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE) != seq) ? 0 : -1;
+        return -1;
+}
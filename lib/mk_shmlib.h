@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Common functions to access the Shared-Memory-Interface (libmkshm)
+ *
+ * All components of the AccessTSN Industrial Use Case Demo (TSN-RT-Interface,
+ * OPC UA Server, HMI, demo applications) attach the shared memories described
+ * in mk_shminterface.h through these functions, so every component gets the
+ * same attach path. The shared memory can be prefaulted and locked at attach
+ * time, so no page fault happens in the first cycle of a realtime loop.
+ */
+
+#ifndef _MK_SHMLIB_H_
+#define _MK_SHMLIB_H_
+
+#include "../mk_shminterface.h"
+#include <stddef.h>
+
+// the shared memories of the interface
+enum mk_shmseg {
+	MK_SHM_MAINOUT = 0,
+	MK_SHM_MAININ,
+	MK_SHM_ADDOUT,
+	MK_SHM_SEGCNT
+};
+
+// flags for attaching a shared memory
+#define MK_SHM_WRITER	0x01	//attach as writer: create and initialize, remove on detach
+#define MK_SHM_POPULATE	0x02	//prefault all pages of the shared memory at attach time
+#define MK_SHM_MLOCK	0x04	//lock the pages of the shared memory into RAM
+#define MK_SHM_HUGEPAGE	0x08	//back the shared memory with a file on hugetlbfs
+#define MK_SHM_NOTIFY	0x10	//writer only: wake waiting readers after every update, see mk_shm_notify
+#define MK_SHM_DELTA	0x20	//writer only: publishes with mk_*_writedelta, see mk_shminterface.h
+#define MK_SHM_SHARED	0x40	//attach an existing shared memory writable without becoming its owner, e.g. as producer of a queue
+
+// default mountpoint of hugetlbfs, can be changed with environment variable MK_SHM_HUGEDIR
+#define MK_SHM_HUGEDIR "/dev/hugepages"
+
+// handle of an attached shared memory
+struct mk_shm {
+	char name[64];		//name of the shared memory
+	size_t size;		//size of the shared memory struct
+	size_t maplen;		//length of the mapping, size rounded up to the page size
+	int flags;		//flags used during attach
+	void* addr;		//address of the mapping, NULL if not attached
+};
+
+// returns the name of a shared memory of the interface
+const char* mk_shm_segname(enum mk_shmseg seg);
+
+/* Returns the shared memory of segments (bit 1 << enum mk_shmseg) which is published last in a cycle, -1 if none
+ *
+ * A writer publishes MK_MAINOUT, MK_ADDOUT and MK_MAININ in this order, a
+ * reader which wakes up on the update of the last one finds the others of
+ * the cycle already published.
+ */
+int mk_shm_lastseg(uint32_t segments);
+
+/* Instances of the interface
+ *
+ * Several controls can share one host, each with its own instance of the
+ * three shared memories. Instance 0 uses the plain names (e.g. MK_MAINOUT),
+ * instance n > 0 appends ".n" (e.g. MK_MAINOUT.2). mk_shm_attach and
+ * mk_ring_attach use the instance of the process, which is set with the
+ * environment variable MK_SHM_INSTANCE and defaults to 0.
+ */
+#define MK_SHM_INSTSEP "."
+
+// builds the name of a shared memory of an instance into name, returns the result of snprintf
+int mk_shm_instname(char* name, size_t len, enum mk_shmseg seg, uint32_t inst);
+
+// builds the name of an instance of the shared memory key, e.g. MK_AXESKEY, like mk_shm_instname
+int mk_shm_instkey(char* name, size_t len, const char* key, uint32_t inst);
+
+// returns the instance of the process, see MK_SHM_INSTANCE
+uint32_t mk_shm_instance(void);
+
+// returns the size of a shared memory of the interface including struct mk_shmhdr
+size_t mk_shm_segsize(enum mk_shmseg seg);
+
+// returns the size of the struct of variables of a shared memory of the interface in wire format
+size_t mk_shm_datasize(enum mk_shmseg seg);
+
+// returns the current CLOCK_TAI time in ns, used to timestamp samples
+uint64_t mk_shm_taitime(void);
+
+// returns the current CLOCK_REALTIME time in ns, used to timestamp output for humans and tools
+uint64_t mk_shm_realtime(void);
+
+/* Attaches a shared memory of the interface, returns its address or NULL on error
+ *
+ * A writer creates the shared memory if necessary and initializes it. A reader
+ * maps it read-only, if it is not available yet it is created and initialized.
+ * A writer becomes the owner of the shared memory and is refused while
+ * another process owns it. The ownership of a terminated process is taken
+ * over, as well as an update it did not finish. Owners are identified by
+ * their process id, so all writers have to run in the same pid namespace.
+ */
+void* mk_shm_attach(struct mk_shm* shm, enum mk_shmseg seg, int flags);
+
+// attaches a shared memory of an instance of the interface like mk_shm_attach
+void* mk_shm_attach_inst(struct mk_shm* shm, enum mk_shmseg seg, uint32_t inst, int flags);
+
+/* Attaches a shared memory by name and size of its struct, which has to start with struct mk_shmhdr
+ *
+ * A reader may pass size 0 to map an existing shared memory with its current
+ * size, in this case the shared memory is not created if it is not available.
+ */
+void* mk_shm_attachname(struct mk_shm* shm, const char* name, size_t size, int flags);
+
+// shared memories of the interface of one instance, see mk_shm_attach_insts
+struct mk_shminst {
+	uint32_t inst;			//instance of the interface
+	struct mk_shm shm[MK_SHM_SEGCNT];	//handles by enum mk_shmseg, addr is NULL if not selected or not attached
+};
+
+/* Attaches the selected shared memories of count instances starting with first like mk_shm_attach
+ *
+ * segments has bit (1 << enum mk_shmseg) set for each selected shared memory.
+ * A shared memory which can not be attached stays NULL, the others are still
+ * attached. Returns the number of attached shared memories.
+ */
+uint32_t mk_shm_attach_insts(struct mk_shminst* insts, uint32_t first, uint32_t count, uint32_t segments, int flags);
+
+/* Checks the header of an attached shared memory again, returns 0 if it matches the layout of this build
+ *
+ * A reader which attached before the writer created the shared memory should
+ * call it once the writer published its first update, as the writer
+ * initializes the header again with its own layout.
+ */
+int mk_shm_check(const struct mk_shm* shm);
+
+// states of the writer of a shared memory, see mk_shm_writerstate
+enum mk_shm_wstate {
+	MK_SHM_WSTATE_OK = 0,	//writer alive and updating
+	MK_SHM_WSTATE_NONE,	//no writer owns the shared memory
+	MK_SHM_WSTATE_STALE,	//no update within the given number of cycles
+	MK_SHM_WSTATE_STUCK,	//writer did not finish an update within the given number of cycles
+	MK_SHM_WSTATE_DEAD	//writer terminated without detaching
+};
+
+/* Returns the state of the writer of a shared memory
+ *
+ * The writer is stale if it did not publish an update for maxcycles of its
+ * announced period (mk_shm_setperiod). Without a period, before the first
+ * update or with maxcycles 0 only the owner process is checked.
+ */
+enum mk_shm_wstate mk_shm_writerstate(const struct mk_shmhdr* hdr, uint32_t maxcycles);
+
+// returns a description of a state of a writer
+const char* mk_shm_wstatename(enum mk_shm_wstate state);
+
+// announces the cycle period of the writer in us to the readers
+void mk_shm_setperiod(struct mk_shmhdr* hdr, uint32_t period);
+
+// detaches a shared memory, a writer also gives up the ownership and removes its name
+int mk_shm_detach(struct mk_shm* shm);
+
+// detaches all shared memories of count instances attached with mk_shm_attach_insts like mk_shm_detach
+void mk_shm_detach_insts(struct mk_shminst* insts, uint32_t count);
+
+// wakes all readers waiting in mk_shm_wait, called by the writer after an update if it was attached with MK_SHM_NOTIFY, no syscall if none waits
+void mk_shm_notify(struct mk_shmhdr* hdr);
+
+/* Waits until seq of the shared memory differs from seq, at most timeout microseconds
+ *
+ * Returns 0 if the shared memory was updated and -1 on timeout or if
+ * interrupted by a signal. If the writer does not notify, the function sleeps
+ * for the timeout and then checks seq, so readers fall back to polling.
+ * Waiting readers count themselves in waiters of the header, which needs
+ * write permission for the shared memory; a reader without it is woken
+ * only by the timeout or together with other readers.
+ */
+int mk_shm_wait(const struct mk_shmhdr* hdr, uint32_t seq, uint32_t timeout);
+
+#endif /* _MK_SHMLIB_H_ */
@@ -0,0 +1,342 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Buffered output of samples of the shared memories (libmkshm) */
+
+#include "mk_shmoutput.h"
+#include "mk_shmfields.h"
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// variables printed in one line of the text format
+#define MK_OUT_PERLINE 4
+
+static const char* const fmtnames[] = {
+        [MK_OUT_TEXT] = "text",
+        [MK_OUT_BIN] = "bin",
+        [MK_OUT_JSON] = "json",
+        [MK_OUT_CSV] = "csv",
+};
+
+/* Appends formatted text to the buffer, the caller reserved maxrec bytes */
+static void append(struct mk_output* out, const char* format, ...)
+{
+        va_list ap;
+        int n;
+
+        va_start(ap, format);
+        n = vsnprintf(out->buf + out->len, out->cap - out->len, format, ap);
+        va_end(ap);
+        if (n > 0)
+                out->len += ((size_t) n < out->cap - out->len) ? (size_t) n : out->cap - out->len - 1;
+}
+
+/* Appends raw bytes to the buffer */
+static void appendraw(struct mk_output* out, const void* data, size_t len)
+{
+        memcpy(out->buf + out->len, data, len);
+        out->len += len;
+}
+
+/* Appends the value of a variable as JSON or CSV number, non-finite doubles as null or empty */
+static void appendvalue(struct mk_output* out, const struct mk_field* field, const void* wire)
+{
+        double d;
+
+        switch (field->type) {
+        case MK_FIELD_DOUBLE:
+                d = mk_field_value(field, wire);
+                // %.17g keeps all digits, so the value is read back exactly
+                if (isfinite(d))
+                        append(out, "%.17g", d);
+                else if (out->fmt == MK_OUT_JSON)
+                        append(out, "null");
+                break;
+        case MK_FIELD_BOOL:
+                if (out->fmt == MK_OUT_JSON)
+                        append(out, "%s", mk_field_value(field, wire) != 0.0 ? "true" : "false");
+                else
+                        append(out, "%d", mk_field_value(field, wire) != 0.0);
+                break;
+        default:
+                out->len += mk_field_format(out->buf + out->len, out->cap - out->len, field, wire);
+                break;
+        }
+}
+
+/* Updates the cached local time hh:mm:ss of the text format */
+static void updateclock(struct mk_output* out, uint64_t time)
+{
+        time_t sec = time / 1000000000ULL;
+        struct tm local;
+
+        // localtime_r is expensive, convert only once per second
+        if ((int64_t) sec != out->second) {
+                localtime_r(&sec, &local);
+                snprintf(out->clock, sizeof(out->clock), "%02d:%02d:%02d", local.tm_hour, local.tm_min, local.tm_sec);
+                out->second = sec;
+        }
+}
+
+/* Appends a sample in the text format of mk_shm_fprint with the local time in ns */
+static void appendtext(struct mk_output* out, const struct mk_fieldset* set, uint32_t inst, uint64_t time, uint64_t cycle, const void* wire, uint64_t fields)
+{
+        char value[32];
+        size_t n = 0;
+        uint32_t i;
+        uint32_t col = 0;
+
+        updateclock(out, time);
+        append(out, "\n##### %s: (at %s.%09llu, cycle %llu, instance %u) #####\n", set->title, out->clock,
+                (unsigned long long) (time % 1000000000ULL), (unsigned long long) cycle, inst);
+        for (i = 0; i < set->count; i++) {
+                if (!(fields & (1ULL << i)))
+                        continue;
+                // entries are left-justified in columns of 44 characters
+                if (col % MK_OUT_PERLINE != 0)
+                        append(out, "%*s", (int) (out->len - n < 44 ? 44 - (out->len - n) : 0), "");
+                mk_field_format(value, sizeof(value), &set->fields[i], wire);
+                n = out->len;
+                append(out, "%s: %s%s%s;", set->fields[i].label, value,
+                        set->fields[i].unit[0] ? " " : "", set->fields[i].unit);
+                if (++col % MK_OUT_PERLINE == 0)
+                        append(out, "\n");
+        }
+        if (col % MK_OUT_PERLINE != 0)
+                append(out, "\n");
+}
+
+int mk_output_parse(const char* name)
+{
+        int i;
+        for (i = 0; i < (int) (sizeof(fmtnames) / sizeof(fmtnames[0])); i++)
+                if (strcmp(fmtnames[i], name) == 0)
+                        return i;
+        return -1;
+}
+
+int mk_output_init(struct mk_output* out, int fd, enum mk_outfmt fmt, uint32_t segments)
+{
+        const struct mk_fieldset* set;
+        struct mk_outhdr hdr;
+        uint32_t seg;
+        uint32_t i;
+
+        memset(out, 0, sizeof(*out));
+        out->fd = fd;
+        out->fmt = fmt;
+        out->segments = segments;
+        out->interval = MK_OUT_INTERVAL;
+        out->second = -1;
+
+        // bound the size of a sample: every format needs less per variable than name, label, unit and a number
+        out->maxrec = 256;
+        for (seg = 0; seg < MK_SHM_SEGCNT; seg++) {
+                if (!(segments & (1 << seg)))
+                        continue;
+                set = mk_shm_fields(seg);
+                out->maxrec += set->wiresize + sizeof(struct mk_outrec);
+                for (i = 0; i < set->count; i++)
+                        out->maxrec += strlen(set->fields[i].name) + strlen(set->fields[i].label) + strlen(set->fields[i].unit) + 80;
+        }
+        // a sample of the axes needs less than 300 bytes per axis
+        out->maxrec += sizeof(struct mk_axes) + sizeof(struct mk_outrec) + MK_NAXES * 300;
+        out->cap = MK_OUT_BUFSIZE;
+        if (out->cap < 4 * out->maxrec)
+                out->cap = 4 * out->maxrec;
+        out->buf = malloc(out->cap);
+        if (NULL == out->buf) {
+                perror("Output buffer allocation failed");
+                return -1;
+        }
+
+        if (fmt == MK_OUT_BIN) {
+                memset(&hdr, 0, sizeof(hdr));
+                hdr.magic = MK_OUT_MAGIC;
+                hdr.version = MK_OUT_VERSION;
+                hdr.layout = MK_SHM_LAYOUT_REV;
+                hdr.hash = MK_SHM_LAYOUT_HASH;
+                hdr.segments = segments;
+                appendraw(out, &hdr, sizeof(hdr));
+        } else if (fmt == MK_OUT_CSV) {
+                append(out, "segment,instance,time,cycle,stamp");
+                for (seg = 0; seg < MK_SHM_SEGCNT; seg++) {
+                        if (!(segments & (1 << seg)))
+                                continue;
+                        set = mk_shm_fields(seg);
+                        for (i = 0; i < set->count; i++)
+                                append(out, ",%s", set->fields[i].name);
+                }
+                append(out, "\n");
+        }
+        return 0;
+}
+
+int mk_output_sample(struct mk_output* out, enum mk_shmseg seg, uint32_t inst, uint64_t time, uint64_t cycle, uint64_t stamp, const void* wire, uint64_t fields)
+{
+        const struct mk_fieldset* set = mk_shm_fields(seg);
+        const struct mk_fieldset* other;
+        struct mk_outrec rec;
+        uint32_t s;
+        uint32_t i;
+
+        if ((out->len + out->maxrec > out->cap) && (mk_output_flush(out) == -1))
+                return -1;
+        if (out->len == 0)
+                out->first = time;
+
+        switch (out->fmt) {
+        case MK_OUT_BIN:
+                memset(&rec, 0, sizeof(rec));
+                rec.seg = seg;
+                rec.size = set->wiresize;
+                rec.inst = inst;
+                rec.time = time;
+                rec.cycle = cycle;
+                rec.stamp = stamp;
+                appendraw(out, &rec, sizeof(rec));
+                appendraw(out, wire, set->wiresize);
+                break;
+        case MK_OUT_JSON:
+                append(out, "{\"segment\":\"%s\",\"instance\":%u,\"time\":%llu,\"cycle\":%llu,\"stamp\":%llu", mk_shm_segname(seg), inst,
+                        (unsigned long long) time, (unsigned long long) cycle, (unsigned long long) stamp);
+                for (i = 0; i < set->count; i++) {
+                        if (!(fields & (1ULL << i)))
+                                continue;
+                        append(out, ",\"%s\":", set->fields[i].name);
+                        appendvalue(out, &set->fields[i], wire);
+                }
+                append(out, "}\n");
+                break;
+        case MK_OUT_CSV:
+                append(out, "%s,%u,%llu,%llu,%llu", mk_shm_segname(seg), inst,
+                        (unsigned long long) time, (unsigned long long) cycle, (unsigned long long) stamp);
+                // the columns of the other selected shared memories stay empty
+                for (s = 0; s < MK_SHM_SEGCNT; s++) {
+                        if (!(out->segments & (1 << s)))
+                                continue;
+                        other = mk_shm_fields(s);
+                        for (i = 0; i < other->count; i++) {
+                                append(out, ",");
+                                if ((s == (uint32_t) seg) && (fields & (1ULL << i)))
+                                        appendvalue(out, &other->fields[i], wire);
+                        }
+                }
+                append(out, "\n");
+                break;
+        default:
+                appendtext(out, set, inst, time, cycle, wire, fields);
+                break;
+        }
+
+        if ((out->interval == 0) || (time - out->first >= out->interval))
+                return mk_output_flush(out);
+        return 0;
+}
+
+/* Appends an array of doubles of all axes as JSON */
+static void appendarray(struct mk_output* out, const char* name, const double* values)
+{
+        int i;
+
+        append(out, ",\"%s\":[", name);
+        for (i = 0; i < MK_NAXES; i++) {
+                if (i > 0)
+                        append(out, ",");
+                if (isfinite(values[i]))
+                        append(out, "%.17g", values[i]);
+                else
+                        append(out, "null");
+        }
+        append(out, "]");
+}
+
+int mk_output_axes(struct mk_output* out, uint32_t inst, uint64_t time, uint64_t cycle, uint64_t stamp, const struct mk_axes* axes)
+{
+        struct mk_outrec rec;
+        int i;
+
+        if ((out->len + out->maxrec > out->cap) && (mk_output_flush(out) == -1))
+                return -1;
+        if (out->len == 0)
+                out->first = time;
+
+        switch (out->fmt) {
+        case MK_OUT_BIN:
+                memset(&rec, 0, sizeof(rec));
+                rec.seg = MK_OUT_AXES;
+                rec.size = sizeof(*axes);
+                rec.inst = inst;
+                rec.time = time;
+                rec.cycle = cycle;
+                rec.stamp = stamp;
+                appendraw(out, &rec, sizeof(rec));
+                appendraw(out, axes, sizeof(*axes));
+                break;
+        case MK_OUT_JSON:
+                append(out, "{\"segment\":\"%s\",\"instance\":%u,\"time\":%llu,\"cycle\":%llu,\"stamp\":%llu,\"naxes\":%d", MK_AXESKEY, inst,
+                        (unsigned long long) time, (unsigned long long) cycle, (unsigned long long) stamp, MK_NAXES);
+                appendarray(out, "vel_set", axes->vel_set);
+                appendarray(out, "pos_set", axes->pos_set);
+                appendarray(out, "pos_cur", axes->pos_cur);
+                append(out, ",\"enable\":%u,\"fault\":%u,\"home\":%u,\"hardneg\":%u,\"hardpos\":%u}\n",
+                        axes->enable, axes->fault, axes->home, axes->hardneg, axes->hardpos);
+                break;
+        case MK_OUT_CSV:
+                // the columns are those of the structs of variables
+                break;
+        default:
+                updateclock(out, time);
+                append(out, "\n##### Axes: (at %s.%09llu, cycle %llu, instance %u) #####\n", out->clock,
+                        (unsigned long long) (time % 1000000000ULL), (unsigned long long) cycle, inst);
+                for (i = 0; i < MK_NAXES; i++)
+                        append(out, "Axis %d: Velocity Setpoint: %f mm/s; Position Setpoint: %f mm; Position Current: %f mm; enabled: %s; faulty: %s; at home: %s; at neg Endstop: %s; at pos Endstop: %s;\n",
+                                i, axes->vel_set[i], axes->pos_set[i], axes->pos_cur[i],
+                                (axes->enable >> i) & 1 ? "true" : "false", (axes->fault >> i) & 1 ? "true" : "false",
+                                (axes->home >> i) & 1 ? "true" : "false", (axes->hardneg >> i) & 1 ? "true" : "false",
+                                (axes->hardpos >> i) & 1 ? "true" : "false");
+                break;
+        }
+
+        if ((out->interval == 0) || (time - out->first >= out->interval))
+                return mk_output_flush(out);
+        return 0;
+}
+
+int mk_output_flush(struct mk_output* out)
+{
+        size_t done = 0;
+        ssize_t n;
+
+        while (done < out->len) {
+                n = write(out->fd, out->buf + done, out->len - done);
+                if (n == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        perror("Output write failed");
+                        out->len = 0;
+                        return -1;
+                }
+                done += n;
+        }
+        out->len = 0;
+        return 0;
+}
+
+void mk_output_close(struct mk_output* out)
+{
+        if (NULL == out->buf)
+                return;
+        mk_output_flush(out);
+        free(out->buf);
+        out->buf = NULL;
+}
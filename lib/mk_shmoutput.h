@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Buffered output of samples of the shared memories (libmkshm)
+ *
+ * Samples are formatted into one reusable buffer, which is written to a file
+ * descriptor in batches: when it cannot take another sample or when the
+ * oldest buffered sample is older than the flush interval. Besides the text
+ * format of demoreader, samples can be written as binary stream, JSON lines
+ * or CSV, so the output can be piped into analysis tools at high rates.
+ *
+ * Binary stream: one struct mk_outhdr, then per sample one struct mk_outrec
+ * followed by the struct of variables in wire format (size bytes).
+ * JSON lines: one object per sample with segment, instance, time, cycle,
+ * stamp and all variables by name.
+ * CSV: one header row with the columns segment, instance, time, cycle and stamp and
+ * the variables of all selected shared memories, then one row per sample in
+ * which the columns of the other shared memories are empty.
+ *
+ * Samples of the axes shared memory (lib/mk_shmaxes.h) are records with seg
+ * MK_OUT_AXES followed by struct mk_axes, JSON objects with the arrays of the
+ * first naxes axes and the masks, there is no CSV format of them.
+ */
+
+#ifndef _MK_SHMOUTPUT_H_
+#define _MK_SHMOUTPUT_H_
+
+#include "mk_shmlib.h"
+
+#define MK_OUT_MAGIC 0x314d5254534b4d41ULL	// "AMKSTRM1"
+#define MK_OUT_VERSION 2
+// default size of the buffer in bytes
+#define MK_OUT_BUFSIZE 65536
+// default flush interval in ns
+#define MK_OUT_INTERVAL 100000000ULL
+// outputs all variables of a sample
+#define MK_OUT_ALLFIELDS (~0ULL)
+// seg of the records of the axes shared memory in a binary stream
+#define MK_OUT_AXES 0x100
+
+// formats of the output
+enum mk_outfmt {
+	MK_OUT_TEXT = 0,	//blocks of labeled values for humans
+	MK_OUT_BIN,		//binary stream
+	MK_OUT_JSON,		//JSON lines
+	MK_OUT_CSV		//comma separated values
+};
+
+// header of a binary stream
+struct __attribute__((__packed__)) mk_outhdr {
+	uint64_t magic;		//MK_OUT_MAGIC
+	uint32_t version;	//version of the stream format, MK_OUT_VERSION
+	uint32_t layout;	//MK_SHM_LAYOUT_REV of the structs
+	uint32_t hash;		//MK_SHM_LAYOUT_HASH of the structs
+	uint32_t segments;	//selected shared memories, bit (1 << enum mk_shmseg) set if selected
+};
+
+// header of a sample in a binary stream
+struct __attribute__((__packed__)) mk_outrec {
+	uint16_t seg;		//enum mk_shmseg or MK_OUT_AXES
+	uint16_t size;		//size of the following struct in wire format
+	uint32_t inst;		//instance of the interface, see mk_shm_instname
+	uint64_t time;		//CLOCK_REALTIME timestamp in ns when the sample was read
+	uint64_t cycle;		//cycle counter of the writer
+	uint64_t stamp;		//CLOCK_TAI timestamp of the writer in ns
+};
+
+// buffered output
+struct mk_output {
+	int fd;
+	enum mk_outfmt fmt;
+	uint32_t segments;	//selected shared memories
+	char* buf;
+	size_t len;		//bytes in the buffer
+	size_t cap;		//size of the buffer
+	size_t maxrec;		//upper bound of the size of one formatted sample
+	uint64_t first;		//time of the oldest sample in the buffer
+	uint64_t interval;	//flush interval in ns, 0 flushes every sample
+	int64_t second;		//second of the cached text time
+	char clock[16];		//cached local time hh:mm:ss of the text format
+};
+
+// returns the format of a name (text, bin, json or csv) or -1 if unknown
+int mk_output_parse(const char* name);
+
+// sets up the output of samples of the selected shared memories to fd, returns 0 or -1 on error
+int mk_output_init(struct mk_output* out, int fd, enum mk_outfmt fmt, uint32_t segments);
+
+/* Formats a sample read at time (CLOCK_REALTIME in ns) into the buffer, returns 0 or -1 on a write error
+ *
+ * Only the variables with bit (1 << index) set in fields are output, e.g. the
+ * changed ones returned by mk_*_readdelta, or all with MK_OUT_ALLFIELDS. The
+ * binary stream always holds the whole struct.
+ */
+int mk_output_sample(struct mk_output* out, enum mk_shmseg seg, uint32_t inst, uint64_t time, uint64_t cycle, uint64_t stamp, const void* wire, uint64_t fields);
+
+// formats a sample of the axes shared memory like mk_output_sample, returns 0 or -1 on a write error
+int mk_output_axes(struct mk_output* out, uint32_t inst, uint64_t time, uint64_t cycle, uint64_t stamp, const struct mk_axes* axes);
+
+// writes all buffered samples, returns 0 or -1 on error
+int mk_output_flush(struct mk_output* out);
+
+// flushes and frees the buffer, does not close fd
+void mk_output_close(struct mk_output* out);
+
+#endif /* _MK_SHMOUTPUT_H_ */
@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Ring buffer layout of the shared memories (libmkshm) */
+
+#include "mk_shmring.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+/* Returns the slot at a position of the ring buffer */
+static inline struct mk_shmslot* slotat(const struct mk_shmring* ring, uint64_t pos)
+{
+        return (struct mk_shmslot*) ((char*) (ring + 1) + (pos & (ring->depth - 1)) * ring->slotsize);
+}
+
+struct mk_shmring* mk_ring_attach(struct mk_shm* shm, enum mk_shmseg seg, uint32_t depth, int flags)
+{
+        return mk_ring_attach_inst(shm,seg,mk_shm_instance(),depth,flags);
+}
+
+struct mk_shmring* mk_ring_attach_inst(struct mk_shm* shm, enum mk_shmseg seg, uint32_t inst, uint32_t depth, int flags)
+{
+        char name[64];
+        struct mk_shmring* ring;
+        uint32_t slotsize;
+        int len;
+
+        len = mk_shm_instname(name,sizeof(name),seg,inst);
+        snprintf(name + len,sizeof(name) - len,"%s",MK_SHM_RINGSUFFIX);
+        slotsize = (sizeof(struct mk_shmslot) + mk_shm_datasize(seg) + 7) & ~7U;
+        if (flags & MK_SHM_WRITER) {
+                if ((depth == 0) || (depth > MK_SHM_RINGMAXDEPTH) || (depth & (depth - 1))) {
+                        fprintf(stderr,"Ring depth %u is not a power of two up to %u\n",depth,MK_SHM_RINGMAXDEPTH);
+                        return(NULL);
+                }
+                ring = mk_shm_attachname(shm,name,sizeof(*ring) + (size_t) depth * slotsize,flags);
+                if (NULL == ring)
+                        return(NULL);
+                mk_shm_writebegin(&ring->hdr);
+                ring->depth = depth;
+                ring->slotsize = slotsize;
+                ring->datasize = mk_shm_datasize(seg);
+                ring->head = 0;
+                mk_shm_writeend(&ring->hdr);
+                return ring;
+        }
+
+        // a reader takes the depth from the existing ring buffer
+        ring = mk_shm_attachname(shm,name,0,flags);
+        if (NULL == ring)
+                return(NULL);
+        if ((shm->size < sizeof(*ring)) || (ring->depth == 0) || (ring->depth & (ring->depth - 1)) ||
+            (ring->slotsize != slotsize) || (ring->datasize != mk_shm_datasize(seg)) ||
+            (sizeof(*ring) + (size_t) ring->depth * ring->slotsize > shm->size)) {
+                fprintf(stderr,"Ring buffer %s has an invalid layout\n",name);
+                mk_shm_detach(shm);
+                return(NULL);
+        }
+        return ring;
+}
+
+void mk_ring_append(struct mk_shmring* ring, uint64_t cycle, uint64_t stamp, const void* data)
+{
+        uint64_t pos = ring->head;
+        struct mk_shmslot* slot = slotat(ring,pos);
+
+        __atomic_store_n(&slot->seq, 2 * pos + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        slot->cycle = cycle;
+        slot->stamp = stamp;
+        memcpy(mk_ring_slotdata(slot),data,ring->datasize);
+        __atomic_store_n(&slot->seq, 2 * pos + 2, __ATOMIC_RELEASE);
+        __atomic_store_n(&ring->head, pos + 1, __ATOMIC_RELEASE);
+        // seq of the header stays even and only serves as notification word
+        __atomic_store_n(&ring->hdr.seq, ring->hdr.seq + 2, __ATOMIC_RELEASE);
+        mk_shm_notify(&ring->hdr);
+}
+
+void mk_ring_cursorinit(const struct mk_shmring* ring, struct mk_ringcursor* cur)
+{
+        cur->owner = __atomic_load_n(&ring->hdr.pid, __ATOMIC_ACQUIRE);
+        cur->pos = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        cur->lost = 0;
+        cur->restarts = 0;
+}
+
+size_t mk_ring_drain(const struct mk_shmring* ring, struct mk_ringcursor* cur, void* buf, size_t max)
+{
+        uint32_t owner = __atomic_load_n(&ring->hdr.pid, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t seq;
+        struct mk_shmslot* slot;
+        struct mk_shmslot* dst;
+        size_t cnt = 0;
+
+        // the writer restarted and appends from position 0 again, a terminated writer keeps its position
+        if ((head < cur->pos) || ((owner != 0) && (owner != cur->owner))) {
+                cur->owner = owner;
+                cur->pos = (head > ring->depth) ? head - ring->depth : 0;
+                cur->lost += cur->pos;
+                cur->restarts++;
+        }
+
+        while ((cnt < max) && (cur->pos < head)) {
+                if (head - cur->pos > ring->depth) {
+                        // overtaken by the writer, continue with the oldest sample
+                        cur->lost += head - ring->depth - cur->pos;
+                        cur->pos = head - ring->depth;
+                }
+                slot = slotat(ring,cur->pos);
+                dst = mk_ring_bufslot(ring,buf,cnt);
+                seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+                if (seq == 2 * cur->pos + 2) {
+                        memcpy(dst,slot,ring->slotsize);
+                        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+                                cnt++;
+                                cur->pos++;
+                                continue;
+                        }
+                }
+                // slot was overwritten while copying it
+                cur->lost++;
+                cur->pos++;
+                head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        }
+        return cnt;
+}
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Ring buffer layout of the shared memories (libmkshm)
+ *
+ * Optionally the writer additionally appends every sample of a shared memory
+ * to a ring buffer with a configurable depth, so consumers which are slower
+ * than the writer (e.g. diagnostics or logging) do not lose cycles. The ring
+ * buffers are separate shared memories named <name of shared memory>_RING.
+ *
+ * There is one writer, which never blocks, and any number of readers, each
+ * keeping its own cursor. Every slot is protected by its own sequence number,
+ * a reader which is overtaken by the writer detects this and counts the lost
+ * samples. seq of the header is incremented by 2 on every append, so readers
+ * can wait for new samples with mk_shm_wait.
+ */
+
+#ifndef _MK_SHMRING_H_
+#define _MK_SHMRING_H_
+
+#include "mk_shmlib.h"
+
+// suffix of the names of the ring buffer shared memories
+#define MK_SHM_RINGSUFFIX "_RING"
+
+// maximum depth of a ring buffer
+#define MK_SHM_RINGMAXDEPTH (1 << 20)
+
+// header of a ring buffer shared memory, followed by depth slots
+struct mk_shmring {
+	struct mk_shmhdr hdr;
+	uint32_t depth;		//number of slots, power of two
+	uint32_t slotsize;	//size of one slot including struct mk_shmslot
+	uint32_t datasize;	//size of the struct of variables in a slot
+	uint32_t reserved;
+	uint64_t head;		//number of samples appended since start, written by writer only
+};
+
+// header of a slot, followed by the struct of variables
+struct mk_shmslot {
+	uint64_t seq;		//2*position+2 if valid, odd while written
+	uint64_t cycle;		//cycle counter of the writer
+	uint64_t stamp;		//CLOCK_TAI timestamp of the sample in ns
+};
+
+// cursor of a reader
+struct mk_ringcursor {
+	uint64_t pos;		//position of the next sample to read
+	uint64_t lost;		//number of samples overwritten before they were read
+	uint32_t owner;		//process id of the writer the position belongs to
+	uint32_t restarts;	//restarts of the writer detected
+};
+
+// returns the struct of variables of a slot
+static inline void* mk_ring_slotdata(struct mk_shmslot* slot)
+{
+	return slot + 1;
+}
+
+// returns the slot with index i of a buffer filled by mk_ring_drain
+static inline struct mk_shmslot* mk_ring_bufslot(const struct mk_shmring* ring, void* buf, size_t i)
+{
+	return (struct mk_shmslot*) ((char*) buf + i * ring->slotsize);
+}
+
+// attaches the ring buffer of a shared memory, a writer creates it with the given depth, a reader passes 0
+struct mk_shmring* mk_ring_attach(struct mk_shm* shm, enum mk_shmseg seg, uint32_t depth, int flags);
+
+// attaches the ring buffer of a shared memory of an instance of the interface like mk_ring_attach
+struct mk_shmring* mk_ring_attach_inst(struct mk_shm* shm, enum mk_shmseg seg, uint32_t inst, uint32_t depth, int flags);
+
+// appends a sample to the ring buffer and notifies waiting readers, never blocks
+void mk_ring_append(struct mk_shmring* ring, uint64_t cycle, uint64_t stamp, const void* data);
+
+// positions the cursor of a reader at the newest sample
+void mk_ring_cursorinit(const struct mk_shmring* ring, struct mk_ringcursor* cur);
+
+/* Copies up to max samples not read yet into buf and advances the cursor
+ *
+ * buf has to hold max slots of ring->slotsize bytes. Returns the number of
+ * copied slots, use mk_ring_bufslot to access them. A new writer starts the
+ * ring buffer at position 0 again; if the writer changed or head is behind
+ * the cursor, the cursor continues with the oldest sample of the new writer
+ * and the samples of the new writer already overwritten are counted as lost.
+ */
+size_t mk_ring_drain(const struct mk_shmring* ring, struct mk_ringcursor* cur, void* buf, size_t max);
+
+#endif /* _MK_SHMRING_H_ */
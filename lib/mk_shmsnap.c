@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Cycle-coherent snapshots of several shared memories (libmkshm) */
+
+#include "mk_shmsnap.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sched.h>
+
+// offsets of the variables of the shared memories in struct mk_snapshot
+static const size_t snapoffset[MK_SHM_SEGCNT] = {
+        offsetof(struct mk_snapshot,mainout),
+        offsetof(struct mk_snapshot,mainin),
+        offsetof(struct mk_snapshot,addout),
+};
+
+// sizes of the variables of the shared memories
+static const size_t snapsize[MK_SHM_SEGCNT] = {
+        sizeof(mk_mainoutput_t),
+        sizeof(mk_maininput_t),
+        sizeof(mk_additionaloutput_t),
+};
+
+void mk_snap_init(struct mk_snapset* set)
+{
+        memset(set,0,sizeof(*set));
+}
+
+void mk_snap_add(struct mk_snapset* set, enum mk_shmseg seg, const void* shm)
+{
+        if ((seg >= MK_SHM_SEGCNT) || (NULL == shm))
+                return;
+        set->hdr[seg] = (const struct mk_shmhdr*) shm;
+        switch (seg) {
+        case MK_SHM_MAINOUT:
+                set->data[seg] = &((const struct mk_mainoutput_shm*) shm)->data;
+                break;
+        case MK_SHM_MAININ:
+                set->data[seg] = &((const struct mk_maininput_shm*) shm)->data;
+                break;
+        case MK_SHM_ADDOUT:
+                set->data[seg] = &((const struct mk_additionaloutput_shm*) shm)->data;
+                break;
+        default:
+                break;
+        }
+        set->segments |= 1U << seg;
+}
+
+/* Counts the pairs of shared memories of different writers in snap whose timestamps are more than one period apart
+ *
+ * The cycle counters of different writers are independent, but both run in
+ * real time, so updates more than the longer of their periods apart mean
+ * that one writer stalled or runs with a different period. Writers which
+ * announced no period are not compared.
+ */
+static void countskew(struct mk_snapset* set, const struct mk_snapshot* snap, const uint32_t* pid)
+{
+        uint64_t period;
+        uint64_t diff;
+        uint32_t p;
+        int seg;
+        int other;
+
+        for (seg = 0; seg < MK_SHM_SEGCNT; seg++) {
+                if (!(set->segments & (1U << seg)))
+                        continue;
+                for (other = seg + 1; other < MK_SHM_SEGCNT; other++) {
+                        if (!(set->segments & (1U << other)) || (pid[other] == pid[seg]))
+                                continue;
+                        period = __atomic_load_n(&set->hdr[seg]->period, __ATOMIC_RELAXED);
+                        p = __atomic_load_n(&set->hdr[other]->period, __ATOMIC_RELAXED);
+                        if ((period == 0) || (p == 0) || (snap->stamps[seg] == 0) || (snap->stamps[other] == 0))
+                                continue;
+                        if (p > period)
+                                period = p;
+                        diff = (snap->stamps[seg] > snap->stamps[other]) ? snap->stamps[seg] - snap->stamps[other] : snap->stamps[other] - snap->stamps[seg];
+                        if (diff > period * 1000)
+                                set->skewed++;
+                }
+        }
+}
+
+int mk_snap_read(struct mk_snapset* set, struct mk_snapshot* snap, uint32_t tries)
+{
+        uint32_t seq[MK_SHM_SEGCNT];
+        uint32_t pid[MK_SHM_SEGCNT];
+        uint32_t try = 0;
+        uint32_t wait;
+        uint64_t now;
+        uint64_t deadline = 0;
+        bool torn;
+        int lag;
+        int seg;
+        int other;
+        const struct mk_shmhdr* hdr;
+
+        for (;;) {
+                for (seg = 0; seg < MK_SHM_SEGCNT; seg++) {
+                        if (!(set->segments & (1U << seg)))
+                                continue;
+                        seq[seg] = mk_shm_readbegin(set->hdr[seg]);
+                        if (seq[seg] & 1)
+                                return -1;
+                        pid[seg] = __atomic_load_n(&set->hdr[seg]->pid, __ATOMIC_RELAXED);
+                }
+                for (seg = 0; seg < MK_SHM_SEGCNT; seg++) {
+                        if (!(set->segments & (1U << seg)))
+                                continue;
+                        snap->cycles[seg] = set->hdr[seg]->cycle;
+                        snap->stamps[seg] = set->hdr[seg]->stamp;
+                        memcpy((char*) snap + snapoffset[seg],set->data[seg],snapsize[seg]);
+                }
+                torn = false;
+                snap->cycle = 0;
+                snap->stamp = 0;
+                for (seg = 0; seg < MK_SHM_SEGCNT; seg++) {
+                        if (!(set->segments & (1U << seg)))
+                                continue;
+                        if (mk_shm_readretry(set->hdr[seg],seq[seg]))
+                                torn = true;
+                        if (snap->cycles[seg] >= snap->cycle) {
+                                snap->cycle = snap->cycles[seg];
+                                snap->stamp = snap->stamps[seg];
+                        }
+                }
+                // only the shared memories of the same writer share its cycle counter
+                lag = -1;
+                for (seg = 0; !torn && (seg < MK_SHM_SEGCNT); seg++) {
+                        if (!(set->segments & (1U << seg)) || (pid[seg] == 0))
+                                continue;
+                        for (other = 0; other < MK_SHM_SEGCNT; other++) {
+                                if ((set->segments & (1U << other)) && (pid[other] == pid[seg]) && (snap->cycles[other] > snap->cycles[seg]))
+                                        lag = seg;
+                        }
+                }
+                if (!torn && (lag == -1)) {
+                        countskew(set,snap,pid);
+                        return 0;
+                }
+                // a shared memory updated during the copy leaves no consistent copy of it
+                if (++try >= tries) {
+                        if (torn)
+                                return -1;
+                        set->incoherent++;
+                        countskew(set,snap,pid);
+                        return 1;
+                }
+                set->retries++;
+                if (torn)
+                        continue;
+                // the writer is between the updates of the cycle, on a busy or single cpu it needs the cpu to finish them
+                hdr = set->hdr[lag];
+                if (try < MK_SNAP_SPINS) {
+                        mk_cpurelax();
+                        continue;
+                }
+                now = mk_shm_taitime();
+                if (deadline == 0) {
+                        wait = hdr->period ? hdr->period / MK_SNAP_WAITDIV : MK_SNAP_WAIT;
+                        deadline = now + (uint64_t) wait * 1000;
+                }
+                if (now >= deadline) {
+                        set->incoherent++;
+                        countskew(set,snap,pid);
+                        return 1;
+                }
+                if (hdr->features & MK_SHM_FEAT_NOTIFY)
+                        mk_shm_wait(hdr,seq[lag],(deadline - now) / 1000);
+                else
+                        sched_yield();
+        }
+}
@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Cycle-coherent snapshots of several shared memories (libmkshm)
+ *
+ * The writer updates the shared memories one after the other, so a reader
+ * copying them one by one may get MK_ADDOUT of cycle n+1 together with
+ * MK_MAININ of cycle n. All updates of a cycle carry the same cycle counter
+ * in the header, which serves as epoch of the snapshot: mk_snap_read takes
+ * seq of all selected shared memories, copies each of them with a single
+ * memcpy and accepts the copies only if no seq changed meanwhile and the
+ * cycle counters of all shared memories of the same writer are equal,
+ * otherwise it reads again. Shared memories of different writers, e.g.
+ * MK_MAINOUT of machinekit and MK_MAININ of the TSN side, have independent
+ * cycle counters and are only read consistently each; their timestamps are
+ * compared instead and pairs updated more than one period apart are counted
+ * as skewed, e.g. if one of the writers stalls. No lock is held, the
+ * writers are never blocked. While a shared memory lags behind, the reader
+ * spins shortly, then waits for its update if the writer notifies
+ * (MK_SHM_NOTIFY) or yields the cpu, so a writer preempted between its
+ * updates can finish the cycle, at most a fraction of the period.
+ */
+
+#ifndef _MK_SHMSNAP_H_
+#define _MK_SHMSNAP_H_
+
+#include "mk_shmlib.h"
+
+// default number of reads until a snapshot of different cycles is returned
+#define MK_SNAP_TRIES 1000
+// reads spinning before waiting for the lagging shared memory or yielding the cpu
+#define MK_SNAP_SPINS 64
+// the wait for the lagging shared memory is at most its period divided by this
+#define MK_SNAP_WAITDIV 2
+// wait for the lagging shared memory in us if its writer announced no period
+#define MK_SNAP_WAIT 500
+
+// shared memories read by a snapshot
+struct mk_snapset {
+	const struct mk_shmhdr* hdr[MK_SHM_SEGCNT];
+	const void* data[MK_SHM_SEGCNT];
+	uint32_t segments;	//bit (1 << enum mk_shmseg) set if selected
+	uint64_t retries;	//reads repeated because of an update or different cycles of the same writer
+	uint64_t incoherent;	//snapshots returned with different cycles
+	uint64_t skewed;	//pairs of shared memories of different writers returned with timestamps more than one period apart
+};
+
+// snapshot of the selected shared memories, provided by the caller
+struct mk_snapshot {
+	uint64_t cycle;		//cycle counter of the snapshot, the newest if not coherent
+	uint64_t stamp;		//timestamp of the update of this cycle
+	uint64_t cycles[MK_SHM_SEGCNT];	//cycle counters of the shared memories
+	uint64_t stamps[MK_SHM_SEGCNT];	//timestamps of the shared memories
+	mk_mainoutput_t mainout;
+	mk_maininput_t mainin;
+	mk_additionaloutput_t addout;
+};
+
+// initializes an empty set of shared memories
+void mk_snap_init(struct mk_snapset* set);
+
+// adds a shared memory of the interface, shm is the address returned by mk_shm_attach
+void mk_snap_add(struct mk_snapset* set, enum mk_shmseg seg, const void* shm);
+
+/* Copies a snapshot of the selected shared memories into snap
+ *
+ * Returns 0 if all shared memories of the same writer were read from the same
+ * cycle. If they still differ after tries reads or after waiting a fraction of
+ * the period, e.g. because a shared memory is not updated every cycle, the
+ * last read is returned with 1; each shared memory is consistent in itself
+ * then. Shared memories of different writers are not retried, but counted
+ * in skewed of set if their timestamps differ by more than the longer of
+ * their periods. Returns -1 if a writer is stuck in an update (see mk_shm_readbegin)
+ * or a shared memory was updated during each of the tries reads, snap is
+ * incomplete then.
+ */
+int mk_snap_read(struct mk_snapset* set, struct mk_snapshot* snap, uint32_t tries);
+
+#endif /* _MK_SHMSNAP_H_ */
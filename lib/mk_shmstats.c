@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Rolling window statistics of the variables (libmkshm) */
+
+#include "mk_shmstats.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define NBUCKETS (MK_STATS_BUCKETS + 1)
+
+// descriptors of the derived channels
+static const struct mk_field derived[MK_STATS_CHANCNT - MK_STATS_XFERR] = {
+        {"xferr", "X-Following Error", "mm", MK_FIELD_DOUBLE, sizeof(double), 0},
+        {"yferr", "Y-Following Error", "mm", MK_FIELD_DOUBLE, sizeof(double), 0},
+        {"zferr", "Z-Following Error", "mm", MK_FIELD_DOUBLE, sizeof(double), 0},
+        {"feed", "Feedrate effective", "mm/s", MK_FIELD_DOUBLE, sizeof(double), 0},
+};
+
+/* Clears a bucket before it is filled */
+static void clearbucket(struct mk_statsagg* agg, uint32_t bucket)
+{
+        memset(agg->buckets[bucket],0,sizeof(agg->buckets[bucket]));
+}
+
+/* Adds a value of a channel to the current bucket */
+static inline void addvalue(struct mk_statsagg* agg, uint32_t chan, double value)
+{
+        struct mk_statsbucket* b = &agg->buckets[agg->cur][chan];
+
+        if (!isfinite(value))
+                return;
+        if (b->count == 0) {
+                b->min = value;
+                b->max = value;
+        } else {
+                b->min = fmin(b->min,value);
+                b->max = fmax(b->max,value);
+        }
+        b->sum += value;
+        b->sumsq += value * value;
+        b->count++;
+        if (agg->seen[chan]) {
+                b->changes += (value != agg->last[chan]);
+                b->rises += (agg->last[chan] == 0.0) && (value != 0.0);
+        }
+        agg->last[chan] = value;
+        agg->seen[chan] = true;
+}
+
+/* Adds all variables of a struct in wire format from channel base on */
+static void addfields(struct mk_statsagg* agg, uint32_t base, enum mk_shmseg seg, const void* wire)
+{
+        const struct mk_fieldset* set = mk_shm_fields(seg);
+        uint32_t i;
+
+        for (i = 0; i < set->count; i++)
+                addvalue(agg,base + i,mk_field_value(&set->fields[i],wire));
+}
+
+void mk_stats_init(struct mk_statsagg* agg, uint32_t window)
+{
+        memset(agg,0,sizeof(*agg));
+        agg->bucketlen = window / MK_STATS_BUCKETS;
+        if (agg->bucketlen == 0)
+                agg->bucketlen = 1;
+}
+
+bool mk_stats_add(struct mk_statsagg* agg, uint64_t cycle, const struct mk_mainoutput* mainout,
+                const struct mk_additionaloutput* addout, const struct mk_maininput* mainin)
+{
+        if (agg->fill == 0)
+                agg->first[agg->cur] = cycle;
+        if (NULL != mainout)
+                addfields(agg,MK_STATS_MAINOUT,MK_SHM_MAINOUT,mainout);
+        if (NULL != addout) {
+                addfields(agg,MK_STATS_ADDOUT,MK_SHM_ADDOUT,addout);
+                addvalue(agg,MK_STATS_FEED,addout->feedrate * addout->feedoverride / 100.0);
+        }
+        if (NULL != mainin)
+                addfields(agg,MK_STATS_MAININ,MK_SHM_MAININ,mainin);
+        if ((NULL != addout) && (NULL != mainin)) {
+                addvalue(agg,MK_STATS_XFERR,addout->xpos_set - mainin->xpos_cur);
+                addvalue(agg,MK_STATS_YFERR,addout->ypos_set - mainin->ypos_cur);
+                addvalue(agg,MK_STATS_ZFERR,addout->zpos_set - mainin->zpos_cur);
+        }
+
+        if (++agg->fill < agg->bucketlen)
+                return false;
+        // the oldest bucket drops out of the window and is filled next
+        agg->fill = 0;
+        agg->cur = (agg->cur + 1) % NBUCKETS;
+        if (agg->used < MK_STATS_BUCKETS)
+                agg->used++;
+        clearbucket(agg,agg->cur);
+        return true;
+}
+
+void mk_stats_result(const struct mk_statsagg* agg, struct mk_stats* stats)
+{
+        const struct mk_statsbucket* b;
+        struct mk_stat* st;
+        double sum;
+        double sumsq;
+        uint32_t bucket;
+        uint32_t chan;
+        uint32_t i;
+
+        memset(stats,0,sizeof(*stats));
+        stats->channels = MK_STATS_CHANCNT;
+        stats->samples = agg->used * agg->bucketlen;
+        if (agg->used == 0)
+                return;
+        stats->first = agg->first[(agg->cur + NBUCKETS - agg->used) % NBUCKETS];
+        for (chan = 0; chan < MK_STATS_CHANCNT; chan++) {
+                st = &stats->chan[chan];
+                sum = 0.0;
+                sumsq = 0.0;
+                for (i = 1; i <= agg->used; i++) {
+                        bucket = (agg->cur + NBUCKETS - i) % NBUCKETS;
+                        b = &agg->buckets[bucket][chan];
+                        if (b->count == 0)
+                                continue;
+                        if (st->count == 0) {
+                                st->min = b->min;
+                                st->max = b->max;
+                        } else {
+                                st->min = fmin(st->min,b->min);
+                                st->max = fmax(st->max,b->max);
+                        }
+                        sum += b->sum;
+                        sumsq += b->sumsq;
+                        st->count += b->count;
+                        st->changes += b->changes;
+                        st->rises += b->rises;
+                }
+                if (st->count == 0)
+                        continue;
+                st->mean = sum / st->count;
+                st->rms = sqrt(sumsq / st->count);
+        }
+}
+
+struct mk_stats_shm* mk_stats_attach(struct mk_shm* shm, uint32_t inst, int flags)
+{
+        char name[64];
+        mk_shm_instkey(name,sizeof(name),MK_STATSKEY,inst);
+        return (struct mk_stats_shm*) mk_shm_attachname(shm,name,sizeof(struct mk_stats_shm),flags);
+}
+
+const struct mk_field* mk_stats_field(enum mk_statschan chan)
+{
+        if (chan < MK_STATS_ADDOUT)
+                return &mk_shm_fields(MK_SHM_MAINOUT)->fields[chan - MK_STATS_MAINOUT];
+        if (chan < MK_STATS_MAININ)
+                return &mk_shm_fields(MK_SHM_ADDOUT)->fields[chan - MK_STATS_ADDOUT];
+        if (chan < MK_STATS_XFERR)
+                return &mk_shm_fields(MK_SHM_MAININ)->fields[chan - MK_STATS_MAININ];
+        if (chan < MK_STATS_CHANCNT)
+                return &derived[chan - MK_STATS_XFERR];
+        return NULL;
+}
+
+void mk_stats_fprint(FILE* file, const struct mk_stats* stats, const char* at)
+{
+        const struct mk_field* field;
+        const struct mk_stat* st;
+        uint32_t chan;
+
+        fprintf(file, "\n##### Statistics: (%s) %u samples from cycle %llu #####\n",
+                at, stats->samples, (unsigned long long) stats->first);
+        for (chan = 0; (chan < stats->channels) && (chan < MK_STATS_CHANCNT); chan++) {
+                st = &stats->chan[chan];
+                if (st->count == 0)
+                        continue;
+                field = mk_stats_field(chan);
+                fprintf(file, "%s: min: %f %s; max: %f %s; mean: %f %s; rms: %f %s; changes: %u; rises: %u;\n",
+                        field->label, st->min, field->unit, st->max, field->unit, st->mean, field->unit,
+                        st->rms, field->unit, st->changes, st->rises);
+        }
+}
@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Rolling window statistics of the variables (libmkshm)
+ *
+ * An aggregator is fed with every sample of the writer and keeps min, max,
+ * mean, RMS, the number of changes and of rising edges (e.g. hits of a limit
+ * switch) of every variable over a window of the last cycles. Besides the
+ * variables there are derived channels: the following errors
+ * xpos_set - xpos_cur of MK_ADDOUT and MK_MAININ and the effective feedrate
+ * feedrate * feedoverride.
+ *
+ * The window consists of MK_STATS_BUCKETS buckets, each bucket covers
+ * window / MK_STATS_BUCKETS samples. Adding a sample only updates the
+ * current bucket, so it takes constant time and never allocates. When a
+ * bucket is completed, the statistics of the last window are published in
+ * the shared memory MK_STATS (MK_STATS.n of instance n) with the seqlock of
+ * the interface, so the HMI or the OPC UA server read precomputed
+ * statistics at a low rate instead of sampling the variables themselves.
+ */
+
+#ifndef _MK_SHMSTATS_H_
+#define _MK_SHMSTATS_H_
+
+#include "mk_shmlib.h"
+#include "mk_shmfields.h"
+#include <stdio.h>
+
+#define MK_STATSKEY "MK_STATS"
+// buckets of the window
+#define MK_STATS_BUCKETS 10
+
+// channels of the statistics: the variables of the shared memories, then the derived channels
+enum mk_statschan {
+	MK_STATS_MAINOUT = 0,						//first variable of mk_mainoutput
+	MK_STATS_ADDOUT = MK_STATS_MAINOUT + MK_MAINOUTPUT_FIELDCNT,	//first variable of mk_additionaloutput
+	MK_STATS_MAININ = MK_STATS_ADDOUT + MK_ADDITIONALOUTPUT_FIELDCNT,	//first variable of mk_maininput
+	MK_STATS_XFERR = MK_STATS_MAININ + MK_MAININPUT_FIELDCNT,	//following error of the X-Axis
+	MK_STATS_YFERR,							//following error of the Y-Axis
+	MK_STATS_ZFERR,							//following error of the Z-Axis
+	MK_STATS_FEED,							//effective feedrate, feedrate * feedoverride / 100
+	MK_STATS_CHANCNT
+};
+
+// statistics of a channel over the window
+struct mk_stat {
+	double min;
+	double max;
+	double mean;
+	double rms;		//root mean square
+	uint32_t count;		//number of samples, 0 if the channel was not sampled
+	uint32_t changes;	//number of samples which differ from the previous one
+	uint32_t rises;		//number of changes from zero to non zero, e.g. hits of a limit switch
+	uint32_t reserved;
+};
+
+// statistics of all channels
+struct mk_stats {
+	uint32_t channels;	//MK_STATS_CHANCNT
+	uint32_t samples;	//samples in the window
+	uint64_t first;		//cycle counter of the writer at the first sample of the window
+	struct mk_stat chan[MK_STATS_CHANCNT];
+};
+
+struct mk_stats_shm {
+	struct mk_shmhdr hdr;
+	struct mk_stats data;
+};
+
+// sums of a channel over a bucket
+struct mk_statsbucket {
+	double min;
+	double max;
+	double sum;
+	double sumsq;
+	uint32_t count;
+	uint32_t changes;
+	uint32_t rises;
+};
+
+// aggregator, fed with the samples by one thread
+struct mk_statsagg {
+	uint32_t bucketlen;		//samples per bucket
+	uint32_t fill;			//samples in the current bucket
+	uint32_t cur;			//current bucket
+	uint32_t used;			//completed buckets in the window, at most MK_STATS_BUCKETS
+	uint64_t first[MK_STATS_BUCKETS + 1];	//cycle counter of the first sample per bucket
+	double last[MK_STATS_CHANCNT];	//previous value per channel
+	bool seen[MK_STATS_CHANCNT];	//true if the channel has a previous value
+	struct mk_statsbucket buckets[MK_STATS_BUCKETS + 1][MK_STATS_CHANCNT];	//the completed ones and the current one
+};
+
+// resets the aggregator to a window of about window samples, at least one per bucket
+void mk_stats_init(struct mk_statsagg* agg, uint32_t window);
+
+/* Adds a sample of the writer, returns true if it completed a bucket
+ *
+ * The structs are in wire format, a shared memory which is not sampled is
+ * passed as NULL. The following errors need MK_ADDOUT and MK_MAININ, the
+ * effective feedrate MK_ADDOUT.
+ */
+bool mk_stats_add(struct mk_statsagg* agg, uint64_t cycle, const struct mk_mainoutput* mainout,
+		const struct mk_additionaloutput* addout, const struct mk_maininput* mainin);
+
+// computes the statistics of the completed buckets of the window
+void mk_stats_result(const struct mk_statsagg* agg, struct mk_stats* stats);
+
+// attaches the statistics shared memory of an instance of the interface like mk_shm_attach_inst
+struct mk_stats_shm* mk_stats_attach(struct mk_shm* shm, uint32_t inst, int flags);
+
+// publishes the statistics together with cycle counter and timestamp of the last sample, never blocks
+static inline void mk_stats_write(struct mk_stats_shm* shm, const struct mk_stats* src, uint64_t cycle, uint64_t stamp)
+{
+	mk_shm_write(&shm->hdr, &shm->data, src, sizeof(*src), cycle, stamp);
+}
+
+// copies a consistent snapshot of the statistics, see mk_shm_read
+static inline uint32_t mk_stats_read(const struct mk_stats_shm* shm, struct mk_stats* dst, uint64_t* cycle, uint64_t* stamp)
+{
+	return mk_shm_read(&shm->hdr, dst, &shm->data, sizeof(*dst), cycle, stamp);
+}
+
+// returns the descriptor (name, label, unit) of a channel, the offset of a derived channel is 0
+const struct mk_field* mk_stats_field(enum mk_statschan chan);
+
+// prints the statistics of all sampled channels with label and unit, at describes the time of the statistics
+void mk_stats_fprint(FILE* file, const struct mk_stats* stats, const char* at);
+
+#endif /* _MK_SHMSTATS_H_ */
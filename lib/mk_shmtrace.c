@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Binary trace files of the shared memories (libmkshm) */
+
+#include "mk_shmtrace.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+_Static_assert(sizeof(struct mk_tracehdr) <= MK_TRACE_HDRSIZE, "trace header too large");
+
+int mk_trace_create(struct mk_trace* trace, const char* path, uint64_t capacity, uint32_t segments, uint32_t period)
+{
+        int ok;
+        struct mk_tracehdr* hdr;
+
+        memset(trace,0,sizeof(*trace));
+        trace->writer = true;
+        trace->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (trace->fd == -1) {
+                perror("Trace Open failed");
+                return -1;
+        }
+        trace->maplen = MK_TRACE_HDRSIZE + capacity * sizeof(struct mk_tracerec);
+        // allocate all blocks now, so recording never waits for the filesystem
+        ok = posix_fallocate(trace->fd, 0, trace->maplen);
+        if (ok != 0) {
+                errno = ok;
+                perror("Trace Allocation failed");
+                close(trace->fd);
+                unlink(path);
+                return -1;
+        }
+        trace->hdr = mmap(NULL, trace->maplen, PROT_READ | PROT_WRITE, MAP_SHARED, trace->fd, 0);
+        if (MAP_FAILED == trace->hdr) {
+                perror("Trace Map failed");
+                close(trace->fd);
+                unlink(path);
+                return -1;
+        }
+        madvise(trace->hdr, trace->maplen, MADV_SEQUENTIAL);
+
+        hdr = trace->hdr;
+        hdr->magic = MK_TRACE_MAGIC;
+        hdr->version = MK_TRACE_VERSION;
+        hdr->layout = MK_SHM_LAYOUT_REV;
+        hdr->hash = MK_SHM_LAYOUT_HASH;
+        hdr->recsize = sizeof(struct mk_tracerec);
+        hdr->segments = segments;
+        hdr->period = period;
+        hdr->datasize[MK_SHM_MAINOUT] = sizeof(struct mk_mainoutput);
+        hdr->datasize[MK_SHM_MAININ] = sizeof(struct mk_maininput);
+        hdr->datasize[MK_SHM_ADDOUT] = sizeof(struct mk_additionaloutput);
+        hdr->dataoffset[MK_SHM_MAINOUT] = offsetof(struct mk_tracerec, mainout);
+        hdr->dataoffset[MK_SHM_MAININ] = offsetof(struct mk_tracerec, mainin);
+        hdr->dataoffset[MK_SHM_ADDOUT] = offsetof(struct mk_tracerec, addout);
+        hdr->capacity = capacity;
+        hdr->count = 0;
+        return 0;
+}
+
+int mk_trace_open(struct mk_trace* trace, const char* path)
+{
+        struct stat st;
+        struct mk_tracehdr* hdr;
+
+        memset(trace,0,sizeof(*trace));
+        trace->fd = open(path, O_RDONLY);
+        if (trace->fd == -1) {
+                perror("Trace Open failed");
+                return -1;
+        }
+        if ((fstat(trace->fd,&st) == -1) || (st.st_size < MK_TRACE_HDRSIZE)) {
+                fprintf(stderr,"Trace %s is not a trace file\n",path);
+                close(trace->fd);
+                return -1;
+        }
+        trace->maplen = st.st_size;
+        trace->hdr = mmap(NULL, trace->maplen, PROT_READ, MAP_SHARED, trace->fd, 0);
+        if (MAP_FAILED == trace->hdr) {
+                perror("Trace Map failed");
+                close(trace->fd);
+                return -1;
+        }
+        hdr = trace->hdr;
+        if ((hdr->magic != MK_TRACE_MAGIC) || (hdr->version != MK_TRACE_VERSION)) {
+                fprintf(stderr,"Trace %s is not a trace file of version %u\n",path,MK_TRACE_VERSION);
+                mk_trace_close(trace);
+                return -1;
+        }
+        // the revision also changes with the header of the shared memories, the records only depend on the structs
+        if (((hdr->hash != 0) && (hdr->hash != MK_SHM_LAYOUT_HASH)) || (hdr->recsize != sizeof(struct mk_tracerec)) ||
+            (hdr->datasize[MK_SHM_MAINOUT] != sizeof(struct mk_mainoutput)) ||
+            (hdr->datasize[MK_SHM_MAININ] != sizeof(struct mk_maininput)) ||
+            (hdr->datasize[MK_SHM_ADDOUT] != sizeof(struct mk_additionaloutput))) {
+                fprintf(stderr,"Trace %s was recorded with layout hash %08x and records of %u bytes, expected %08x and %zu bytes\n",
+                        path,hdr->hash,hdr->recsize,MK_SHM_LAYOUT_HASH,sizeof(struct mk_tracerec));
+                mk_trace_close(trace);
+                return -1;
+        }
+        if (MK_TRACE_HDRSIZE + hdr->count * hdr->recsize > trace->maplen) {
+                fprintf(stderr,"Trace %s is truncated\n",path);
+                mk_trace_close(trace);
+                return -1;
+        }
+        return 0;
+}
+
+int mk_trace_close(struct mk_trace* trace)
+{
+        int ok = 0;
+        uint64_t count;
+        if (NULL == trace->hdr)
+                return 0;
+        count = trace->hdr->count;
+        if (trace->writer) {
+                trace->hdr->capacity = count;
+                ok = msync(trace->hdr, trace->maplen, MS_SYNC);
+        }
+        munmap(trace->hdr, trace->maplen);
+        trace->hdr = NULL;
+        // give the unused preallocated space back
+        if (trace->writer && (ftruncate(trace->fd, MK_TRACE_HDRSIZE + count * sizeof(struct mk_tracerec)) == -1))
+                ok = -1;
+        close(trace->fd);
+        return ok;
+}
@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: (MIT)
+/*
+ * Copyright (c) 2020 Institute for Control Engineering of Machine Tools and Manufacturing Units, University of Stuttgart
+ * Author: Philipp Neher <philipp.neher@isw.uni-stuttgart.de>
+ */
+
+/* Binary trace files of the shared memories (libmkshm)
+ *
+ * A trace file consists of a header followed by fixed-size records, each one
+ * a timestamped snapshot of all three shared memories in wire format. The file
+ * is preallocated and memory-mapped, so recording a cycle is a copy into the
+ * mapping without any system call or allocation.
+ */
+
+#ifndef _MK_SHMTRACE_H_
+#define _MK_SHMTRACE_H_
+
+#include "mk_shmlib.h"
+#include <stdbool.h>
+
+#define MK_TRACE_MAGIC 0x45434152544b4d41ULL	// "AMKTRACE"
+#define MK_TRACE_VERSION 1
+// size of the header, the records start at this offset
+#define MK_TRACE_HDRSIZE 256
+
+// header of a trace file
+struct mk_tracehdr {
+	uint64_t magic;		//MK_TRACE_MAGIC
+	uint32_t version;	//version of the trace format, MK_TRACE_VERSION
+	uint32_t layout;	//MK_SHM_LAYOUT_REV of the recorded structs, informational
+	uint32_t recsize;	//size of one record, sizeof(struct mk_tracerec)
+	uint32_t segments;	//recorded shared memories, bit (1 << enum mk_shmseg) set if recorded
+	uint32_t period;	//sampling period of the recorder in us
+	uint32_t datasize[MK_SHM_SEGCNT];	//size of the recorded structs in wire format
+	uint32_t dataoffset[MK_SHM_SEGCNT];	//offset of the recorded structs in a record
+	uint64_t capacity;	//number of records the file has space for
+	uint64_t count;		//number of valid records
+	uint32_t hash;		//MK_SHM_LAYOUT_HASH of the recorded structs, 0 in traces of older recorders
+};
+
+// cycle counter and timestamp of the writer of a shared memory at its last update
+struct mk_tracestamp {
+	uint64_t cycle;
+	uint64_t stamp;
+};
+
+// one record of a trace file
+struct __attribute__((__packed__)) mk_tracerec {
+	uint64_t stamp;		//CLOCK_TAI timestamp in ns when the snapshot was taken
+	struct mk_tracestamp seg[MK_SHM_SEGCNT];
+	struct mk_mainoutput mainout;
+	struct mk_maininput mainin;
+	struct mk_additionaloutput addout;
+};
+
+// handle of an open trace file
+struct mk_trace {
+	int fd;
+	bool writer;
+	size_t maplen;
+	struct mk_tracehdr* hdr;
+};
+
+// creates a trace file with space for capacity records, returns 0 or -1 on error
+int mk_trace_create(struct mk_trace* trace, const char* path, uint64_t capacity, uint32_t segments, uint32_t period);
+
+// opens an existing trace file read-only and validates its header, returns 0 or -1 on error
+int mk_trace_open(struct mk_trace* trace, const char* path);
+
+// returns record i of the trace
+static inline struct mk_tracerec* mk_trace_record(const struct mk_trace* trace, uint64_t i)
+{
+	return (struct mk_tracerec*) ((char*) trace->hdr + MK_TRACE_HDRSIZE) + i;
+}
+
+// returns the next free record to be filled by the recorder or NULL if the file is full
+static inline struct mk_tracerec* mk_trace_next(const struct mk_trace* trace)
+{
+	if (trace->hdr->count >= trace->hdr->capacity)
+		return NULL;
+	return mk_trace_record(trace, trace->hdr->count);
+}
+
+// marks the record returned by mk_trace_next as valid
+static inline void mk_trace_commit(struct mk_trace* trace)
+{
+	__atomic_store_n(&trace->hdr->count, trace->hdr->count + 1, __ATOMIC_RELEASE);
+}
+
+// closes a trace file, a created file is truncated to its valid records
+int mk_trace_close(struct mk_trace* trace);
+
+#endif /* _MK_SHMTRACE_H_ */
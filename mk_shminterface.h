@@ -35,58 +35,664 @@
 #define _MK_SHMINTERFACE_H_
 
 #include <linux/types.h>
+#include <sched.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 // Names of shared memories
 #define MK_MAINOUTKEY "MK_MAINOUT"
 #define MK_ADDAOUTKEY "MK_ADDOUT"
 #define MK_MAININKEY "MK_MAININ"
+#define MK_AXESKEY "MK_AXES"
 
-// struct of main variables which are written by machinekit
+/* Field tables of the interface
+ *
+ * Every variable of the interface is listed exactly once in the tables below
+ * as X(type, name, block, unit, label). The packed wire format structs, the
+ * aligned layout, the conversions between both, the layout hash and the field
+ * descriptors of libmkshm (lib/mk_shmfields.h), which drive the formatters of
+ * the demo applications, are all generated from these tables. To add a
+ * variable, add a line to its table, increase MK_SHM_LAYOUT_REV and update
+ * the static assertions of the wire format below.
+ *
+ * block is MK_NEWBLOCK for the first variable of a block of variables which
+ * are updated together, in the aligned layout each block starts at its own
+ * cache line. Otherwise it is MK_SAMEBLOCK. unit and label are used by the
+ * formatters.
+ */
+#define MK_CACHELINE 64
+#define MK_NEWBLOCK __attribute__((__aligned__(MK_CACHELINE)))
+#define MK_SAMEBLOCK
+
+// main variables which are written by machinekit
+#define MK_MAINOUTPUT_FIELDS(X) \
+	X(double, xvel_set, MK_NEWBLOCK, "mm/s", "X-Velocity Setpoint")		/* commanded x-Velocity; set-value from control */ \
+	X(double, yvel_set, MK_SAMEBLOCK, "mm/s", "Y-Velocity Setpoint")		/* commanded y-Velocity; set-value from control */ \
+	X(double, zvel_set, MK_SAMEBLOCK, "mm/s", "Z-Velocity Setpoint")		/* commanded z-Velocity; set-value from control */ \
+	X(double, spindlespeed, MK_SAMEBLOCK, "rpm", "Spindlespeed Setpoint")		/* commanded Speed of Spindle; set-value from control */ \
+	X(bool, xenable, MK_NEWBLOCK, "", "X-Axis enabled")			/* Enable of X-Drive, True if allowed to run */ \
+	X(bool, yenable, MK_SAMEBLOCK, "", "Y-Axis enabled")			/* Enable of Y-Drive, True if allowed to run */ \
+	X(bool, zenable, MK_SAMEBLOCK, "", "Z-Axis enabled")			/* Enable of Z-Drive, True if allowed to run */ \
+	X(bool, spindleenable, MK_SAMEBLOCK, "", "Spindle enabled")		/* Enable of spindle, True if allowed to run */ \
+	X(bool, spindlebrake, MK_SAMEBLOCK, "", "Spindlebrake engaged")		/* Brake of Spindle, True if engaged; set-value from control */ \
+	X(bool, machinestatus, MK_SAMEBLOCK, "", "Machine on")			/* Status of Machine, True if machine is powered on */ \
+	X(bool, estopstatus, MK_SAMEBLOCK, "", "Emergency Stop activated")	/* Status of Emergencystop, True if Emergency stop is activated */
+
+// additional variables which are written by machinekit
+#define MK_ADDITIONALOUTPUT_FIELDS(X) \
+	X(double, feedrate, MK_NEWBLOCK, "mm/s", "Feedrate planned")		/* calculated planned feedrate */ \
+	X(double, feedoverride, MK_SAMEBLOCK, "%", "Feedrate override")		/* value of feed override, unit: percent */ \
+	X(double, xpos_set, MK_SAMEBLOCK, "mm", "X-Position Setpoint")		/* commanded x-Position; set-value from control */ \
+	X(double, ypos_set, MK_SAMEBLOCK, "mm", "Y-Position Setpoint")		/* commanded y-Position; set-value from control */ \
+	X(double, zpos_set, MK_SAMEBLOCK, "mm", "Z-Position Setpoint")		/* commanded z-Position; set-value from control */ \
+	X(int32_t, lineno, MK_NEWBLOCK, "", "Current Line Number")		/* currently active program-line */ \
+	X(uint32_t, tool, MK_SAMEBLOCK, "", "Tool Number")			/* number of current tool */ \
+	X(uint8_t, mode, MK_SAMEBLOCK, "", "Mode")				/* Operationmode: 1 = auto, 2 = mdi, 4 = manual */ \
+	X(bool, xhome, MK_SAMEBLOCK, "", "X-Axis at home")			/* Homeposition of x-axis, True if currently at home position */ \
+	X(bool, yhome, MK_SAMEBLOCK, "", "Y-Axis at home")			/* Homeposition of y-axis, True if currently at home position */ \
+	X(bool, zhome, MK_SAMEBLOCK, "", "Z-Axis at home")			/* Homeposition of z-axis, True if currently at home position */ \
+	X(bool, xhardneg, MK_SAMEBLOCK, "", "X-Axis at neg Endstop")		/* Negative Hard limit of X-Axis, True if currently at negative limit */ \
+	X(bool, xhardpos, MK_SAMEBLOCK, "", "X-Axis at pos Endstop")		/* Positiv Hard limit of X-Axis, True if currently at positiv limit */ \
+	X(bool, yhardneg, MK_SAMEBLOCK, "", "Y-Axis at neg Endstop")		/* Negative Hard limit of Y-Axis, True if currently at negative limit */ \
+	X(bool, yhardpos, MK_SAMEBLOCK, "", "Y-Axis at pos Endstop")		/* Positiv Hard limit of Y-Axis, True if currently at positiv limit */ \
+	X(bool, zhardneg, MK_SAMEBLOCK, "", "Z-Axis at neg Endstop")		/* Negative Hard limit of Z-Axis, True if currently at negative limit */ \
+	X(bool, zhardpos, MK_SAMEBLOCK, "", "Z-Axis at pos Endstop")		/* Positiv Hard limit of Z-Axis, True if currently at positiv limit */
+
+// main variables which are read by machinekit
+#define MK_MAININPUT_FIELDS(X) \
+	X(double, xpos_cur, MK_NEWBLOCK, "mm", "X-Position Current")		/* actual x-Position; feedback from the drive */ \
+	X(double, ypos_cur, MK_SAMEBLOCK, "mm", "Y-Position Current")		/* actual y-Position; feedback from the drive */ \
+	X(double, zpos_cur, MK_SAMEBLOCK, "mm", "Z-Position Current")		/* actual z-Position; feedback from the drive */ \
+	X(bool, xfault, MK_NEWBLOCK, "", "X-Axis faulty")			/* Fault of X-Drive, True if fault occured */ \
+	X(bool, yfault, MK_SAMEBLOCK, "", "Y-Axis faulty")			/* Fault of Y-Drive, True if fault occured */ \
+	X(bool, zfault, MK_SAMEBLOCK, "", "Z-Axis faulty")			/* Fault of Z-Drive, True if fault occured */
+
+#define MK_FIELD_PACKED(type, name, block, unit, label) type name;
+#define MK_FIELD_ALIGNED(type, name, block, unit, label) type name block;
+#define MK_FIELD_COPY(type, name, block, unit, label) dst->name = src->name;
+#define MK_FIELD_COUNT(type, name, block, unit, label) + 1
+
+// structs of the wire format, packed
 struct __attribute__((__packed__)) mk_mainoutput {
-	double xvel_set;	//commanded x-Velocity; set-value from control, unit: mm/s
-	double yvel_set;	//commanded y-Velocity; set-value from control, unit: mm/s
-	double zvel_set;	//commanded z-Velocity; set-value from control, unit: mm/s
-	double spindlespeed;	//commanded Speed of Spindle; set-value from control, unit: rpm
-	bool xenable;		//Enable of X-Drive, True if allowed to run
-	bool yenable;		//Enable of Y-Drive, True if allowed to run
-	bool zenable;		//Enable of Z-Drive, True if allowed to run
-	bool spindleenable;	//Enable of spindle, True if allowed to run
-	bool spindlebrake;	//Brake of Spindle, True if engaged; set-value from control
-	bool machinestatus;	//Status of Machine, True if machine is powered on
-	bool estopstatus;	//Status of Emergencystop, True if Emergency stop is activated
+	MK_MAINOUTPUT_FIELDS(MK_FIELD_PACKED)
 };
 
-// struct of additional variables which are written by machinekit
 struct __attribute__ ((__packed__)) mk_additionaloutput {
-	double feedrate;		//calculated planned feedrate, unit: mm/s
-	double feedoverride;		//value of feed override, unit: percent
-	double xpos_set;		//commanded x-Position; set-value from control, unit: mm
-	double ypos_set;		//commanded y-Position; set-value from control, unit: mm
-	double zpos_set;		//commanded z-Position; set-value from control, unit: mm
-	int32_t lineno;			//currently active program-line
-	uint32_t tool;			//number of current tool
-	uint8_t mode;          		 //Operationmode: 1 = auto, 2 = mdi, 4 = manual
-	bool xhome;			//Homeposition of x-axis, True if currently at home position
-	bool yhome;			//Homeposition of y-axis, True if currently at home position
-	bool zhome;			//Homeposition of z-axis, True if currently at home position
-	bool xhardneg;			//Negative Hard limit of X-Axis, True if currently at negative limit
-	bool xhardpos;			//Positiv Hard limit of X-Axis, True if currently at positiv limit
-	bool yhardneg;			//Negative Hard limit of X-Axis, True if currently at negative limit
-	bool yhardpos;			//Positiv Hard limit of X-Axis, True if currently at positiv limit
-	bool zhardneg;			//Negative Hard limit of X-Axis, True if currently at negative limit
-	bool zhardpos;			//Positiv Hard limit of X-Axis, True if currently at positiv limit
+	MK_ADDITIONALOUTPUT_FIELDS(MK_FIELD_PACKED)
 };
 
-// struct of main variables which are read by machinekit
 struct __attribute__ ((__packed__)) mk_maininput {
-	double xpos_cur;	//actual x-Position; feedback from the drive, unit: mm
-	double ypos_cur;	//actual y-Position; feedback from the drive, unit: mm
-	double zpos_cur;	//actual z-Position; feedback from the drive, unit: mm
-	bool xfault;		//Fault of X-Drive, True if fault occured
-	bool yfault;		//Fault of Y-Drive, True if fault occured
-	bool zfault;		//Fault of Z-Drive, True if fault occured
+	MK_MAININPUT_FIELDS(MK_FIELD_PACKED)
+};
+
+/* Aligned layout of the structs
+ *
+ * The structs above are packed, they are the wire format of the interface.
+ * With MK_SHM_LAYOUT_ALIGNED defined at compile time the shared memories hold
+ * the structs below instead: all fields are naturally aligned and each block
+ * of fields which is updated together starts at its own cache line, so
+ * processes on different cores do not bounce the cache lines of unrelated
+ * blocks. All processes using the shared memories have to be built with the
+ * same layout.
+ */
+struct mk_mainoutput_al {
+	MK_MAINOUTPUT_FIELDS(MK_FIELD_ALIGNED)
+};
+
+struct mk_additionaloutput_al {
+	MK_ADDITIONALOUTPUT_FIELDS(MK_FIELD_ALIGNED)
+};
+
+struct mk_maininput_al {
+	MK_MAININPUT_FIELDS(MK_FIELD_ALIGNED)
+};
+
+// the wire format must never change silently, a new variable updates these together with MK_SHM_LAYOUT_REV
+_Static_assert(sizeof(struct mk_mainoutput) == 39, "wire format of mk_mainoutput changed");
+_Static_assert(sizeof(struct mk_additionaloutput) == 58, "wire format of mk_additionaloutput changed");
+_Static_assert(sizeof(struct mk_maininput) == 27, "wire format of mk_maininput changed");
+_Static_assert(offsetof(struct mk_mainoutput, xenable) == 32, "wire format of mk_mainoutput changed");
+_Static_assert(offsetof(struct mk_additionaloutput, lineno) == 40, "wire format of mk_additionaloutput changed");
+_Static_assert(offsetof(struct mk_additionaloutput, mode) == 48, "wire format of mk_additionaloutput changed");
+_Static_assert(offsetof(struct mk_maininput, xfault) == 24, "wire format of mk_maininput changed");
+
+// each block of the aligned layout starts at its own cache line
+_Static_assert(offsetof(struct mk_mainoutput_al, xenable) == MK_CACHELINE, "mk_mainoutput_al is not cache line aligned");
+_Static_assert(sizeof(struct mk_mainoutput_al) == 2 * MK_CACHELINE, "mk_mainoutput_al is not cache line aligned");
+_Static_assert(offsetof(struct mk_additionaloutput_al, lineno) == MK_CACHELINE, "mk_additionaloutput_al is not cache line aligned");
+_Static_assert(offsetof(struct mk_additionaloutput_al, tool) % sizeof(uint32_t) == 0, "mk_additionaloutput_al is not naturally aligned");
+_Static_assert(sizeof(struct mk_additionaloutput_al) == 2 * MK_CACHELINE, "mk_additionaloutput_al is not cache line aligned");
+_Static_assert(offsetof(struct mk_maininput_al, xfault) == MK_CACHELINE, "mk_maininput_al is not cache line aligned");
+_Static_assert(sizeof(struct mk_maininput_al) == 2 * MK_CACHELINE, "mk_maininput_al is not cache line aligned");
+
+/* Layout hash
+ *
+ * Combines offset, size and type class of every variable of the wire format,
+ * so any change of a table which changes the binary layout also changes the
+ * hash. It is a constant expression and can be compared at compile time and
+ * at runtime by all processes sharing the interface.
+ */
+#define MK_FIELD_CLASS(type) _Generic((type) 0, double: 1u, float: 1u, bool: 2u, \
+	int8_t: 3u, int16_t: 3u, int32_t: 3u, int64_t: 3u, default: 4u)
+#define MK_FIELD_HASH(wire, type, name) \
+	+ ((uint32_t) (offsetof(struct wire, name) + 1) * 2654435761u ^ ((uint32_t) sizeof(type) << 8 | MK_FIELD_CLASS(type)) * 40503u)
+#define MK_FIELD_HASH_MAINOUT(type, name, block, unit, label) MK_FIELD_HASH(mk_mainoutput, type, name)
+#define MK_FIELD_HASH_ADDOUT(type, name, block, unit, label) MK_FIELD_HASH(mk_additionaloutput, type, name)
+#define MK_FIELD_HASH_MAININ(type, name, block, unit, label) MK_FIELD_HASH(mk_maininput, type, name)
+#define MK_MAINOUTPUT_HASH ((uint32_t) (0x4d4f5554u MK_MAINOUTPUT_FIELDS(MK_FIELD_HASH_MAINOUT)))
+#define MK_ADDITIONALOUTPUT_HASH ((uint32_t) (0x41444f55u MK_ADDITIONALOUTPUT_FIELDS(MK_FIELD_HASH_ADDOUT)))
+#define MK_MAININPUT_HASH ((uint32_t) (0x4d41494eu MK_MAININPUT_FIELDS(MK_FIELD_HASH_MAININ)))
+#define MK_SHM_LAYOUT_HASH ((uint32_t) (MK_MAINOUTPUT_HASH * 31u + MK_ADDITIONALOUTPUT_HASH * 17u + MK_MAININPUT_HASH))
+
+// conversion between the aligned layout and the wire format
+static inline void mk_mainoutput_pack(struct mk_mainoutput* dst, const struct mk_mainoutput_al* src)
+{
+	MK_MAINOUTPUT_FIELDS(MK_FIELD_COPY)
+}
+
+static inline void mk_mainoutput_unpack(struct mk_mainoutput_al* dst, const struct mk_mainoutput* src)
+{
+	MK_MAINOUTPUT_FIELDS(MK_FIELD_COPY)
+}
+
+static inline void mk_additionaloutput_pack(struct mk_additionaloutput* dst, const struct mk_additionaloutput_al* src)
+{
+	MK_ADDITIONALOUTPUT_FIELDS(MK_FIELD_COPY)
+}
+
+static inline void mk_additionaloutput_unpack(struct mk_additionaloutput_al* dst, const struct mk_additionaloutput* src)
+{
+	MK_ADDITIONALOUTPUT_FIELDS(MK_FIELD_COPY)
+}
+
+static inline void mk_maininput_pack(struct mk_maininput* dst, const struct mk_maininput_al* src)
+{
+	MK_MAININPUT_FIELDS(MK_FIELD_COPY)
+}
+
+static inline void mk_maininput_unpack(struct mk_maininput_al* dst, const struct mk_maininput* src)
+{
+	MK_MAININPUT_FIELDS(MK_FIELD_COPY)
+}
+
+/* Field indices
+ *
+ * Every variable has an index in its struct, in the order of its table. The
+ * dirty bitmaps of the shared memories have bit (1 << index) set for every
+ * changed variable, so a struct can have at most 64 variables.
+ */
+#define MK_FIELD_IDX_MAINOUT(type, name, block, unit, label) MK_MAINOUTPUT_IDX_##name,
+#define MK_FIELD_IDX_ADDOUT(type, name, block, unit, label) MK_ADDITIONALOUTPUT_IDX_##name,
+#define MK_FIELD_IDX_MAININ(type, name, block, unit, label) MK_MAININPUT_IDX_##name,
+
+enum mk_mainoutput_idx { MK_MAINOUTPUT_FIELDS(MK_FIELD_IDX_MAINOUT) };
+enum mk_additionaloutput_idx { MK_ADDITIONALOUTPUT_FIELDS(MK_FIELD_IDX_ADDOUT) };
+enum mk_maininput_idx { MK_MAININPUT_FIELDS(MK_FIELD_IDX_MAININ) };
+
+#define MK_MAINOUTPUT_FIELDCNT (0 MK_MAINOUTPUT_FIELDS(MK_FIELD_COUNT))
+#define MK_ADDITIONALOUTPUT_FIELDCNT (0 MK_ADDITIONALOUTPUT_FIELDS(MK_FIELD_COUNT))
+#define MK_MAININPUT_FIELDCNT (0 MK_MAININPUT_FIELDS(MK_FIELD_COUNT))
+
+_Static_assert(MK_MAINOUTPUT_FIELDCNT <= 64, "mk_mainoutput has more variables than the dirty bitmap");
+_Static_assert(MK_ADDITIONALOUTPUT_FIELDCNT <= 64, "mk_additionaloutput has more variables than the dirty bitmap");
+_Static_assert(MK_MAININPUT_FIELDCNT <= 64, "mk_maininput has more variables than the dirty bitmap");
+
+// bitmap with the first cnt variables set
+#define MK_FIELDMASK(cnt) ((cnt) >= 64 ? ~0ULL : (1ULL << (cnt)) - 1)
+
+/* Structs held by the shared memories in the selected layout
+ *
+ * mk_*_towire and mk_*_fromwire convert them to and from the wire format,
+ * for the packed layout this is a plain copy.
+ */
+#ifdef MK_SHM_LAYOUT_ALIGNED
+typedef struct mk_mainoutput_al mk_mainoutput_t;
+typedef struct mk_additionaloutput_al mk_additionaloutput_t;
+typedef struct mk_maininput_al mk_maininput_t;
+#define mk_mainoutput_towire mk_mainoutput_pack
+#define mk_mainoutput_fromwire mk_mainoutput_unpack
+#define mk_additionaloutput_towire mk_additionaloutput_pack
+#define mk_additionaloutput_fromwire mk_additionaloutput_unpack
+#define mk_maininput_towire mk_maininput_pack
+#define mk_maininput_fromwire mk_maininput_unpack
+#else
+typedef struct mk_mainoutput mk_mainoutput_t;
+typedef struct mk_additionaloutput mk_additionaloutput_t;
+typedef struct mk_maininput mk_maininput_t;
+#define mk_mainoutput_towire(wire, v) (*(wire) = *(v))
+#define mk_mainoutput_fromwire(v, wire) (*(v) = *(wire))
+#define mk_additionaloutput_towire(wire, v) (*(wire) = *(v))
+#define mk_additionaloutput_fromwire(v, wire) (*(v) = *(wire))
+#define mk_maininput_towire(wire, v) (*(wire) = *(v))
+#define mk_maininput_fromwire(v, wire) (*(v) = *(wire))
+#endif
+
+// Version of the layout of the shared memories, increase on every change
+#define MK_SHM_LAYOUT_REV 8
+// flag in the layout version marking the aligned layout
+#define MK_SHM_LAYOUT_ALIGNEDFLAG 0x8000
+
+#ifdef MK_SHM_LAYOUT_ALIGNED
+#define MK_SHM_LAYOUT_VERSION (MK_SHM_LAYOUT_REV | MK_SHM_LAYOUT_ALIGNEDFLAG)
+#else
+#define MK_SHM_LAYOUT_VERSION MK_SHM_LAYOUT_REV
+#endif
+
+/* Header in front of each shared memory
+ *
+ * The content of the shared memories is published with a seqlock: the writer
+ * increments seq before and after every update, so seq is odd while an update
+ * is in progress. Readers never block the writer, they copy the content and
+ * retry if seq changed meanwhile. There is only one writer per shared memory.
+ *
+ * magic, version, hash, size and naxes describe the layout the shared memory was
+ * initialized with and are checked on every attach, so processes built
+ * against different versions of this header refuse to share memory instead
+ * of interpreting garbage; naxes only for MK_AXESKEY, the only layout which
+ * depends on it. magic is written last during initialization.
+ *
+ * pid is the owner of the shared memory: a writer only attaches if there is
+ * no owner or the owner process terminated, so a crashed writer is replaced
+ * by simply starting a new one. stamp is the heartbeat of the writer, readers
+ * detect a stale or dead writer with mk_shm_writerstate (lib/mk_shmlib.h).
+ * waiters is the only field written by readers, a notifying writer only
+ * wakes them if it is nonzero (mk_shm_notify, lib/mk_shmlib.h).
+ */
+#define MK_SHM_MAGIC 0x48534b4d		// "MKSH"
+
+struct mk_shmhdr {
+	uint32_t magic;		//MK_SHM_MAGIC once the shared memory is initialized
+	uint32_t version;	//layout version of the shared memory, see MK_SHM_LAYOUT_VERSION
+	uint32_t hash;		//layout hash of the variables, see MK_SHM_LAYOUT_HASH
+	uint32_t size;		//size of the shared memory struct including this header
+	uint32_t period;	//cycle period of the writer in us, 0 if unknown
+	uint32_t features;	//features used by the writer, see MK_SHM_FEAT_*
+	uint32_t seq;		//sequence counter of the seqlock, odd while writer updates the content
+	uint32_t naxes;		//number of axes of the machine, see MK_NAXES
+	uint32_t pid;		//process id of the writer owning the shared memory, 0 if none
+	uint32_t waiters;	//readers waiting in mk_shm_wait for the next update, maintained by the readers
+	uint64_t cycle;		//cycle counter of the writer at the last update
+	uint64_t stamp;		//CLOCK_TAI timestamp of the last update in ns, 0 if never updated
+};
+
+/* Features of the writer
+ *
+ * Readers may ignore unknown compatible features (lower 16 bits). Incompatible
+ * features (upper 16 bits) change how the content has to be read, a reader
+ * refuses to attach if the writer uses one it does not know.
+ */
+#define MK_SHM_FEAT_INCOMPAT_MASK 0xffff0000
+// incompatible features known by this version
+#define MK_SHM_FEAT_INCOMPAT_KNOWN 0x00000000
+
+// the writer wakes readers waiting on seq (futex) after every update
+#define MK_SHM_FEAT_NOTIFY 0x00000001
+// the writer maintains dirty and gen of the shared memory, see mk_*_writedelta
+#define MK_SHM_FEAT_DELTA 0x00000002
+
+/* Layout of the shared memories
+ *
+ * Behind the variables each shared memory holds the change information of
+ * the last update: dirty has bit (1 << index) set for every variable changed
+ * by it and gen holds for every variable seq of the update which changed it
+ * last, both are maintained by writers using mk_*_writedelta. Readers using
+ * mk_*_readdelta copy only the variables changed since their last read.
+ */
+struct mk_mainoutput_shm {
+	struct mk_shmhdr hdr;
+	mk_mainoutput_t data;
+	uint64_t dirty;
+	uint32_t gen[MK_MAINOUTPUT_FIELDCNT];
+};
+
+struct mk_additionaloutput_shm {
+	struct mk_shmhdr hdr;
+	mk_additionaloutput_t data;
+	uint64_t dirty;
+	uint32_t gen[MK_ADDITIONALOUTPUT_FIELDCNT];
 };
 
-#endif /* _MK_SHMINTERFACE_H_ */
\ No newline at end of file
+struct mk_maininput_shm {
+	struct mk_shmhdr hdr;
+	mk_maininput_t data;
+	uint64_t dirty;
+	uint32_t gen[MK_MAININPUT_FIELDCNT];
+};
+
+/* Axes of the machine in struct-of-arrays layout
+ *
+ * The structs above name the variables of the axes X, Y and Z one by one. The
+ * optional shared memory MK_AXESKEY holds the per-axis variables of all
+ * MK_NAXES axes as arrays instead, so consumers can process all axes with
+ * SIMD instructions and test the flags of all axes with one mask operation.
+ * Axis n is element n of the arrays and bit (1 << n) of the masks, axes 0 to
+ * 2 are X, Y and Z. Each array starts at its own cache line and is padded
+ * with zeros to MK_AXES_STRIDE elements, so loops can run over whole vectors.
+ * The number of axes is fixed at compile time (-DMK_NAXES=n, make NAXES=n)
+ * and recorded in the header of every shared memory, all processes using
+ * the shared memories have to be built with the same number.
+ */
+#ifndef MK_NAXES
+#define MK_NAXES 3
+#endif
+// elements of an array, multiple of the 8 doubles of a cache line
+#define MK_AXES_STRIDE ((MK_NAXES + 7) & ~7)
+
+_Static_assert((MK_NAXES >= 3) && (MK_NAXES <= 32), "MK_NAXES has to be between 3 (X, Y, Z) and 32 (bits of the masks)");
+
+struct mk_axes {
+	double vel_set[MK_AXES_STRIDE] MK_NEWBLOCK;	//commanded velocities in mm/s; set-values from control
+	double pos_set[MK_AXES_STRIDE] MK_NEWBLOCK;	//commanded positions in mm; set-values from control
+	double pos_cur[MK_AXES_STRIDE] MK_NEWBLOCK;	//actual positions in mm; feedback from the drives
+	uint32_t enable MK_NEWBLOCK;	//drives allowed to run
+	uint32_t fault;			//faults of the drives
+	uint32_t home;			//axes currently at home position
+	uint32_t hardneg;		//axes currently at negative hard limit
+	uint32_t hardpos;		//axes currently at positive hard limit
+};
+
+struct mk_axes_shm {
+	struct mk_shmhdr hdr;
+	struct mk_axes data;
+};
+
+// mask with a bit for every axis
+#define MK_AXESMASK ((uint32_t) (MK_NAXES >= 32 ? ~0U : (1U << MK_NAXES) - 1))
+
+// hint to the cpu that we are spinning on a shared variable
+static inline void mk_cpurelax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+// starts an update of the content, makes seq odd
+static inline void mk_shm_writebegin(struct mk_shmhdr* hdr)
+{
+	uint32_t seq = __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&hdr->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// finishes an update of the content, makes seq even again
+static inline void mk_shm_writeend(struct mk_shmhdr* hdr)
+{
+	uint32_t seq = __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&hdr->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+// spins of a reader waiting for the end of an update, afterwards it yields the cpu, see mk_shm_readbegin
+#define MK_SHM_SPINMAX 4096
+// yields of the cpu after the spins until the update is given up
+#define MK_SHM_YIELDMAX 256
+
+/* Starts reading the content, waits while an update is in progress and returns seq
+ *
+ * The reader spins MK_SHM_SPINMAX times, an update takes far less, then it
+ * yields the cpu, so a writer preempted during the update can finish it. If
+ * the update does not finish within MK_SHM_YIELDMAX yields, e.g. because the
+ * writer crashed during it, the odd seq is returned and the content must not
+ * be read.
+ */
+static inline uint32_t mk_shm_readbegin(const struct mk_shmhdr* hdr)
+{
+	uint32_t seq;
+	uint32_t spins = 0;
+	while (((seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE)) & 1) && (++spins < MK_SHM_SPINMAX + MK_SHM_YIELDMAX)) {
+		if (spins < MK_SHM_SPINMAX)
+			mk_cpurelax();
+		else
+			sched_yield();
+	}
+	return seq;
+}
+
+// returns true if the content was changed since mk_shm_readbegin and must be read again
+static inline bool mk_shm_readretry(const struct mk_shmhdr* hdr, uint32_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) != seq;
+}
+
+// publishes len bytes from src into the content dst of a shared memory together with cycle counter and timestamp, never blocks
+static inline void mk_shm_write(struct mk_shmhdr* hdr, void* dst, const void* src, size_t len, uint64_t cycle, uint64_t stamp)
+{
+	mk_shm_writebegin(hdr);
+	hdr->cycle = cycle;
+	hdr->stamp = stamp;
+	memcpy(dst, src, len);
+	mk_shm_writeend(hdr);
+}
+
+/* Copies a consistent snapshot of len bytes of the content src into dst
+ *
+ * Cycle counter and timestamp of the snapshot are stored in cycle and stamp,
+ * both may be NULL. Returns seq of the snapshot. If the writer is stuck in an
+ * update (see mk_shm_readbegin) cycle and stamp are 0 and the odd seq is
+ * returned; dst may then hold a torn copy of an earlier try and must not be
+ * used.
+ */
+static inline uint32_t mk_shm_read(const struct mk_shmhdr* hdr, void* dst, const void* src, size_t len, uint64_t* cycle, uint64_t* stamp)
+{
+	uint32_t seq;
+	uint64_t c;
+	uint64_t t;
+	do {
+		seq = mk_shm_readbegin(hdr);
+		if (seq & 1) {
+			c = 0;
+			t = 0;
+			break;
+		}
+		c = hdr->cycle;
+		t = hdr->stamp;
+		memcpy(dst, src, len);
+	} while (mk_shm_readretry(hdr, seq));
+	if (cycle)
+		*cycle = c;
+	if (stamp)
+		*stamp = t;
+	return seq;
+}
+
+/* Publication of changed variables only
+ *
+ * mk_*_diff compares two structs bitwise and returns the bitmap of the
+ * variables which differ, mk_*_copydirty copies the variables of a bitmap.
+ * mk_*_writedelta publishes a struct like mk_shm_write, but copies only the
+ * changed variables and records them in dirty and gen. The first update
+ * marks all variables. A writer has to publish all updates of a shared
+ * memory with it and should attach with MK_SHM_DELTA (lib/mk_shmlib.h).
+ *
+ * mk_*_readdelta copies the variables changed since the update seen, which is
+ * then set to seq of the snapshot, and returns their bitmap. Starting with
+ * seen 0 or if the writer does not maintain gen, all variables are copied.
+ * If the writer is stuck in an update 0 is returned; variables copied by an
+ * earlier try may be torn then, so seen is reset to 0 and the next read
+ * copies all variables again.
+ * A reader must read at least once every 2^31 updates, as gen wraps around.
+ */
+#define MK_FIELD_DIFF(idx, type, name) \
+	{ type a_ = a->name, b_ = b->name; if (memcmp(&a_, &b_, sizeof(type)) != 0) dirty |= 1ULL << (idx); }
+#define MK_FIELD_DIFF_MAINOUT(type, name, block, unit, label) MK_FIELD_DIFF(MK_MAINOUTPUT_IDX_##name, type, name)
+#define MK_FIELD_DIFF_ADDOUT(type, name, block, unit, label) MK_FIELD_DIFF(MK_ADDITIONALOUTPUT_IDX_##name, type, name)
+#define MK_FIELD_DIFF_MAININ(type, name, block, unit, label) MK_FIELD_DIFF(MK_MAININPUT_IDX_##name, type, name)
+#define MK_FIELD_COPYDIRTY(idx, name) \
+	if (dirty & (1ULL << (idx))) dst->name = src->name;
+#define MK_FIELD_COPYDIRTY_MAINOUT(type, name, block, unit, label) MK_FIELD_COPYDIRTY(MK_MAINOUTPUT_IDX_##name, name)
+#define MK_FIELD_COPYDIRTY_ADDOUT(type, name, block, unit, label) MK_FIELD_COPYDIRTY(MK_ADDITIONALOUTPUT_IDX_##name, name)
+#define MK_FIELD_COPYDIRTY_MAININ(type, name, block, unit, label) MK_FIELD_COPYDIRTY(MK_MAININPUT_IDX_##name, name)
+
+// records the variables of dirty as changed by the update in progress, called between mk_shm_writebegin and mk_shm_writeend
+static inline void mk_shm_markdirty(struct mk_shmhdr* hdr, uint64_t* dirtyp, uint32_t* gen, uint64_t dirty)
+{
+	// seq is odd during the update, the update is published with seq + 1
+	uint32_t seq = __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) + 1;
+	uint64_t bits = dirty;
+	*dirtyp = dirty;
+	while (bits) {
+		gen[__builtin_ctzll(bits)] = seq;
+		bits &= bits - 1;
+	}
+}
+
+// returns the bitmap of the variables changed after the update seen, called between mk_shm_readbegin and mk_shm_readretry
+static inline uint64_t mk_shm_changed(const struct mk_shmhdr* hdr, const uint32_t* gen, uint32_t cnt, uint32_t seen)
+{
+	uint64_t changed = 0;
+	uint32_t i;
+	if ((seen == 0) || !(hdr->features & MK_SHM_FEAT_DELTA))
+		return MK_FIELDMASK(cnt);
+	for (i = 0; i < cnt; i++)
+		if ((int32_t) (gen[i] - seen) > 0)
+			changed |= 1ULL << i;
+	return changed;
+}
+
+static inline uint64_t mk_mainoutput_diff(const mk_mainoutput_t* a, const mk_mainoutput_t* b)
+{
+	uint64_t dirty = 0;
+	MK_MAINOUTPUT_FIELDS(MK_FIELD_DIFF_MAINOUT)
+	return dirty;
+}
+
+static inline void mk_mainoutput_copydirty(mk_mainoutput_t* dst, const mk_mainoutput_t* src, uint64_t dirty)
+{
+	MK_MAINOUTPUT_FIELDS(MK_FIELD_COPYDIRTY_MAINOUT)
+}
+
+static inline uint64_t mk_additionaloutput_diff(const mk_additionaloutput_t* a, const mk_additionaloutput_t* b)
+{
+	uint64_t dirty = 0;
+	MK_ADDITIONALOUTPUT_FIELDS(MK_FIELD_DIFF_ADDOUT)
+	return dirty;
+}
+
+static inline void mk_additionaloutput_copydirty(mk_additionaloutput_t* dst, const mk_additionaloutput_t* src, uint64_t dirty)
+{
+	MK_ADDITIONALOUTPUT_FIELDS(MK_FIELD_COPYDIRTY_ADDOUT)
+}
+
+static inline uint64_t mk_maininput_diff(const mk_maininput_t* a, const mk_maininput_t* b)
+{
+	uint64_t dirty = 0;
+	MK_MAININPUT_FIELDS(MK_FIELD_DIFF_MAININ)
+	return dirty;
+}
+
+static inline void mk_maininput_copydirty(mk_maininput_t* dst, const mk_maininput_t* src, uint64_t dirty)
+{
+	MK_MAININPUT_FIELDS(MK_FIELD_COPYDIRTY_MAININ)
+}
+
+// generates mk_<pfx>_writedelta and mk_<pfx>_readdelta for the shared memory of struct mk_<pfx>
+#define MK_SHM_DELTA_FUNCS(pfx, cnt) \
+static inline uint64_t mk_##pfx##_writedelta(struct mk_##pfx##_shm* shm, const mk_##pfx##_t* src, uint64_t cycle, uint64_t stamp) \
+{ \
+	uint64_t dirty = (shm->hdr.stamp == 0) ? MK_FIELDMASK(cnt) : mk_##pfx##_diff(&shm->data, src); \
+	mk_shm_writebegin(&shm->hdr); \
+	shm->hdr.cycle = cycle; \
+	shm->hdr.stamp = stamp; \
+	mk_##pfx##_copydirty(&shm->data, src, dirty); \
+	mk_shm_markdirty(&shm->hdr, &shm->dirty, shm->gen, dirty); \
+	mk_shm_writeend(&shm->hdr); \
+	return dirty; \
+} \
+static inline uint64_t mk_##pfx##_readdelta(const struct mk_##pfx##_shm* shm, mk_##pfx##_t* dst, uint32_t* seen, uint64_t* cycle, uint64_t* stamp) \
+{ \
+	uint32_t seq; \
+	uint64_t changed; \
+	uint64_t c; \
+	uint64_t t; \
+	do { \
+		seq = mk_shm_readbegin(&shm->hdr); \
+		if (seq & 1) { \
+			*seen = 0; \
+			return 0; \
+		} \
+		c = shm->hdr.cycle; \
+		t = shm->hdr.stamp; \
+		changed = mk_shm_changed(&shm->hdr, shm->gen, cnt, *seen); \
+		mk_##pfx##_copydirty(dst, &shm->data, changed); \
+	} while (mk_shm_readretry(&shm->hdr, seq)); \
+	*seen = seq; \
+	if (cycle) \
+		*cycle = c; \
+	if (stamp) \
+		*stamp = t; \
+	return changed; \
+}
+
+MK_SHM_DELTA_FUNCS(mainoutput, MK_MAINOUTPUT_FIELDCNT)
+MK_SHM_DELTA_FUNCS(additionaloutput, MK_ADDITIONALOUTPUT_FIELDCNT)
+MK_SHM_DELTA_FUNCS(maininput, MK_MAININPUT_FIELDCNT)
+
+/* Conversion between the axes struct and the variables of X, Y and Z
+ *
+ * mk_axes_gather copies the variables of X, Y and Z into axes 0 to 2 and
+ * leaves the other axes unchanged, mk_axes_scatter copies them back.
+ */
+#define MK_AXES_FLAG(mask, axis, flag) ((mask) = ((mask) & ~(1U << (axis))) | ((uint32_t) (bool) (flag) << (axis)))
+
+static inline void mk_axes_gather(struct mk_axes* axes, const mk_mainoutput_t* mainout, const mk_additionaloutput_t* addout, const mk_maininput_t* mainin)
+{
+	axes->vel_set[0] = mainout->xvel_set;
+	axes->vel_set[1] = mainout->yvel_set;
+	axes->vel_set[2] = mainout->zvel_set;
+	axes->pos_set[0] = addout->xpos_set;
+	axes->pos_set[1] = addout->ypos_set;
+	axes->pos_set[2] = addout->zpos_set;
+	axes->pos_cur[0] = mainin->xpos_cur;
+	axes->pos_cur[1] = mainin->ypos_cur;
+	axes->pos_cur[2] = mainin->zpos_cur;
+	MK_AXES_FLAG(axes->enable, 0, mainout->xenable);
+	MK_AXES_FLAG(axes->enable, 1, mainout->yenable);
+	MK_AXES_FLAG(axes->enable, 2, mainout->zenable);
+	MK_AXES_FLAG(axes->fault, 0, mainin->xfault);
+	MK_AXES_FLAG(axes->fault, 1, mainin->yfault);
+	MK_AXES_FLAG(axes->fault, 2, mainin->zfault);
+	MK_AXES_FLAG(axes->home, 0, addout->xhome);
+	MK_AXES_FLAG(axes->home, 1, addout->yhome);
+	MK_AXES_FLAG(axes->home, 2, addout->zhome);
+	MK_AXES_FLAG(axes->hardneg, 0, addout->xhardneg);
+	MK_AXES_FLAG(axes->hardneg, 1, addout->yhardneg);
+	MK_AXES_FLAG(axes->hardneg, 2, addout->zhardneg);
+	MK_AXES_FLAG(axes->hardpos, 0, addout->xhardpos);
+	MK_AXES_FLAG(axes->hardpos, 1, addout->yhardpos);
+	MK_AXES_FLAG(axes->hardpos, 2, addout->zhardpos);
+}
+
+static inline void mk_axes_scatter(mk_mainoutput_t* mainout, mk_additionaloutput_t* addout, mk_maininput_t* mainin, const struct mk_axes* axes)
+{
+	mainout->xvel_set = axes->vel_set[0];
+	mainout->yvel_set = axes->vel_set[1];
+	mainout->zvel_set = axes->vel_set[2];
+	addout->xpos_set = axes->pos_set[0];
+	addout->ypos_set = axes->pos_set[1];
+	addout->zpos_set = axes->pos_set[2];
+	mainin->xpos_cur = axes->pos_cur[0];
+	mainin->ypos_cur = axes->pos_cur[1];
+	mainin->zpos_cur = axes->pos_cur[2];
+	mainout->xenable = axes->enable & 1;
+	mainout->yenable = (axes->enable >> 1) & 1;
+	mainout->zenable = (axes->enable >> 2) & 1;
+	mainin->xfault = axes->fault & 1;
+	mainin->yfault = (axes->fault >> 1) & 1;
+	mainin->zfault = (axes->fault >> 2) & 1;
+	addout->xhome = axes->home & 1;
+	addout->yhome = (axes->home >> 1) & 1;
+	addout->zhome = (axes->home >> 2) & 1;
+	addout->xhardneg = axes->hardneg & 1;
+	addout->yhardneg = (axes->hardneg >> 1) & 1;
+	addout->zhardneg = (axes->hardneg >> 2) & 1;
+	addout->xhardpos = axes->hardpos & 1;
+	addout->yhardpos = (axes->hardpos >> 1) & 1;
+	addout->zhardpos = (axes->hardpos >> 2) & 1;
+}
+
+#endif /* _MK_SHMINTERFACE_H_ */